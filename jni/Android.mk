@@ -1,5 +1,51 @@
 LOCAL_PATH:= $(call my-dir)
 
+# Terminal engine without any dependency on the VM, built for both the
+# device and the host so it can be exercised on a workstation.
+terminal_core_src_files := \
+    Terminal.cpp \
+    ByteRing.cpp \
+    OutputQueue.cpp \
+    PtySpawn.cpp \
+    ScrollbackBudget.cpp \
+    ScrollbackLine.cpp \
+    ScrollbackSpill.cpp \
+    SlabAllocator.cpp \
+    ScreenSnapshot.cpp \
+    RunScan.cpp \
+    SessionRecording.cpp \
+    TerminalReactor.cpp \
+    TerminalSearch.cpp \
+
+terminal_core_c_includes := \
+    external/libvterm/include
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(terminal_core_src_files)
+LOCAL_C_INCLUDES := $(terminal_core_c_includes)
+
+LOCAL_CFLAGS := \
+    -Wno-unused-parameter \
+
+LOCAL_MODULE := libterminal_core
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(terminal_core_src_files)
+LOCAL_C_INCLUDES := $(terminal_core_c_includes)
+
+LOCAL_CFLAGS := \
+    -Wno-unused-parameter \
+
+LOCAL_MODULE := libterminal_core
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
@@ -7,18 +53,20 @@ LOCAL_SRC_FILES := \
     com_android_terminal_Terminal.cpp \
 
 LOCAL_C_INCLUDES += \
-    external/libvterm/include \
+    $(terminal_core_c_includes) \
     libcore/include \
     frameworks/base/include
 
 LOCAL_SHARED_LIBRARIES := \
     libandroidfw \
     libandroid_runtime \
+    libcutils \
     liblog \
     libnativehelper \
     libutils
 
 LOCAL_STATIC_LIBRARIES := \
+    libterminal_core \
     libvterm
 
 LOCAL_CFLAGS := \
@@ -28,3 +76,5 @@ LOCAL_MODULE := libjni_terminal
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/atomic.h>
+
+#include <stdlib.h>
+
+#include "ByteRing.h"
+
+namespace android {
+
+ByteRing::ByteRing() :
+        mBuf(NULL), mMask(0), mWritten(0), mRead(0) {
+}
+
+ByteRing::~ByteRing() {
+    free(mBuf);
+}
+
+bool ByteRing::init(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    char* buf = (char*) malloc(size);
+    if (buf == NULL) {
+        return false;
+    }
+    free(mBuf);
+    mBuf = buf;
+    mMask = size - 1;
+    mWritten = 0;
+    mRead = 0;
+    return true;
+}
+
+char* ByteRing::writeSpan(size_t* len) {
+    uint32_t written = mWritten;
+    uint32_t used = written - (uint32_t) android_atomic_acquire_load(&mRead);
+    uint32_t offset = written & mMask;
+    uint32_t toEnd = mMask + 1 - offset;
+    uint32_t space = mMask + 1 - used;
+    *len = space < toEnd ? space : toEnd;
+    return mBuf + offset;
+}
+
+void ByteRing::commitWrite(size_t len) {
+    android_atomic_release_store((int32_t) ((uint32_t) mWritten + len), &mWritten);
+}
+
+const char* ByteRing::readSpan(size_t* len) {
+    uint32_t read = mRead;
+    uint32_t used = (uint32_t) android_atomic_acquire_load(&mWritten) - read;
+    uint32_t offset = read & mMask;
+    uint32_t toEnd = mMask + 1 - offset;
+    *len = used < toEnd ? used : toEnd;
+    return mBuf + offset;
+}
+
+void ByteRing::commitRead(size_t len) {
+    android_atomic_release_store((int32_t) ((uint32_t) mRead + len), &mRead);
+}
+
+size_t ByteRing::writable() const {
+    uint32_t used = (uint32_t) mWritten - (uint32_t) android_atomic_acquire_load(&mRead);
+    return mMask + 1 - used;
+}
+
+} /* namespace android */
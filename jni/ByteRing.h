@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Fixed size ring of bytes passed from exactly one producer thread to
+ * exactly one consumer thread without locks. Each side owns one counter,
+ * published with release semantics and read by the other side with
+ * acquire semantics, so bytes are always visible before the counter that
+ * covers them. Spans are contiguous, so the producer can read() straight
+ * into the ring and the consumer can parse straight out of it.
+ */
+class ByteRing {
+public:
+    ByteRing();
+    ~ByteRing();
+
+    /* Allocates the ring, rounding capacity up to a power of two */
+    bool init(size_t capacity);
+
+    /*
+     * Producer side: free space after the last committed byte, up to the
+     * end of the buffer, and committing bytes written there.
+     */
+    char* writeSpan(size_t* len);
+    void commitWrite(size_t len);
+
+    /*
+     * Consumer side: committed bytes from the oldest onward, up to the end
+     * of the buffer, and releasing bytes consumed from there.
+     */
+    const char* readSpan(size_t* len);
+    void commitRead(size_t len);
+
+    /* Free space, counting both sides of the wrap. Producer only. */
+    size_t writable() const;
+
+    inline size_t capacity() const {
+        return mMask + 1;
+    }
+
+private:
+    char* mBuf;
+    uint32_t mMask;
+
+    /*
+     * Total bytes ever committed and consumed, wrapping at 2^32. Written
+     * only by the producer and consumer respectively.
+     */
+    volatile int32_t mWritten;
+    volatile int32_t mRead;
+
+    /* Disallow copying */
+    ByteRing(const ByteRing&);
+    ByteRing& operator=(const ByteRing&);
+};
+
+} /* namespace android */
+
+#endif /* BYTE_RING_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CELL_STYLE_H
+#define CELL_STYLE_H
+
+#include <stdint.h>
+
+#include <vterm.h>
+
+namespace android {
+
+typedef short unsigned int dimen_t;
+
+/* Marker libvterm places in the cell following a double-width character */
+static const uint32_t CHAR_CONTINUATION = (uint32_t) -1;
+
+/*
+ * Everything about a cell except its characters, packed into a single
+ * integer so that two cells can be compared with one instruction:
+ *
+ *   bits  0..23  background RGB
+ *   bits 24..47  foreground RGB
+ *   bits 48..58  attributes (bold, underline:2, italic, blink, reverse,
+ *                strike, font:4)
+ */
+typedef uint64_t style_key_t;
+
+enum {
+    STYLE_ATTR_BOLD = 1 << 0,
+    STYLE_ATTR_UNDERLINE_SHIFT = 1,
+    STYLE_ATTR_UNDERLINE_MASK = 3 << STYLE_ATTR_UNDERLINE_SHIFT,
+    STYLE_ATTR_ITALIC = 1 << 3,
+    STYLE_ATTR_BLINK = 1 << 4,
+    STYLE_ATTR_REVERSE = 1 << 5,
+    STYLE_ATTR_STRIKE = 1 << 6,
+    STYLE_ATTR_FONT_SHIFT = 7,
+    STYLE_ATTR_FONT_MASK = 0xf << STYLE_ATTR_FONT_SHIFT,
+};
+
+static inline uint32_t packColor(const VTermColor& color) {
+    return color.red << 16 | color.green << 8 | color.blue;
+}
+
+static inline void unpackColor(uint32_t rgb, VTermColor* color) {
+    color->red = (rgb >> 16) & 0xff;
+    color->green = (rgb >> 8) & 0xff;
+    color->blue = rgb & 0xff;
+}
+
+static inline uint32_t packAttrs(const VTermScreenCell& cell) {
+    return (cell.attrs.bold ? STYLE_ATTR_BOLD : 0)
+            | cell.attrs.underline << STYLE_ATTR_UNDERLINE_SHIFT
+            | (cell.attrs.italic ? STYLE_ATTR_ITALIC : 0)
+            | (cell.attrs.blink ? STYLE_ATTR_BLINK : 0)
+            | (cell.attrs.reverse ? STYLE_ATTR_REVERSE : 0)
+            | (cell.attrs.strike ? STYLE_ATTR_STRIKE : 0)
+            | cell.attrs.font << STYLE_ATTR_FONT_SHIFT;
+}
+
+static inline style_key_t styleKey(const VTermScreenCell& cell) {
+    return (style_key_t) packAttrs(cell) << 48
+            | (style_key_t) packColor(cell.fg) << 24
+            | packColor(cell.bg);
+}
+
+static inline uint32_t styleFg(style_key_t key) {
+    return (key >> 24) & 0xffffff;
+}
+
+static inline uint32_t styleBg(style_key_t key) {
+    return key & 0xffffff;
+}
+
+static inline uint32_t styleAttrs(style_key_t key) {
+    return key >> 48;
+}
+
+static inline void applyStyle(style_key_t key, VTermScreenCell* cell) {
+    uint32_t attrs = styleAttrs(key);
+    cell->attrs.bold = (attrs & STYLE_ATTR_BOLD) != 0;
+    cell->attrs.underline = (attrs & STYLE_ATTR_UNDERLINE_MASK) >> STYLE_ATTR_UNDERLINE_SHIFT;
+    cell->attrs.italic = (attrs & STYLE_ATTR_ITALIC) != 0;
+    cell->attrs.blink = (attrs & STYLE_ATTR_BLINK) != 0;
+    cell->attrs.reverse = (attrs & STYLE_ATTR_REVERSE) != 0;
+    cell->attrs.strike = (attrs & STYLE_ATTR_STRIKE) != 0;
+    cell->attrs.font = (attrs & STYLE_ATTR_FONT_MASK) >> STYLE_ATTR_FONT_SHIFT;
+    unpackColor(styleFg(key), &cell->fg);
+    unpackColor(styleBg(key), &cell->bg);
+}
+
+} /* namespace android */
+
+#endif /* CELL_STYLE_H */
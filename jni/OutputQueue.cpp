@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "OutputQueue.h"
+
+namespace android {
+
+static const size_t MIN_QUEUE_ALLOC = 4096;
+static const size_t DEFAULT_QUEUE_LIMIT = 1024 * 1024;
+/* Buffers grown past this by a big paste are released once drained */
+static const size_t MAX_IDLE_ALLOC = 64 * 1024;
+
+OutputQueue::OutputQueue() :
+        mBuf(NULL), mAlloc(0), mHead(0), mSize(0), mLimit(DEFAULT_QUEUE_LIMIT) {
+}
+
+OutputQueue::~OutputQueue() {
+    free(mBuf);
+}
+
+/*
+ * Resizes the ring to hold at least needed bytes, unwrapping queued bytes
+ * to the front of the new buffer.
+ */
+bool OutputQueue::grow(size_t needed) {
+    size_t alloc = mAlloc > 0 ? mAlloc : MIN_QUEUE_ALLOC;
+    while (alloc < needed) {
+        alloc *= 2;
+    }
+
+    char* buf = (char*) malloc(alloc);
+    if (buf == NULL) {
+        return false;
+    }
+
+    if (mSize > 0) {
+        size_t first = mAlloc - mHead < mSize ? mAlloc - mHead : mSize;
+        memcpy(buf, mBuf + mHead, first);
+        memcpy(buf + first, mBuf, mSize - first);
+    }
+
+    free(mBuf);
+    mBuf = buf;
+    mAlloc = alloc;
+    mHead = 0;
+    return true;
+}
+
+bool OutputQueue::append(const char* bytes, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    if (len > mLimit || mSize > mLimit - len) {
+        return false;
+    }
+    if (mSize + len > mAlloc && !grow(mSize + len)) {
+        return false;
+    }
+
+    size_t tail = (mHead + mSize) % mAlloc;
+    size_t first = mAlloc - tail < len ? mAlloc - tail : len;
+    memcpy(mBuf + tail, bytes, first);
+    memcpy(mBuf, bytes + first, len - first);
+    mSize += len;
+    return true;
+}
+
+ssize_t OutputQueue::writeTo(int fd) {
+    size_t total = 0;
+    while (mSize > 0) {
+        size_t chunk = mAlloc - mHead < mSize ? mAlloc - mHead : mSize;
+        ssize_t written = ::write(fd, mBuf + mHead, chunk);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (total > 0) {
+                break;
+            }
+            return (errno == EWOULDBLOCK) ? -EAGAIN : -errno;
+        }
+
+        mHead = (mHead + written) % mAlloc;
+        mSize -= written;
+        total += written;
+        if ((size_t) written < chunk) {
+            break;
+        }
+    }
+
+    if (mSize == 0) {
+        mHead = 0;
+        if (mAlloc > MAX_IDLE_ALLOC) {
+            free(mBuf);
+            mBuf = NULL;
+            mAlloc = 0;
+        }
+    }
+    return total;
+}
+
+void OutputQueue::clear() {
+    mHead = 0;
+    mSize = 0;
+}
+
+void OutputQueue::setLimit(size_t limit) {
+    mLimit = limit;
+}
+
+} /* namespace android */
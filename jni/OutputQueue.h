@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace android {
+
+/*
+ * Bytes waiting to be written to a nonblocking descriptor, kept in order in
+ * a ring buffer that grows by doubling up to a limit. Appends are all or
+ * nothing, so a write that doesn't fit is refused whole rather than sent
+ * in part.
+ *
+ * Not thread safe.
+ */
+class OutputQueue {
+public:
+    OutputQueue();
+    ~OutputQueue();
+
+    /* Returns false, queueing nothing, if len bytes would exceed the limit */
+    bool append(const char* bytes, size_t len);
+
+    /*
+     * Writes as much as fd accepts from the front of the queue. Returns
+     * bytes written, or a negative errno, -EAGAIN once fd is full.
+     */
+    ssize_t writeTo(int fd);
+
+    void clear();
+
+    /* Limit on queued bytes; lowering it never drops what's already queued */
+    void setLimit(size_t limit);
+
+    inline size_t size() const {
+        return mSize;
+    }
+
+    inline size_t limit() const {
+        return mLimit;
+    }
+
+private:
+    char* mBuf;
+    size_t mAlloc;
+    /* Offset of the oldest queued byte */
+    size_t mHead;
+    size_t mSize;
+    size_t mLimit;
+
+    bool grow(size_t needed);
+};
+
+} /* namespace android */
+
+#endif /* OUTPUT_QUEUE_H */
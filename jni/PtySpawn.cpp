@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "PtySpawn.h"
+
+extern char** environ;
+
+namespace android {
+
+/* Signals the shell must not inherit our dispositions for */
+static const int RESET_SIGNALS[] = { SIGINT, SIGQUIT, SIGSTOP, SIGCONT, SIGPIPE, SIGCHLD };
+
+static void writeString(int fd, const char* str) {
+    size_t len = strlen(str);
+    while (len > 0) {
+        ssize_t written = ::write(fd, str, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            return;
+        }
+        str += written;
+        len -= written;
+    }
+}
+
+/*
+ * Runs in the vforked child, borrowing the parent's memory and stack until
+ * it execs or exits, so it must not return, touch the heap, or take locks.
+ */
+static void execChild(int slave, const char* path, char* const argv[], char* const envp[],
+        const sigset_t* oldMask) {
+    if (setsid() == -1 || ioctl(slave, TIOCSCTTY, 0) == -1) {
+        _exit(127);
+    }
+    if (dup2(slave, 0) == -1 || dup2(slave, 1) == -1 || dup2(slave, 2) == -1) {
+        _exit(127);
+    }
+    if (slave > 2) {
+        close(slave);
+    }
+
+    for (size_t i = 0; i < sizeof(RESET_SIGNALS) / sizeof(RESET_SIGNALS[0]); i++) {
+        signal(RESET_SIGNALS[i], SIG_DFL);
+    }
+    sigprocmask(SIG_SETMASK, oldMask, NULL);
+
+    execve(path, argv, envp != NULL ? envp : environ);
+
+    int err = errno;
+    writeString(2, "Cannot exec(");
+    writeString(2, path);
+    writeString(2, ") - ");
+    writeString(2, strerror(err));
+    writeString(2, "\r\n");
+    _exit(127);
+}
+
+pid_t spawnPty(const char* path, char* const argv[], char* const envp[],
+        const struct termios* termios, const struct winsize* size, int* masterFd) {
+    int master = open("/dev/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master == -1) {
+        return -1;
+    }
+
+    char name[64];
+    int slave = -1;
+    if (grantpt(master) != 0 || unlockpt(master) != 0
+            || ptsname_r(master, name, sizeof(name)) != 0
+            || (slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) == -1) {
+        int err = errno;
+        close(master);
+        errno = err;
+        return -1;
+    }
+    if (termios != NULL) {
+        tcsetattr(slave, TCSANOW, termios);
+    }
+    if (size != NULL) {
+        ioctl(slave, TIOCSWINSZ, size);
+    }
+
+    // Keep our handlers from running in the child before it resets them,
+    // since they'd be running on our memory
+    sigset_t all;
+    sigset_t oldMask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &oldMask);
+
+    pid_t pid = vfork();
+    if (pid == 0) {
+        execChild(slave, path, argv, envp, &oldMask);
+    }
+    int err = errno;
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    close(slave);
+    if (pid == -1) {
+        close(master);
+        errno = err;
+        return -1;
+    }
+
+    *masterFd = master;
+    return pid;
+}
+
+} /* namespace android */
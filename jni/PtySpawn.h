@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PTY_SPAWN_H
+#define PTY_SPAWN_H
+
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <termios.h>
+
+namespace android {
+
+/*
+ * Starts path with argv and envp on a new pty, as the leader of a new
+ * session with the pty as its controlling terminal and stdio. A NULL envp
+ * passes on our own environment. On success returns the child's pid and
+ * stores the master in *masterFd, close-on-exec; otherwise returns -1 with
+ * errno set.
+ *
+ * Unlike forkpty(), the child shares our address space until it execs, so
+ * the cost doesn't grow with the size of the calling process. Failing to
+ * exec is reported on the pty itself, where the user will see it, and the
+ * child exits with status 127.
+ */
+pid_t spawnPty(const char* path, char* const argv[], char* const envp[],
+        const struct termios* termios, const struct winsize* size, int* masterFd);
+
+} /* namespace android */
+
+#endif /* PTY_SPAWN_H */
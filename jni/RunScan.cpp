@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RUN_SCAN_SSE2 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RUN_SCAN_NEON 1
+#endif
+
+#include "RunScan.h"
+
+namespace android {
+
+static inline uint16_t widenChar(uint32_t c) {
+    return (c == 0 || c == CHAR_CONTINUATION) ? ' ' : c;
+}
+
+size_t findStyleRunEnd(const style_key_t* styles, size_t start, size_t end) {
+    const style_key_t key = styles[start];
+    size_t i = start + 1;
+
+#if RUN_SCAN_SSE2
+    // SSE2 has no 64-bit compare, so compare 32-bit halves and require both
+    const __m128i pattern = _mm_set1_epi64x(key);
+    for (; i + 4 <= end; i += 4) {
+        __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (styles + i)), pattern);
+        __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (styles + i + 2)),
+                pattern);
+        if (_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xffff) {
+            break;
+        }
+    }
+#elif RUN_SCAN_NEON
+    const uint32x4_t pattern = vreinterpretq_u32_u64(vdupq_n_u64(key));
+    for (; i + 4 <= end; i += 4) {
+        uint32x4_t a = vceqq_u32(vld1q_u32((const uint32_t*) (styles + i)), pattern);
+        uint32x4_t b = vceqq_u32(vld1q_u32((const uint32_t*) (styles + i + 2)), pattern);
+        uint32x2_t m = vand_u32(vget_low_u32(vandq_u32(a, b)), vget_high_u32(vandq_u32(a, b)));
+        if ((vget_lane_u32(m, 0) & vget_lane_u32(m, 1)) != 0xffffffff) {
+            break;
+        }
+    }
+#endif
+
+    // Finish the tail, or pinpoint the mismatch inside the last block
+    while (i < end && styles[i] == key) {
+        i++;
+    }
+    return i;
+}
+
+size_t widenBmpChars(const uint32_t* chars, size_t count, uint16_t* out) {
+    size_t i = 0;
+
+#if RUN_SCAN_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i space = _mm_set1_epi32(' ');
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short) 0x8000);
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (chars + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (chars + i + 4));
+
+        // Blank out erased cells and continuations
+        __m128i blankA = _mm_or_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpeq_epi32(a, ones));
+        __m128i blankB = _mm_or_si128(_mm_cmpeq_epi32(b, zero), _mm_cmpeq_epi32(b, ones));
+        a = _mm_or_si128(_mm_andnot_si128(blankA, a), _mm_and_si128(blankA, space));
+        b = _mm_or_si128(_mm_andnot_si128(blankB, b), _mm_and_si128(blankB, space));
+
+        // Anything left above 0xffff needs a surrogate pair
+        __m128i high = _mm_or_si128(_mm_srli_epi32(a, 16), _mm_srli_epi32(b, 16));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xffff) {
+            break;
+        }
+
+        // Signed saturating pack, biased so the full unsigned range survives
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+        _mm_storeu_si128((__m128i*) (out + i), _mm_add_epi16(packed, bias16));
+    }
+#elif RUN_SCAN_NEON
+    const uint32x4_t ones = vdupq_n_u32(0xffffffff);
+    const uint32x4_t space = vdupq_n_u32(' ');
+    for (; i + 8 <= count; i += 8) {
+        uint32x4_t a = vld1q_u32(chars + i);
+        uint32x4_t b = vld1q_u32(chars + i + 4);
+
+        uint32x4_t blankA = vorrq_u32(vceqq_u32(a, vdupq_n_u32(0)), vceqq_u32(a, ones));
+        uint32x4_t blankB = vorrq_u32(vceqq_u32(b, vdupq_n_u32(0)), vceqq_u32(b, ones));
+        a = vbslq_u32(blankA, space, a);
+        b = vbslq_u32(blankB, space, b);
+
+        uint32x4_t high = vorrq_u32(vshrq_n_u32(a, 16), vshrq_n_u32(b, 16));
+        uint32x2_t h = vorr_u32(vget_low_u32(high), vget_high_u32(high));
+        if ((vget_lane_u32(h, 0) | vget_lane_u32(h, 1)) != 0) {
+            break;
+        }
+
+        vst1q_u16(out + i, vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint32_t c = chars[i];
+        if (c >= 0x10000 && c != CHAR_CONTINUATION) {
+            break;
+        }
+        out[i] = widenChar(c);
+    }
+    return i;
+}
+
+size_t findEitherChar(const uint32_t* chars, size_t start, size_t end, uint32_t a, uint32_t b) {
+    size_t i = start;
+
+#if RUN_SCAN_SSE2
+    const __m128i patternA = _mm_set1_epi32(a);
+    const __m128i patternB = _mm_set1_epi32(b);
+    for (; i + 8 <= end; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (chars + i));
+        __m128i y = _mm_loadu_si128((const __m128i*) (chars + i + 4));
+        __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(x, patternA), _mm_cmpeq_epi32(x, patternB)),
+                _mm_or_si128(_mm_cmpeq_epi32(y, patternA), _mm_cmpeq_epi32(y, patternB)));
+        if (_mm_movemask_epi8(hits) != 0) {
+            break;
+        }
+    }
+#elif RUN_SCAN_NEON
+    const uint32x4_t patternA = vdupq_n_u32(a);
+    const uint32x4_t patternB = vdupq_n_u32(b);
+    for (; i + 8 <= end; i += 8) {
+        uint32x4_t x = vld1q_u32(chars + i);
+        uint32x4_t y = vld1q_u32(chars + i + 4);
+        uint32x4_t hits = vorrq_u32(
+                vorrq_u32(vceqq_u32(x, patternA), vceqq_u32(x, patternB)),
+                vorrq_u32(vceqq_u32(y, patternA), vceqq_u32(y, patternB)));
+        uint32x2_t h = vorr_u32(vget_low_u32(hits), vget_high_u32(hits));
+        if ((vget_lane_u32(h, 0) | vget_lane_u32(h, 1)) != 0) {
+            break;
+        }
+    }
+#endif
+
+    // Finish the tail, or pinpoint the hit inside the last block
+    while (i < end && chars[i] != a && chars[i] != b) {
+        i++;
+    }
+    return i;
+}
+
+uint64_t hashRow(const uint32_t* chars, const style_key_t* styles, size_t count) {
+    // FNV-1a over whole cells rather than bytes; rows are short and this
+    // runs only for rows libvterm reported as damaged
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < count; i++) {
+        hash = (hash ^ chars[i]) * prime;
+        hash = (hash ^ styles[i]) * prime;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+} /* namespace android */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RUN_SCAN_H
+#define RUN_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CellStyle.h"
+
+namespace android {
+
+/*
+ * Row scanning primitives used by run extraction. Vectorized with SSE2 or
+ * NEON when the compiler targets them, with a scalar fallback otherwise.
+ */
+
+/*
+ * Returns the index of the first cell in (start, end) whose style differs
+ * from styles[start], or end if the whole span shares it.
+ */
+size_t findStyleRunEnd(const style_key_t* styles, size_t start, size_t end);
+
+/*
+ * Copies leading cells of chars that fit in a single UTF-16 unit into out,
+ * turning erased cells and wide character continuations into spaces. Stops
+ * at count or at the first astral character, returning cells copied.
+ */
+size_t widenBmpChars(const uint32_t* chars, size_t count, uint16_t* out);
+
+/*
+ * Returns the index of the first cell in [start, end) holding either a or
+ * b, or end if there is none.
+ */
+size_t findEitherChar(const uint32_t* chars, size_t start, size_t end, uint32_t a, uint32_t b);
+
+/*
+ * 64-bit hash of a row's codepoints and style keys, never zero, so callers
+ * can use zero for a row whose content isn't known.
+ */
+uint64_t hashRow(const uint32_t* chars, const style_key_t* styles, size_t count);
+
+} /* namespace android */
+
+#endif /* RUN_SCAN_H */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "RunScan.h"
+#include "ScreenSnapshot.h"
+
+namespace android {
+
+ScreenFrame::ScreenFrame() :
+        rows(0), cols(0), rowBase(0), defaultFg(0), defaultBg(0), scrollSeq(0), scrollOffset(0),
+        chars(NULL), styles(NULL), runStarts(NULL), runCounts(NULL), rowVersions(NULL) {
+}
+
+ScreenFrame::~ScreenFrame() {
+    free(chars);
+    free(styles);
+    free(runStarts);
+    free(runCounts);
+    free(rowVersions);
+}
+
+void ScreenFrame::resize(dimen_t _rows, dimen_t _cols) {
+    size_t cells = _rows * _cols;
+    if (cells != (size_t) rows * cols) {
+        free(chars);
+        free(styles);
+        free(runStarts);
+        chars = (uint32_t*) calloc(cells, sizeof(uint32_t));
+        styles = (style_key_t*) calloc(cells, sizeof(style_key_t));
+        runStarts = (dimen_t*) calloc(cells, sizeof(dimen_t));
+    }
+    if (_rows != rows) {
+        free(runCounts);
+        free(rowVersions);
+        runCounts = (dimen_t*) calloc(_rows, sizeof(dimen_t));
+        rowVersions = (uint32_t*) malloc(_rows * sizeof(uint32_t));
+    }
+
+    // Version zero is never current, so every row gets copied
+    memset(rowVersions, 0, _rows * sizeof(uint32_t));
+    rows = _rows;
+    cols = _cols;
+    rowBase = 0;
+}
+
+void ScreenFrame::shiftRows(uint64_t count) {
+    if (count >= rows) {
+        memset(rowVersions, 0, rows * sizeof(uint32_t));
+        return;
+    }
+
+    // Row count becomes row 0, and the old top rows come back as the bottom
+    rowBase = slot(count);
+    for (dimen_t row = rows - count; row < rows; row++) {
+        rowVersions[slot(row)] = 0;
+    }
+}
+
+void ScreenFrame::indexRow(dimen_t row) {
+    const size_t index = slot(row);
+    const style_key_t* rowStyle = styles + index * cols;
+    dimen_t* starts = runStarts + index * cols;
+    dimen_t count = 0;
+    for (size_t col = 0; col < cols; col = findStyleRunEnd(rowStyle, col, cols)) {
+        starts[count++] = col;
+    }
+    runCounts[index] = count;
+}
+
+ScreenSnapshot::ScreenSnapshot() :
+        mBack(0), mFront(1), mReady(2) {
+}
+
+int32_t ScreenSnapshot::exchange(volatile int32_t* addr, int32_t value) {
+    int32_t old;
+    do {
+        old = *addr;
+    } while (android_atomic_cas(old, value, addr) != 0);
+    return old;
+}
+
+void ScreenSnapshot::publish() {
+    int32_t old = exchange(&mReady, mBack | FLAG_FRESH);
+    mBack = old & INDEX_MASK;
+}
+
+const ScreenFrame* ScreenSnapshot::acquire() {
+    if (android_atomic_acquire_load(&mReady) & FLAG_FRESH) {
+        int32_t old = exchange(&mReady, mFront);
+        mFront = old & INDEX_MASK;
+    }
+    return &mFrames[mFront];
+}
+
+} /* namespace android */
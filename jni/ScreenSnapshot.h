@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCREEN_SNAPSHOT_H
+#define SCREEN_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CellStyle.h"
+
+namespace android {
+
+/*
+ * Copy of the visible screen at one point in time. Cells are stored as
+ * parallel arrays of base codepoints and style keys, row-major. Each row
+ * also carries the start columns of its style runs, rebuilt only when the
+ * row is copied, so clean rows never have their cells rescanned. Storage
+ * is a ring of rows starting at rowBase, so a scroll only rotates it.
+ */
+struct ScreenFrame {
+    ScreenFrame();
+    ~ScreenFrame();
+
+    /* Reallocates for new dimensions, invalidating every row */
+    void resize(dimen_t rows, dimen_t cols);
+
+    /*
+     * Moves every row up by count, as the screen did when it scrolled,
+     * invalidating the count rows exposed at the bottom.
+     */
+    void shiftRows(uint64_t count);
+
+    /* Rebuilds the run index of a row after its cells were written */
+    void indexRow(dimen_t row);
+
+    /* Where a row is stored in the per-row arrays */
+    inline size_t slot(dimen_t row) const {
+        size_t index = row + rowBase;
+        return index < rows ? index : index - rows;
+    }
+
+    inline uint32_t* rowChars(dimen_t row) {
+        return chars + slot(row) * cols;
+    }
+
+    inline const uint32_t* rowChars(dimen_t row) const {
+        return chars + slot(row) * cols;
+    }
+
+    inline style_key_t* rowStyles(dimen_t row) {
+        return styles + slot(row) * cols;
+    }
+
+    inline const style_key_t* rowStyles(dimen_t row) const {
+        return styles + slot(row) * cols;
+    }
+
+    inline const dimen_t* rowRunStarts(dimen_t row) const {
+        return runStarts + slot(row) * cols;
+    }
+
+    inline dimen_t rowRunCount(dimen_t row) const {
+        return runCounts[slot(row)];
+    }
+
+    inline uint32_t& rowVersion(dimen_t row) {
+        return rowVersions[slot(row)];
+    }
+
+    dimen_t rows;
+    dimen_t cols;
+    /* Slot holding row 0 */
+    dimen_t rowBase;
+    /* Default colors as RGB, used for cells outside the valid region */
+    uint32_t defaultFg;
+    uint32_t defaultBg;
+    /* Lines in scrollback when published, so row r is line scrollSeq + r */
+    size_t scrollSeq;
+    /* Rows the screen had scrolled up in total when published */
+    uint64_t scrollOffset;
+    uint32_t* chars;
+    style_key_t* styles;
+    /* Up to cols run start columns per row, rowRunCount() of them valid */
+    dimen_t* runStarts;
+    dimen_t* runCounts;
+
+    /* Content version of each row as of when it was copied into this frame */
+    uint32_t* rowVersions;
+};
+
+/*
+ * Triple-buffered ScreenFrame handoff between a single writer (the parser)
+ * and a single reader. The writer fills its back frame and publishes it
+ * with one atomic swap; the reader picks up the newest published frame
+ * with another. Neither side ever waits for the other, and a frame stays
+ * untouched for as long as the reader holds it.
+ *
+ * Callers with more than one reading thread must serialize them.
+ */
+class ScreenSnapshot {
+public:
+    ScreenSnapshot();
+
+    /* Writer: frame to fill before the next publish() */
+    inline ScreenFrame* backFrame() {
+        return &mFrames[mBack];
+    }
+
+    /* Writer: make the back frame the latest, taking a stale one back */
+    void publish();
+
+    /* Reader: latest published frame, valid until the next acquire() */
+    const ScreenFrame* acquire();
+
+private:
+    enum {
+        INDEX_MASK = 3,
+        /* Set when the ready frame hasn't been picked up by the reader */
+        FLAG_FRESH = 4,
+    };
+
+    static int32_t exchange(volatile int32_t* addr, int32_t value);
+
+    ScreenFrame mFrames[3];
+    int32_t mBack;
+    int32_t mFront;
+    volatile int32_t mReady;
+};
+
+} /* namespace android */
+
+#endif /* SCREEN_SNAPSHOT_H */
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+
+#include "ScrollbackBudget.h"
+
+#define DEBUG_BUDGET 0
+
+namespace android {
+
+static const size_t DEFAULT_LIMIT = 16 * 1024 * 1024;
+
+/*
+ * Going over the limit trims down to this fraction of it, so a hidden
+ * session that keeps printing isn't trimmed again on every batch.
+ */
+static const size_t LOW_WATER_NUM = 7;
+static const size_t LOW_WATER_DEN = 8;
+
+ScrollbackBudget& ScrollbackBudget::getInstance() {
+    static ScrollbackBudget* instance = new ScrollbackBudget();
+    return *instance;
+}
+
+ScrollbackBudget::ScrollbackBudget() :
+        mTotal(0), mLimit(DEFAULT_LIMIT), mTrimTarget(SIZE_MAX), mTrimVisible(false),
+        mTrimFd(-1), mTrimSession(this) {
+    mTrimFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mTrimFd == -1) {
+        ALOGE("failed to create trim eventfd: %s", strerror(errno));
+    } else if (TerminalReactor::getParseInstance().add(mTrimFd, &mTrimSession) != OK) {
+        ALOGE("failed to watch trim eventfd");
+        close(mTrimFd);
+        mTrimFd = -1;
+    }
+}
+
+void ScrollbackBudget::add(Client* client) {
+    Mutex::Autolock lock(mLock);
+    if (findLocked(client) != NULL) {
+        return;
+    }
+
+    Entry entry;
+    entry.client = client;
+    entry.bytes = 0;
+    entry.visible = false;
+    entry.lastViewed = systemTime();
+    mEntries.add(entry);
+}
+
+void ScrollbackBudget::remove(Client* client) {
+    Mutex::Autolock lock(mLock);
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries[i].client == client) {
+            mTotal -= mEntries[i].bytes;
+            mEntries.removeAt(i);
+            return;
+        }
+    }
+}
+
+void ScrollbackBudget::update(Client* client, size_t bytes) {
+    Mutex::Autolock lock(mLock);
+    Entry* entry = findLocked(client);
+    if (entry == NULL || entry->bytes == bytes) {
+        return;
+    }
+
+    mTotal = mTotal - entry->bytes + bytes;
+    entry->bytes = bytes;
+    if (mTotal > mLimit) {
+        trimLocked(mLimit / LOW_WATER_DEN * LOW_WATER_NUM, false);
+    }
+}
+
+void ScrollbackBudget::setVisible(Client* client, bool visible) {
+    Mutex::Autolock lock(mLock);
+    Entry* entry = findLocked(client);
+    if (entry == NULL || entry->visible == visible) {
+        return;
+    }
+
+    // Visible until now counts as just viewed, and so does coming back
+    entry->visible = visible;
+    entry->lastViewed = systemTime();
+}
+
+void ScrollbackBudget::setLimit(size_t bytes) {
+    Mutex::Autolock lock(mLock);
+    mLimit = bytes;
+    if (mTotal > mLimit) {
+        requestTrimLocked(mLimit / LOW_WATER_DEN * LOW_WATER_NUM, false);
+    }
+}
+
+size_t ScrollbackBudget::getLimit() {
+    Mutex::Autolock lock(mLock);
+    return mLimit;
+}
+
+size_t ScrollbackBudget::getTotal() {
+    Mutex::Autolock lock(mLock);
+    return mTotal;
+}
+
+void ScrollbackBudget::onTrimMemory(int level) {
+    Mutex::Autolock lock(mLock);
+
+    size_t target;
+    if (level >= TRIM_MEMORY_COMPLETE) {
+        target = 0;
+    } else if (level >= TRIM_MEMORY_BACKGROUND) {
+        target = mLimit / 4;
+    } else if (level >= TRIM_MEMORY_RUNNING_LOW) {
+        target = mLimit / 2;
+    } else {
+        target = mLimit / LOW_WATER_DEN * LOW_WATER_NUM;
+    }
+
+    ALOGD("trimming scrollback to %zu bytes for level %d, holding %zu", target, level, mTotal);
+    requestTrimLocked(target, level >= TRIM_MEMORY_BACKGROUND);
+}
+
+/*
+ * Leaves a trim for the parse reactor, folding it into any still waiting.
+ * Without one to hand it to, trims right here as a last resort.
+ */
+void ScrollbackBudget::requestTrimLocked(size_t target, bool includeVisible) {
+    if (mTrimFd == -1) {
+        trimLocked(target, includeVisible);
+        return;
+    }
+
+    if (target < mTrimTarget) {
+        mTrimTarget = target;
+    }
+    mTrimVisible |= includeVisible;
+
+    uint64_t one = 1;
+    if (write(mTrimFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        ALOGW("failed to signal trim eventfd: %s", strerror(errno));
+    }
+}
+
+void ScrollbackBudget::runRequestedTrim() {
+    Mutex::Autolock lock(mLock);
+    if (mTrimTarget == SIZE_MAX) {
+        return;
+    }
+    const size_t target = mTrimTarget;
+    const bool includeVisible = mTrimVisible;
+    mTrimTarget = SIZE_MAX;
+    mTrimVisible = false;
+    trimLocked(target, includeVisible);
+}
+
+bool ScrollbackBudget::TrimSession::onReadable() {
+    uint64_t count;
+    if (read(mBudget->mTrimFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        ALOGW("failed to read trim eventfd: %s", strerror(errno));
+    }
+    mBudget->runRequestedTrim();
+    return true;
+}
+
+/*
+ * Hidden sessions go before visible ones, then whichever was seen longest ago.
+ */
+bool ScrollbackBudget::trimsBefore(const Entry& a, const Entry& b) {
+    if (a.visible != b.visible) {
+        return !a.visible;
+    }
+    return a.lastViewed < b.lastViewed;
+}
+
+ScrollbackBudget::Entry* ScrollbackBudget::findLocked(Client* client) {
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries[i].client == client) {
+            return &mEntries.editItemAt(i);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Trims sessions, least recently viewed first, until the total is down to
+ * target or there's nobody left to ask. Each session is asked once, so one
+ * that can't shrink any further doesn't stall the rest.
+ */
+void ScrollbackBudget::trimLocked(size_t target, bool includeVisible) {
+    // Few sessions are ever open, so a simple insertion sort will do
+    Vector<size_t> order;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        const Entry& entry = mEntries[i];
+        if (entry.bytes == 0 || (entry.visible && !includeVisible)) {
+            continue;
+        }
+
+        size_t pos = order.size();
+        while (pos > 0 && trimsBefore(entry, mEntries[order[pos - 1]])) {
+            pos--;
+        }
+        order.insertAt(i, pos);
+    }
+
+    for (size_t i = 0; i < order.size() && mTotal > target; i++) {
+        Entry& entry = mEntries.editItemAt(order[i]);
+        size_t held = entry.client->trimScrollback(mTotal - target);
+#if DEBUG_BUDGET
+        ALOGD("trimmed client %p from %zu to %zu bytes", entry.client, entry.bytes, held);
+#endif
+        mTotal = mTotal - entry.bytes + held;
+        entry.bytes = held;
+    }
+}
+
+} /* namespace android */
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCROLLBACK_BUDGET_H
+#define SCROLLBACK_BUDGET_H
+
+#include <stddef.h>
+
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "TerminalReactor.h"
+
+namespace android {
+
+/*
+ * Process-wide limit on memory held by scrollback, shared by every session.
+ * Sessions report what they hold after each batch of output. When the total
+ * goes over the limit, sessions nobody is looking at are asked to shed
+ * history, least recently viewed first, until it's back under a low water
+ * mark. Visible sessions are left alone, so whatever is on screen keeps its
+ * full history.
+ *
+ * Trimming always runs on the parse reactor's thread, where sessions
+ * already report in, so callers on the UI thread never wait on disk or
+ * on copying history. Never call in with a session's own locks held; the
+ * budget takes them while trimming.
+ */
+class ScrollbackBudget {
+public:
+    class Client {
+    public:
+        virtual ~Client() {}
+
+        /*
+         * Releases at least bytes of memory if possible, moving history to
+         * disk where the session can, or dropping its oldest lines where it
+         * can't. Returns what the session holds afterwards.
+         */
+        virtual size_t trimScrollback(size_t bytes) = 0;
+    };
+
+    /* Levels passed to onTrimMemory(), as in ComponentCallbacks2 */
+    enum {
+        TRIM_MEMORY_RUNNING_MODERATE = 5,
+        TRIM_MEMORY_RUNNING_LOW = 10,
+        TRIM_MEMORY_RUNNING_CRITICAL = 15,
+        TRIM_MEMORY_UI_HIDDEN = 20,
+        TRIM_MEMORY_BACKGROUND = 40,
+        TRIM_MEMORY_MODERATE = 60,
+        TRIM_MEMORY_COMPLETE = 80,
+    };
+
+    static ScrollbackBudget& getInstance();
+
+    void add(Client* client);
+    /* Once this returns, the client is not being trimmed and never will be */
+    void remove(Client* client);
+
+    /*
+     * Records what client holds now, trimming others if that's too much.
+     * Only called from the parse reactor.
+     */
+    void update(Client* client, size_t bytes);
+
+    /*
+     * Marks client as on screen or not. Hidden clients are trimmed in the
+     * order they were last visible.
+     */
+    void setVisible(Client* client, bool visible);
+
+    /* Trims down to a new, lower limit later on the parse reactor */
+    void setLimit(size_t bytes);
+    size_t getLimit();
+    size_t getTotal();
+
+    /*
+     * Responds to memory pressure reported by the system. The deeper the
+     * level, the further below the limit hidden sessions are trimmed. Once
+     * the app itself is in the background, visible sessions are fair game
+     * too, after all the others. Only records the target; the trim runs
+     * later on the parse reactor.
+     */
+    void onTrimMemory(int level);
+
+private:
+    ScrollbackBudget();
+
+    /* Runs requested trims when its eventfd is signalled */
+    class TrimSession : public TerminalReactor::Session {
+    public:
+        TrimSession(ScrollbackBudget* budget) : mBudget(budget) {}
+
+        virtual bool onReadable();
+        virtual void onWritable() {}
+        virtual nsecs_t getDeadline() { return -1; }
+        virtual void onDeadline(nsecs_t now) {}
+
+    private:
+        ScrollbackBudget* mBudget;
+    };
+
+    struct Entry {
+        Client* client;
+        size_t bytes;
+        bool visible;
+        /* When the client was last on screen */
+        nsecs_t lastViewed;
+    };
+
+    static bool trimsBefore(const Entry& a, const Entry& b);
+    Entry* findLocked(Client* client);
+    void trimLocked(size_t target, bool includeVisible);
+    void requestTrimLocked(size_t target, bool includeVisible);
+    void runRequestedTrim();
+
+    Mutex mLock;
+    Vector<Entry> mEntries;
+    size_t mTotal;
+    size_t mLimit;
+
+    /*
+     * Lowest target asked for since the last trim ran, or SIZE_MAX for
+     * none, and whether visible sessions may be trimmed to reach it.
+     */
+    size_t mTrimTarget;
+    bool mTrimVisible;
+    /* eventfd waking mTrimSession, or -1 to trim on the caller's thread */
+    int mTrimFd;
+    TrimSession mTrimSession;
+};
+
+} /* namespace android */
+
+#endif /* SCROLLBACK_BUDGET_H */
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <utils/Log.h>
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ScrollbackLine.h"
+
+namespace android {
+
+/* CHAR_CONTINUATION when codepoints are stored in 16 bits */
+static const uint16_t CHAR_CONTINUATION_16 = 0xffff;
+
+static const size_t MAX_STYLES = 0xffff;
+
+static inline size_t hashStyle(style_key_t key, size_t mask) {
+    return (size_t) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+StyleTable::StyleTable() :
+        mKeys(NULL), mCount(0), mCapacity(0), mSlots(NULL), mSlotMask(0),
+        mLastKey(0), mLastId(0) {
+}
+
+StyleTable::~StyleTable() {
+    free(mKeys);
+    free(mSlots);
+}
+
+void StyleTable::rehash(size_t slotCount) {
+    free(mSlots);
+    mSlots = (uint16_t*) calloc(slotCount, sizeof(uint16_t));
+    mSlotMask = slotCount - 1;
+
+    for (size_t id = 0; id < mCount; id++) {
+        size_t slot = hashStyle(mKeys[id], mSlotMask);
+        while (mSlots[slot] != 0) {
+            slot = (slot + 1) & mSlotMask;
+        }
+        mSlots[slot] = id + 1;
+    }
+}
+
+uint16_t StyleTable::intern(style_key_t key) {
+    // Consecutive runs very often share a style
+    if (mCount > 0 && key == mLastKey) {
+        return mLastId;
+    }
+
+    if (mSlots != NULL) {
+        size_t slot = hashStyle(key, mSlotMask);
+        while (mSlots[slot] != 0) {
+            uint16_t id = mSlots[slot] - 1;
+            if (mKeys[id] == key) {
+                mLastKey = key;
+                mLastId = id;
+                return id;
+            }
+            slot = (slot + 1) & mSlotMask;
+        }
+    }
+
+    if (mCount == MAX_STYLES) {
+        // Pathological; render with the first style we ever saw
+        ALOGW("style table full, dropping style %llx", (unsigned long long) key);
+        return 0;
+    }
+
+    if (mCount == mCapacity) {
+        mCapacity = mCapacity ? mCapacity * 2 : 64;
+        mKeys = (style_key_t*) realloc(mKeys, mCapacity * sizeof(style_key_t));
+    }
+
+    uint16_t id = mCount++;
+    mKeys[id] = key;
+
+    // Keep load factor at or below one half
+    if (mCount * 2 > mSlotMask + 1) {
+        rehash(mSlots == NULL ? 128 : (mSlotMask + 1) * 2);
+    } else {
+        size_t slot = hashStyle(key, mSlotMask);
+        while (mSlots[slot] != 0) {
+            slot = (slot + 1) & mSlotMask;
+        }
+        mSlots[slot] = id + 1;
+    }
+
+    mLastKey = key;
+    mLastId = id;
+    return id;
+}
+
+ScrollbackLine::ScrollbackLine(dimen_t _cols, dimen_t len, uint16_t runCount,
+        uint16_t fillStyle, uint16_t extraCount, uint8_t flags) :
+        cols(_cols), mLen(len), mRunCount(runCount), mFillStyle(fillStyle),
+        mExtraCount(extraCount), mFlags(flags) {
+}
+
+size_t ScrollbackLine::payloadSize(dimen_t len, uint16_t runCount, uint16_t extraCount,
+        uint8_t flags) {
+    size_t charBytes = len * ((flags & FLAG_WIDE_CHARS) ? 4 : 2);
+    return runCount * sizeof(StyleRun) + ((charBytes + 3) & ~3)
+            + extraCount * sizeof(uint32_t);
+}
+
+ScrollbackLine* ScrollbackLine::create(SlabAllocator& heap, StyleTable& styles,
+        dimen_t cols, const VTermScreenCell* cells, bool wrapped) {
+    // Trim trailing erased cells that share the style of the last column
+    style_key_t fillKey = cols > 0 ? styleKey(cells[cols - 1]) : 0;
+    dimen_t len = cols;
+    while (len > 0 && cells[len - 1].chars[0] == 0 && styleKey(cells[len - 1]) == fillKey) {
+        len--;
+    }
+
+    // First pass measures the packed encoding
+    size_t runCount = 0;
+    size_t extraCount = 0;
+    uint8_t flags = wrapped ? FLAG_WRAPPED : 0;
+    style_key_t lastKey = 0;
+    for (dimen_t col = 0; col < len; col++) {
+        const VTermScreenCell& cell = cells[col];
+        style_key_t key = styleKey(cell);
+        if (col == 0 || key != lastKey) {
+            runCount++;
+            lastKey = key;
+        }
+
+        uint32_t c = cell.chars[0];
+        if (c == CHAR_CONTINUATION) {
+            continue;
+        }
+        if (c >= CHAR_CONTINUATION_16) {
+            flags |= FLAG_WIDE_CHARS;
+        }
+        if (c != 0 && cell.chars[1] != 0) {
+            size_t n = 1;
+            while (n < VTERM_MAX_CHARS_PER_CELL - 1 && cell.chars[n + 1] != 0) {
+                n++;
+            }
+            extraCount += 1 + n;
+        }
+    }
+
+    if (runCount > 0xffff || extraCount > 0xffff) {
+        // Can't happen with dimen_t columns and a bounded number of
+        // combining characters, but never write past the allocation
+        ALOGE("scrollback line too complex to pack");
+        runCount = 0;
+        extraCount = 0;
+        len = 0;
+    }
+
+    size_t size = sizeof(ScrollbackLine) + payloadSize(len, runCount, extraCount, flags);
+    void* mem = heap.alloc(size);
+    if (mem == NULL) {
+        return NULL;
+    }
+
+    ScrollbackLine* line = new (mem) ScrollbackLine(cols, len, runCount,
+            styles.intern(fillKey), extraCount, flags);
+
+    // Second pass writes runs, codepoints and combining records
+    StyleRun* run = line->runs() - 1;
+    uint16_t* chars16 = (uint16_t*) line->chars();
+    uint32_t* chars32 = (uint32_t*) line->chars();
+    uint32_t* extra = line->extras();
+    for (dimen_t col = 0; col < len; col++) {
+        const VTermScreenCell& cell = cells[col];
+        style_key_t key = styleKey(cell);
+        if (col == 0 || key != lastKey) {
+            run++;
+            run->start = col;
+            run->style = styles.intern(key);
+            lastKey = key;
+        }
+
+        uint32_t c = cell.chars[0];
+        if (flags & FLAG_WIDE_CHARS) {
+            chars32[col] = c;
+        } else {
+            chars16[col] = (c == CHAR_CONTINUATION) ? CHAR_CONTINUATION_16 : c;
+        }
+
+        if (c != 0 && c != CHAR_CONTINUATION && cell.chars[1] != 0) {
+            uint32_t* header = extra++;
+            size_t n = 0;
+            while (n < VTERM_MAX_CHARS_PER_CELL - 1 && cell.chars[n + 1] != 0) {
+                *extra++ = cell.chars[n + 1];
+                n++;
+            }
+            *header = col | n << 16;
+        }
+    }
+
+    return line;
+}
+
+void ScrollbackLine::destroy(SlabAllocator& heap, ScrollbackLine* line) {
+    if (line != NULL) {
+        size_t size = line->byteSize();
+        line->~ScrollbackLine();
+        heap.free(line, size);
+    }
+}
+
+ScrollbackLine* ScrollbackLine::clone(SlabAllocator& heap, const ScrollbackLine* line) {
+    // Header and payload are plain data in one block, so bytes copy as is
+    size_t size = line->byteSize();
+    void* mem = heap.alloc(size);
+    if (mem == NULL) {
+        return NULL;
+    }
+    memcpy(mem, line, size);
+    return reinterpret_cast<ScrollbackLine*>(mem);
+}
+
+size_t ScrollbackLine::byteSize() const {
+    return sizeof(ScrollbackLine) + payloadSize(mLen, mRunCount, mExtraCount, mFlags);
+}
+
+uint32_t ScrollbackLine::charAt(dimen_t col) const {
+    if (mFlags & FLAG_WIDE_CHARS) {
+        return ((const uint32_t*) chars())[col];
+    } else {
+        uint16_t c = ((const uint16_t*) chars())[col];
+        return c == CHAR_CONTINUATION_16 ? CHAR_CONTINUATION : c;
+    }
+}
+
+void ScrollbackLine::fillCell(uint32_t rawChar, dimen_t col, VTermScreenCell* cell) const {
+    cell->chars[0] = rawChar;
+    cell->chars[1] = 0;
+    cell->width = (col + 1 < mLen && charAt(col + 1) == CHAR_CONTINUATION) ? 2 : 1;
+
+    if (mExtraCount == 0 || rawChar == 0 || rawChar == CHAR_CONTINUATION) {
+        return;
+    }
+
+    const uint32_t* extra = extras();
+    const uint32_t* end = extra + mExtraCount;
+    while (extra < end) {
+        dimen_t extraCol = *extra & 0xffff;
+        size_t n = *extra >> 16;
+        if (extraCol == col) {
+            memcpy(cell->chars + 1, extra + 1, n * sizeof(uint32_t));
+            if (n + 1 < VTERM_MAX_CHARS_PER_CELL) {
+                cell->chars[n + 1] = 0;
+            }
+            return;
+        } else if (extraCol > col) {
+            return;
+        }
+        extra += 1 + n;
+    }
+}
+
+void ScrollbackLine::expand(const StyleTable& styles, dimen_t cols,
+        VTermScreenCell* cells) const {
+    dimen_t n = cols > mLen ? mLen : cols;
+
+    const StyleRun* run = runs();
+    const StyleRun* end = run + mRunCount;
+    style_key_t key = 0;
+    for (dimen_t col = 0; col < n; col++) {
+        if (run < end && run->start == col) {
+            key = styles.get(run->style);
+            run++;
+        }
+        applyStyle(key, &cells[col]);
+        fillCell(charAt(col), col, &cells[col]);
+    }
+
+    if (n < cols) {
+        VTermScreenCell blank;
+        applyStyle(styles.get(mFillStyle), &blank);
+        blank.chars[0] = 0;
+        blank.width = 1;
+        for (dimen_t col = n; col < cols; col++) {
+            cells[col] = blank;
+        }
+    }
+}
+
+dimen_t ScrollbackLine::expandRow(const StyleTable& styles, dimen_t cols, uint32_t* chars,
+        style_key_t* keys, dimen_t* runStarts) const {
+    dimen_t n = cols > mLen ? mLen : cols;
+    dimen_t runCount = 0;
+
+    const StyleRun* run = runs();
+    const StyleRun* end = run + mRunCount;
+    style_key_t key = 0;
+    for (dimen_t col = 0; col < n; col++) {
+        if (run < end && run->start == col) {
+            key = styles.get(run->style);
+            runStarts[runCount++] = col;
+            run++;
+        }
+        keys[col] = key;
+        chars[col] = charAt(col);
+    }
+
+    if (n < cols) {
+        // Trimmed tail only starts a run if its style differs
+        style_key_t fillKey = styles.get(mFillStyle);
+        if (n == 0 || fillKey != key) {
+            runStarts[runCount++] = n;
+        }
+        for (dimen_t col = n; col < cols; col++) {
+            keys[col] = fillKey;
+            chars[col] = 0;
+        }
+    }
+    return runCount;
+}
+
+void ScrollbackLine::expandChars(dimen_t cols, uint32_t* chars) const {
+    dimen_t n = cols > mLen ? mLen : cols;
+    if (mFlags & FLAG_WIDE_CHARS) {
+        memcpy(chars, this->chars(), n * sizeof(uint32_t));
+    } else {
+        for (dimen_t col = 0; col < n; col++) {
+            chars[col] = charAt(col);
+        }
+    }
+    if (n < cols) {
+        memset(chars + n, 0, (cols - n) * sizeof(uint32_t));
+    }
+}
+
+void ScrollbackLine::getCell(const StyleTable& styles, dimen_t col,
+        VTermScreenCell* cell) const {
+    if (col >= mLen) {
+        applyStyle(styles.get(mFillStyle), cell);
+        cell->chars[0] = 0;
+        cell->width = 1;
+        return;
+    }
+
+    // Find last run starting at or before col
+    size_t lo = 0;
+    size_t hi = mRunCount;
+    const StyleRun* r = runs();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (r[mid].start <= col) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    applyStyle(styles.get(r[lo].style), cell);
+    fillCell(charAt(col), col, cell);
+}
+
+} /* namespace android */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCROLLBACK_LINE_H
+#define SCROLLBACK_LINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vterm.h>
+
+#include "CellStyle.h"
+#include "SlabAllocator.h"
+
+namespace android {
+
+/*
+ * Interns style keys into small integer IDs shared by all scrollback lines
+ * of a session. IDs are stable for the lifetime of the table.
+ */
+class StyleTable {
+public:
+    StyleTable();
+    ~StyleTable();
+
+    uint16_t intern(style_key_t key);
+
+    inline style_key_t get(uint16_t id) const {
+        return mKeys[id];
+    }
+
+    inline size_t size() const {
+        return mCount;
+    }
+
+private:
+    void rehash(size_t slotCount);
+
+    style_key_t* mKeys;
+    size_t mCount;
+    size_t mCapacity;
+
+    /* Open addressed hash of key -> (id + 1), zero marks an empty slot */
+    uint16_t* mSlots;
+    size_t mSlotMask;
+
+    style_key_t mLastKey;
+    uint16_t mLastId;
+};
+
+/*
+ * Span of cells starting at a column that share a single interned style.
+ */
+struct StyleRun {
+    dimen_t start;
+    uint16_t style;
+};
+
+/*
+ * Single line of scrollback history in packed form. Codepoints are stored
+ * densely (16 bits per cell unless the line needs more), styles are kept
+ * as runs into a StyleTable, and trailing erased cells are trimmed. The
+ * packed payload follows the header in the same allocation, which comes
+ * from the session's SlabAllocator.
+ */
+class ScrollbackLine {
+public:
+    /*
+     * Packs cols cells. A wrapped line continues on the next one, so its
+     * text can be rewrapped to a different width later.
+     */
+    static ScrollbackLine* create(SlabAllocator& heap, StyleTable& styles, dimen_t cols,
+            const VTermScreenCell* cells, bool wrapped);
+    static void destroy(SlabAllocator& heap, ScrollbackLine* line);
+
+    /* Copies line into heap, e.g. to move it out of a fragmented one */
+    static ScrollbackLine* clone(SlabAllocator& heap, const ScrollbackLine* line);
+
+    /* Fill cells with this line, padding with erased cells beyond its width */
+    void expand(const StyleTable& styles, dimen_t cols, VTermScreenCell* cells) const;
+
+    void getCell(const StyleTable& styles, dimen_t col, VTermScreenCell* cell) const;
+
+    /*
+     * Like expand(), but into parallel arrays of base codepoints and style
+     * keys. Run start columns come straight from the packed runs, and the
+     * number of runs is returned.
+     */
+    dimen_t expandRow(const StyleTable& styles, dimen_t cols, uint32_t* chars,
+            style_key_t* keys, dimen_t* runStarts) const;
+
+    /* Base codepoints only, for callers that don't care about styles */
+    void expandChars(dimen_t cols, uint32_t* chars) const;
+
+    /* Total bytes occupied by this line, including the header */
+    size_t byteSize() const;
+
+    inline bool isWrapped() const {
+        return (mFlags & FLAG_WRAPPED) != 0;
+    }
+
+    /* Cells up to and including the last one that isn't erased */
+    inline dimen_t length() const {
+        return mLen;
+    }
+
+    /* Width of the screen this line was pushed from */
+    const dimen_t cols;
+
+private:
+    enum {
+        /* Codepoints are stored as 32-bit values instead of 16-bit */
+        FLAG_WIDE_CHARS = 1 << 0,
+        /* Text continues on the next line */
+        FLAG_WRAPPED = 1 << 1,
+    };
+
+    ScrollbackLine(dimen_t cols, dimen_t len, uint16_t runCount, uint16_t fillStyle,
+            uint16_t extraCount, uint8_t flags);
+
+    static size_t payloadSize(dimen_t len, uint16_t runCount, uint16_t extraCount,
+            uint8_t flags);
+
+    inline StyleRun* runs() const {
+        return (StyleRun*) (this + 1);
+    }
+
+    inline void* chars() const {
+        return runs() + mRunCount;
+    }
+
+    inline uint32_t* extras() const {
+        size_t charBytes = mLen * ((mFlags & FLAG_WIDE_CHARS) ? 4 : 2);
+        return (uint32_t*) ((uint8_t*) chars() + ((charBytes + 3) & ~3));
+    }
+
+    uint32_t charAt(dimen_t col) const;
+    void fillCell(uint32_t rawChar, dimen_t col, VTermScreenCell* cell) const;
+
+    /* Number of stored cells; everything past this is erased with mFillStyle */
+    const dimen_t mLen;
+    const uint16_t mRunCount;
+    const uint16_t mFillStyle;
+    /* Number of 32-bit words of combining character records */
+    const uint16_t mExtraCount;
+    const uint8_t mFlags;
+};
+
+} /* namespace android */
+
+#endif /* SCROLLBACK_LINE_H */
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ScrollbackSpill.h"
+
+namespace android {
+
+/* Dead space at the front of the file worth compacting away */
+static const uint64_t COMPACT_MIN_BYTES = 32 * 1024 * 1024;
+
+static inline size_t recordSize(const ScrollbackLine* line) {
+    return (line->byteSize() + 7) & ~7;
+}
+
+ScrollbackSpill::ScrollbackSpill() :
+        mFd(-1), mOffsets(NULL), mHead(0), mCount(0), mAlloc(0), mEnd(0), mPending(NULL),
+        mPendingStart(0), mUseClock(0) {
+    memset(mWindows, 0, sizeof(mWindows));
+}
+
+ScrollbackSpill::~ScrollbackSpill() {
+    close();
+}
+
+status_t ScrollbackSpill::open(const char* dir) {
+    close();
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/scrollback-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        ALOGE("failed to create scrollback spill in %s: %s", dir, strerror(errno));
+        return -errno;
+    }
+    unlink(path);
+
+    mPending = (uint8_t*) malloc(PENDING_SIZE);
+    mFd = fd;
+    return OK;
+}
+
+void ScrollbackSpill::close() {
+    if (mFd < 0) {
+        return;
+    }
+
+    unmapAll();
+    ::close(mFd);
+    mFd = -1;
+
+    free(mOffsets);
+    free(mPending);
+    mOffsets = NULL;
+    mPending = NULL;
+    mHead = 0;
+    mCount = 0;
+    mAlloc = 0;
+    mEnd = 0;
+    mPendingStart = 0;
+}
+
+status_t ScrollbackSpill::writeFully(const uint8_t* data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(mFd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("failed to write scrollback spill: %s", strerror(errno));
+            return -errno;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return OK;
+}
+
+status_t ScrollbackSpill::flushPending() {
+    if (mPendingStart == mEnd) {
+        return OK;
+    }
+
+    status_t res = writeFully(mPending, mEnd - mPendingStart, mPendingStart);
+    if (res == OK) {
+        mPendingStart = mEnd;
+    }
+    return res;
+}
+
+status_t ScrollbackSpill::append(const ScrollbackLine* line) {
+    const size_t size = line->byteSize();
+    const size_t record = recordSize(line);
+
+    if (mEnd - mPendingStart + record > PENDING_SIZE) {
+        status_t res = flushPending();
+        if (res != OK) {
+            return res;
+        }
+    }
+
+    if (record > PENDING_SIZE) {
+        // Too big to buffer, so goes straight to the file
+        status_t res = writeFully((const uint8_t*) line, size, mEnd);
+        if (res != OK) {
+            return res;
+        }
+        mPendingStart = mEnd + record;
+    } else {
+        uint8_t* dest = mPending + (mEnd - mPendingStart);
+        memcpy(dest, line, size);
+        memset(dest + size, 0, record - size);
+    }
+
+    if (mCount == mAlloc) {
+        // Grow geometrically, unwrapping so the oldest lands in slot 0
+        size_t alloc = mAlloc < 1024 ? 1024 : mAlloc * 2;
+        uint64_t* offsets = (uint64_t*) malloc(alloc * sizeof(uint64_t));
+        for (size_t i = 0; i < mCount; i++) {
+            offsets[i] = offsetAt(mCount - 1 - i);
+        }
+        free(mOffsets);
+        mOffsets = offsets;
+        mAlloc = alloc;
+        mHead = 0;
+    }
+
+    mCount++;
+    offsetAt(0) = mEnd;
+    mEnd += record;
+    return OK;
+}
+
+const ScrollbackLine* ScrollbackSpill::get(size_t index) {
+    const uint64_t start = offsetAt(index);
+    if (start >= mPendingStart) {
+        return (const ScrollbackLine*) (mPending + (start - mPendingStart));
+    }
+
+    const uint64_t end = index == 0 ? mEnd : offsetAt(index - 1);
+    return (const ScrollbackLine*) map(start, end - start);
+}
+
+void ScrollbackSpill::removeNewest() {
+    const uint64_t start = offsetAt(0);
+    mCount--;
+    if (start < mPendingStart) {
+        // Line was already written, so nothing newer is pending
+        mPendingStart = start;
+    }
+    mEnd = start;
+}
+
+void ScrollbackSpill::trim(size_t count) {
+    if (mCount <= count) {
+        return;
+    }
+
+    size_t drop = mCount - count;
+    mHead += drop;
+    if (mHead >= mAlloc) {
+        mHead -= mAlloc;
+    }
+    mCount = count;
+
+    if (mCount == 0) {
+        clear();
+        return;
+    }
+
+    const uint64_t dead = offsetAt(mCount - 1);
+    if (dead >= COMPACT_MIN_BYTES && dead >= mEnd - dead) {
+        compact();
+    }
+}
+
+void ScrollbackSpill::clear() {
+    unmapAll();
+    mHead = 0;
+    mCount = 0;
+    mEnd = 0;
+    mPendingStart = 0;
+    if (mFd >= 0) {
+        ftruncate(mFd, 0);
+    }
+}
+
+size_t ScrollbackSpill::bytesMapped() const {
+    size_t bytes = mPending != NULL ? PENDING_SIZE : 0;
+    for (size_t i = 0; i < WINDOW_COUNT; i++) {
+        if (mWindows[i].data != NULL) {
+            bytes += mWindows[i].length;
+        }
+    }
+    return bytes + mAlloc * sizeof(uint64_t);
+}
+
+/*
+ * Moves live lines to the front of the file and releases the rest. Front
+ * to back copying is safe since the destination is always behind the
+ * source. On failure all spilled lines are dropped, which loses the oldest
+ * history but keeps what's left contiguous.
+ */
+void ScrollbackSpill::compact() {
+    if (flushPending() != OK) {
+        clear();
+        return;
+    }
+    unmapAll();
+
+    const uint64_t base = offsetAt(mCount - 1);
+    const size_t chunk = PENDING_SIZE;
+    for (uint64_t offset = base; offset < mEnd; offset += chunk) {
+        size_t length = mEnd - offset < chunk ? mEnd - offset : chunk;
+        ssize_t got = pread(mFd, mPending, length, offset);
+        if (got != (ssize_t) length || writeFully(mPending, length, offset - base) != OK) {
+            ALOGE("failed to compact scrollback spill");
+            clear();
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < mCount; i++) {
+        offsetAt(i) -= base;
+    }
+    mEnd -= base;
+    mPendingStart = mEnd;
+    ftruncate(mFd, mEnd);
+}
+
+const uint8_t* ScrollbackSpill::map(uint64_t offset, size_t length) {
+    Window* victim = &mWindows[0];
+    for (size_t i = 0; i < WINDOW_COUNT; i++) {
+        Window& w = mWindows[i];
+        if (w.data != NULL && offset >= w.offset && offset + length <= w.offset + w.length) {
+            w.lastUse = ++mUseClock;
+            return w.data + (offset - w.offset);
+        }
+        if (w.data == NULL || (victim->data != NULL && w.lastUse < victim->lastUse)) {
+            victim = &w;
+        }
+    }
+
+    if (victim->data != NULL) {
+        munmap(victim->data, victim->length);
+        victim->data = NULL;
+    }
+
+    // Lines too big for a regular window get one of their own
+    const uint64_t base = offset & ~(uint64_t) (WINDOW_STEP - 1);
+    size_t span = offset + length - base;
+    if (span < WINDOW_SIZE) {
+        span = WINDOW_SIZE;
+    } else {
+        span = (span + WINDOW_STEP - 1) & ~(size_t) (WINDOW_STEP - 1);
+    }
+
+    void* data = mmap(NULL, span, PROT_READ, MAP_SHARED, mFd, base);
+    if (data == MAP_FAILED) {
+        ALOGE("failed to map scrollback spill: %s", strerror(errno));
+        return NULL;
+    }
+
+    victim->offset = base;
+    victim->length = span;
+    victim->data = (uint8_t*) data;
+    victim->lastUse = ++mUseClock;
+    return victim->data + (offset - base);
+}
+
+void ScrollbackSpill::unmapAll() {
+    for (size_t i = 0; i < WINDOW_COUNT; i++) {
+        if (mWindows[i].data != NULL) {
+            munmap(mWindows[i].data, mWindows[i].length);
+            mWindows[i].data = NULL;
+        }
+    }
+}
+
+} /* namespace android */
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCROLLBACK_SPILL_H
+#define SCROLLBACK_SPILL_H
+
+#include <utils/Errors.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ScrollbackLine.h"
+
+namespace android {
+
+/*
+ * Cold tier of scrollback, holding the oldest lines of a session in an
+ * append-only file instead of RAM. Lines are stored in their packed form,
+ * so they can be used in place once the file is mapped. Appends are
+ * buffered and written in large chunks, and reads go through a handful of
+ * fixed-size mapped windows, so resident memory stays bounded however
+ * deep the history gets; the kernel pages windows in on first touch.
+ *
+ * The file is unlinked as soon as it's created, so it never outlives the
+ * process. Space taken by lines dropped off the old end is reclaimed by
+ * compacting the file once it makes up most of it.
+ *
+ * Not thread safe.
+ */
+class ScrollbackSpill {
+public:
+    ScrollbackSpill();
+    ~ScrollbackSpill();
+
+    /* Starts spilling into a new file under dir, discarding any spilled lines */
+    status_t open(const char* dir);
+    void close();
+
+    inline bool isOpen() const {
+        return mFd >= 0;
+    }
+
+    /* Adds a copy of line as the newest spilled line */
+    status_t append(const ScrollbackLine* line);
+
+    /*
+     * Spilled line, where index 0 is the newest. Returns NULL if it can't be
+     * mapped. Only valid until the next call on this object.
+     */
+    const ScrollbackLine* get(size_t index);
+
+    /* Forgets the newest line, reusing its space for the next append */
+    void removeNewest();
+
+    /* Drops the oldest lines until at most count remain */
+    void trim(size_t count);
+
+    void clear();
+
+    inline size_t size() const {
+        return mCount;
+    }
+
+    /* Bytes of file currently holding lines, including dead space */
+    inline size_t fileBytes() const {
+        return mEnd;
+    }
+
+    /* Bytes of address space taken by mapped windows and the append buffer */
+    size_t bytesMapped() const;
+
+private:
+    enum {
+        WINDOW_COUNT = 4,
+        WINDOW_SIZE = 1024 * 1024,
+        /* Windows start on this boundary, so any line up to this size fits one */
+        WINDOW_STEP = WINDOW_SIZE / 2,
+        PENDING_SIZE = 64 * 1024,
+    };
+
+    struct Window {
+        uint64_t offset;
+        size_t length;
+        uint8_t* data;
+        uint64_t lastUse;
+    };
+
+    inline uint64_t& offsetAt(size_t index) {
+        size_t slot = mHead + mCount - 1 - index;
+        return mOffsets[slot >= mAlloc ? slot - mAlloc : slot];
+    }
+
+    const uint8_t* map(uint64_t offset, size_t length);
+    void unmapAll();
+    status_t writeFully(const uint8_t* data, size_t length, uint64_t offset);
+    status_t flushPending();
+    void compact();
+
+    int mFd;
+
+    /* Ring of file offsets of spilled lines, oldest at mHead */
+    uint64_t* mOffsets;
+    size_t mHead;
+    size_t mCount;
+    size_t mAlloc;
+
+    /* File offset just past the newest line */
+    uint64_t mEnd;
+
+    /* Appended bytes not yet written, covering [mPendingStart, mEnd) */
+    uint8_t* mPending;
+    uint64_t mPendingStart;
+
+    Window mWindows[WINDOW_COUNT];
+    uint64_t mUseClock;
+};
+
+} /* namespace android */
+
+#endif /* SCROLLBACK_SPILL_H */
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SessionRecording.h"
+
+namespace android {
+
+static const char MAGIC[8] = { 'V', 'T', 'R', 'E', 'C', 0, 1, 0 };
+
+SessionRecorder::SessionRecorder() : mFile(NULL), mLast(0), mRows(0), mCols(0) {
+}
+
+SessionRecorder::~SessionRecorder() {
+    close();
+}
+
+status_t SessionRecorder::open(const char* path, dimen_t rows, dimen_t cols) {
+    close();
+
+    mFile = fopen(path, "wb");
+    if (mFile == NULL) {
+        ALOGE("failed to create recording %s: %s", path, strerror(errno));
+        return -errno;
+    }
+    setvbuf(mFile, NULL, _IOFBF, 64 * 1024);
+
+    fwrite(MAGIC, 1, sizeof(MAGIC), mFile);
+    writeVarint(rows);
+    writeVarint(cols);
+    mLast = systemTime();
+    mRows = rows;
+    mCols = cols;
+    return OK;
+}
+
+void SessionRecorder::close() {
+    if (mFile != NULL) {
+        if (fclose(mFile) != 0) {
+            ALOGE("failed to finish recording: %s", strerror(errno));
+        }
+        mFile = NULL;
+    }
+}
+
+void SessionRecorder::writeVarint(uint64_t value) {
+    uint8_t buf[10];
+    size_t len = 0;
+    do {
+        buf[len] = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            buf[len] |= 0x80;
+        }
+        len++;
+    } while (value != 0);
+    fwrite(buf, 1, len, mFile);
+}
+
+void SessionRecorder::writeEventHeader(nsecs_t when, uint64_t value, int kind) {
+    // Clamp so a clock step can't produce a negative delta
+    nsecs_t delta = when > mLast ? when - mLast : 0;
+    uint64_t micros = delta / 1000;
+    mLast += micros * 1000;
+
+    writeVarint(micros);
+    writeVarint(value << 1 | kind);
+}
+
+void SessionRecorder::recordOutput(nsecs_t when, const char* bytes, size_t len) {
+    writeEventHeader(when, len, RECORD_OUTPUT);
+    fwrite(bytes, 1, len, mFile);
+}
+
+void SessionRecorder::recordResize(nsecs_t when, dimen_t rows, dimen_t cols) {
+    if (rows == mRows && cols == mCols) {
+        return;
+    }
+    mRows = rows;
+    mCols = cols;
+    writeEventHeader(when, rows, RECORD_RESIZE);
+    writeVarint(cols);
+}
+
+SessionPlayer::SessionPlayer() :
+        mData(NULL), mSize(0), mFirstEvent(0), mPos(0), mWhen(0), mRows(0), mCols(0),
+        mOutputBytes(0) {
+}
+
+SessionPlayer::~SessionPlayer() {
+    if (mData != NULL) {
+        munmap((void*) mData, mSize);
+    }
+}
+
+status_t SessionPlayer::open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(MAGIC)) {
+        ::close(fd);
+        return BAD_VALUE;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return -errno;
+    }
+
+    mData = (const uint8_t*) data;
+    mSize = st.st_size;
+    mPos = sizeof(MAGIC);
+
+    uint64_t rows, cols;
+    if (memcmp(mData, MAGIC, sizeof(MAGIC)) != 0 || !readVarint(&rows) || !readVarint(&cols)) {
+        return BAD_VALUE;
+    }
+    mRows = rows;
+    mCols = cols;
+    mFirstEvent = mPos;
+
+    // Sum up output once, so callers can report throughput
+    Event event;
+    while (next(&event)) {
+        if (event.kind == RECORD_OUTPUT) {
+            mOutputBytes += event.len;
+        }
+    }
+    rewind();
+    return OK;
+}
+
+void SessionPlayer::rewind() {
+    mPos = mFirstEvent;
+    mWhen = 0;
+}
+
+bool SessionPlayer::readVarint(uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; mPos < mSize && shift < 64; shift += 7) {
+        uint8_t b = mData[mPos++];
+        result |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SessionPlayer::next(Event* event) {
+    uint64_t micros, header;
+    if (!readVarint(&micros) || !readVarint(&header)) {
+        return false;
+    }
+
+    mWhen += micros * 1000;
+    event->when = mWhen;
+    event->kind = header & 1;
+    if (event->kind == RECORD_OUTPUT) {
+        // A recording cut short by a crash ends at the last whole chunk
+        size_t len = header >> 1;
+        if (len > mSize - mPos) {
+            return false;
+        }
+        event->bytes = (const char*) mData + mPos;
+        event->len = len;
+        mPos += len;
+    } else {
+        uint64_t cols;
+        if (!readVarint(&cols)) {
+            return false;
+        }
+        event->rows = header >> 1;
+        event->cols = cols;
+    }
+    return true;
+}
+
+} /* namespace android */
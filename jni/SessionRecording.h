@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SESSION_RECORDING_H
+#define SESSION_RECORDING_H
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "CellStyle.h"
+
+namespace android {
+
+/*
+ * Recordings capture the raw output of a session exactly as it was read
+ * from the pty, so it can be fed through the engine again without a shell.
+ * The file is an 8 byte magic followed by the initial screen size and a
+ * sequence of events, all numbers as unsigned LEB128 varints:
+ *
+ *   header:  "VTREC\0\1\0", rows, cols
+ *   event:   micros since previous event, (value << 1 | kind), payload
+ *
+ * For output events kind is 0, value is the byte count and the payload is
+ * that many raw bytes. For resizes kind is 1, value is the new rows, and
+ * the payload is the new cols.
+ */
+enum {
+    RECORD_OUTPUT = 0,
+    RECORD_RESIZE = 1,
+};
+
+/*
+ * Appends events to a recording. Writes are buffered, so nothing is
+ * guaranteed to be on disk until close(). Not thread safe.
+ */
+class SessionRecorder {
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    status_t open(const char* path, dimen_t rows, dimen_t cols);
+    void close();
+
+    inline bool isOpen() const {
+        return mFile != NULL;
+    }
+
+    void recordOutput(nsecs_t when, const char* bytes, size_t len);
+    void recordResize(nsecs_t when, dimen_t rows, dimen_t cols);
+
+private:
+    void writeVarint(uint64_t value);
+    void writeEventHeader(nsecs_t when, uint64_t value, int kind);
+
+    FILE* mFile;
+    nsecs_t mLast;
+    /* Size last recorded, so repeated resizes to it are skipped */
+    dimen_t mRows;
+    dimen_t mCols;
+};
+
+/*
+ * Reads events back from a recording, mapping the whole file so output
+ * payloads can be handed out in place.
+ */
+class SessionPlayer {
+public:
+    struct Event {
+        int kind;
+        /* Time since the recording started */
+        nsecs_t when;
+        const char* bytes;
+        size_t len;
+        dimen_t rows;
+        dimen_t cols;
+    };
+
+    SessionPlayer();
+    ~SessionPlayer();
+
+    status_t open(const char* path);
+
+    /* Fills event with the next one, returning false at the end */
+    bool next(Event* event);
+
+    inline dimen_t getRows() const {
+        return mRows;
+    }
+
+    inline dimen_t getCols() const {
+        return mCols;
+    }
+
+    /* Total output bytes in the recording */
+    inline size_t getOutputBytes() const {
+        return mOutputBytes;
+    }
+
+    /* Rewinds to the first event */
+    void rewind();
+
+private:
+    bool readVarint(uint64_t* value);
+
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mFirstEvent;
+    size_t mPos;
+    nsecs_t mWhen;
+    dimen_t mRows;
+    dimen_t mCols;
+    size_t mOutputBytes;
+};
+
+} /* namespace android */
+
+#endif /* SESSION_RECORDING_H */
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SlabAllocator.h"
+
+namespace android {
+
+/* Slab headers are padded so blocks stay 16-byte aligned */
+static const size_t SLAB_HEADER = 16;
+static const size_t LARGE_HEADER = 32;
+
+SlabAllocator::SlabAllocator() :
+        mSlabs(NULL), mCursor(NULL), mRemaining(0), mLarge(NULL),
+        mBytesHeld(0), mBytesUsed(0) {
+    memset(mFree, 0, sizeof(mFree));
+}
+
+SlabAllocator::~SlabAllocator() {
+    while (mSlabs != NULL) {
+        Slab* next = mSlabs->next;
+        ::free(mSlabs);
+        mSlabs = next;
+    }
+    while (mLarge != NULL) {
+        LargeBlock* next = mLarge->next;
+        ::free(mLarge);
+        mLarge = next;
+    }
+}
+
+template<typename T>
+static inline void swapValues(T& a, T& b) {
+    T tmp = a;
+    a = b;
+    b = tmp;
+}
+
+void SlabAllocator::swap(SlabAllocator& other) {
+    for (size_t i = 0; i < NUM_CLASSES; i++) {
+        swapValues(mFree[i], other.mFree[i]);
+    }
+    swapValues(mSlabs, other.mSlabs);
+    swapValues(mCursor, other.mCursor);
+    swapValues(mRemaining, other.mRemaining);
+    swapValues(mLarge, other.mLarge);
+    swapValues(mBytesHeld, other.mBytesHeld);
+    swapValues(mBytesUsed, other.mBytesUsed);
+}
+
+size_t SlabAllocator::classIndex(size_t size) {
+    if (size <= FINE_LIMIT) {
+        return (size + FINE_STEP - 1) / FINE_STEP - 1;
+    }
+    return FINE_LIMIT / FINE_STEP + (size - FINE_LIMIT + COARSE_STEP - 1) / COARSE_STEP - 1;
+}
+
+size_t SlabAllocator::classSize(size_t index) {
+    if (index < FINE_LIMIT / FINE_STEP) {
+        return (index + 1) * FINE_STEP;
+    }
+    return FINE_LIMIT + (index + 1 - FINE_LIMIT / FINE_STEP) * COARSE_STEP;
+}
+
+void* SlabAllocator::allocFromSlab(size_t size) {
+    if (mRemaining < size) {
+        // Tail of the current slab is abandoned; it's less than one block
+        Slab* slab = (Slab*) malloc(SLAB_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->next = mSlabs;
+        mSlabs = slab;
+        mCursor = (uint8_t*) slab + SLAB_HEADER;
+        mRemaining = SLAB_SIZE - SLAB_HEADER;
+        mBytesHeld += SLAB_SIZE;
+    }
+
+    void* ptr = mCursor;
+    mCursor += size;
+    mRemaining -= size;
+    return ptr;
+}
+
+void* SlabAllocator::alloc(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (size > MAX_CLASS_SIZE) {
+        LargeBlock* block = (LargeBlock*) malloc(LARGE_HEADER + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->prev = NULL;
+        block->next = mLarge;
+        block->size = size;
+        if (mLarge != NULL) {
+            mLarge->prev = block;
+        }
+        mLarge = block;
+        mBytesHeld += LARGE_HEADER + size;
+        mBytesUsed += size;
+        return (uint8_t*) block + LARGE_HEADER;
+    }
+
+    size_t index = classIndex(size);
+    void* ptr;
+    if (mFree[index] != NULL) {
+        FreeBlock* block = mFree[index];
+        mFree[index] = block->next;
+        ptr = block;
+    } else {
+        ptr = allocFromSlab(classSize(index));
+        if (ptr == NULL) {
+            return NULL;
+        }
+    }
+
+    mBytesUsed += size;
+    return ptr;
+}
+
+void SlabAllocator::free(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+
+    mBytesUsed -= size;
+
+    if (size > MAX_CLASS_SIZE) {
+        LargeBlock* block = (LargeBlock*) ((uint8_t*) ptr - LARGE_HEADER);
+        if (block->prev != NULL) {
+            block->prev->next = block->next;
+        } else {
+            mLarge = block->next;
+        }
+        if (block->next != NULL) {
+            block->next->prev = block->prev;
+        }
+        mBytesHeld -= LARGE_HEADER + block->size;
+        ::free(block);
+        return;
+    }
+
+    size_t index = classIndex(size);
+    FreeBlock* block = (FreeBlock*) ptr;
+    block->next = mFree[index];
+    mFree[index] = block;
+}
+
+} /* namespace android */
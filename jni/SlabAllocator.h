@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Arena for scrollback line storage. Small blocks are carved out of large
+ * slabs and recycled through per-size-class free lists, so a session that
+ * keeps scrolling lines of similar size stops touching the heap entirely.
+ * Blocks too big for any class come straight from malloc but are still
+ * tracked, so destroying the allocator releases everything in one sweep.
+ *
+ * Callers pass the block size back to free(). Not thread safe.
+ */
+class SlabAllocator {
+public:
+    SlabAllocator();
+    ~SlabAllocator();
+
+    void* alloc(size_t size);
+    void free(void* ptr, size_t size);
+
+    /*
+     * Exchanges everything held with other. Lets a caller copy live blocks
+     * into a fresh allocator and then drop the old, mostly free slabs.
+     */
+    void swap(SlabAllocator& other);
+
+    /* Bytes obtained from the system, including free and wasted space */
+    inline size_t bytesHeld() const {
+        return mBytesHeld;
+    }
+
+    /* Bytes currently handed out to callers */
+    inline size_t bytesUsed() const {
+        return mBytesUsed;
+    }
+
+private:
+    enum {
+        SLAB_SIZE = 64 * 1024,
+        /* Classes step by 16 bytes up to 512, then by 64 bytes up to 4096 */
+        FINE_STEP = 16,
+        FINE_LIMIT = 512,
+        COARSE_STEP = 64,
+        MAX_CLASS_SIZE = 4096,
+        NUM_CLASSES = FINE_LIMIT / FINE_STEP + (MAX_CLASS_SIZE - FINE_LIMIT) / COARSE_STEP,
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Slab {
+        Slab* next;
+    };
+
+    /* Header in front of blocks larger than MAX_CLASS_SIZE */
+    struct LargeBlock {
+        LargeBlock* prev;
+        LargeBlock* next;
+        size_t size;
+    };
+
+    static size_t classIndex(size_t size);
+    static size_t classSize(size_t index);
+
+    void* allocFromSlab(size_t size);
+
+    FreeBlock* mFree[NUM_CLASSES];
+
+    Slab* mSlabs;
+    uint8_t* mCursor;
+    size_t mRemaining;
+
+    LargeBlock* mLarge;
+
+    size_t mBytesHeld;
+    size_t mBytesUsed;
+};
+
+} /* namespace android */
+
+#endif /* SLAB_ALLOCATOR_H */
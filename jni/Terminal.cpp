@@ -0,0 +1,2315 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <cutils/atomic.h>
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "PtySpawn.h"
+#include "RunScan.h"
+#include "Terminal.h"
+
+#define USE_TEST_SHELL 0
+#define DEBUG_CALLBACKS 0
+#define DEBUG_IO 0
+#define DEBUG_SCROLLBACK 0
+
+namespace android {
+
+/*
+ * Line numbers start here rather than at zero, so history rewrapped to a
+ * narrower width, which can hold more rows than lines were ever pushed,
+ * still numbers its oldest rows above zero.
+ */
+static const size_t SCROLL_SEQ_BASE = 1 << 30;
+
+/*
+ * How far the pty reader may get ahead of the parser before it stops
+ * reading, leaving the child to block on a full pty.
+ */
+static const size_t READ_RING_SIZE = 1024 * 1024;
+
+static const char DEFAULT_SHELL[] = "/system/bin/sh";
+
+static const int DEFAULT_FRAME_INTERVAL_MS = 16;
+
+/* Scrollback slot arrays start this big, then double */
+static const size_t MIN_SCROLL_ALLOC = 64;
+
+/*
+ * Free space the scrollback heap must hold, unless it's mostly free, before
+ * a trim copies live lines into a fresh one to give it back.
+ */
+static const size_t COMPACT_MIN_SLACK = 256 * 1024;
+
+/*
+ * Batches are parsed in slices this big, dropping mLock in between, so
+ * keystrokes like Ctrl-C never wait behind a whole batch.
+ */
+static const size_t PARSE_SLICE = 16 * 1024;
+
+/*
+ * Slices parsed per parse reactor wakeup before giving other sessions on
+ * it a turn, so a flood of output can't hold the reactor to itself.
+ */
+static const size_t PARSE_SLICES_PER_WAKEUP = 8;
+
+/*
+ * Output arriving faster than this many bytes per frame switches to jump
+ * scrolling, which ends after a few quieter frames.
+ */
+static const int DEFAULT_JUMP_SCROLL_BYTES = 16 * 1024;
+static const int JUMP_SCROLL_EXIT_FRAMES = 3;
+
+/* Private mode number toggling bracketed paste, as in ESC [ ? 2004 h */
+static const unsigned BRACKETED_PASTE_MODE = 2004;
+static const char PASTE_START[] = "\033[200~";
+static const char PASTE_END[] = "\033[201~";
+static const size_t PASTE_MARKER_LEN = sizeof(PASTE_START) - 1;
+
+/*
+ * VTerm event handlers
+ */
+
+static int term_damage(VTermRect rect, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_damage");
+#endif
+
+    return term->onDamage(rect);
+}
+
+static int term_moverect(VTermRect dest, VTermRect src, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_moverect");
+#endif
+
+    return term->onMoveRect(dest, src);
+}
+
+static int term_movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_movecursor");
+#endif
+
+    return term->onCursorChange(oldpos, pos, visible != 0);
+}
+
+static int term_settermprop(VTermProp prop, VTermValue *val, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_settermprop");
+#endif
+
+    return term->getListener()->onTermProp(prop, *val);
+}
+
+static int term_setmousefunc(VTermMouseFunc func, void *data, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_setmousefunc");
+#endif
+    return 1;
+}
+
+static int term_bell(void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_bell");
+#endif
+
+    return term->getListener()->onBell();
+}
+
+static int term_sb_pushline(int cols, const VTermScreenCell *cells, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_sb_pushline");
+#endif
+
+    return term->onPushline(cols, cells);
+}
+
+static int term_sb_popline(int cols, VTermScreenCell *cells, void *user) {
+    Terminal* term = reinterpret_cast<Terminal*>(user);
+#if DEBUG_CALLBACKS
+    ALOGW("term_sb_popline");
+#endif
+
+    return term->onPopline(cols, cells);
+}
+
+static VTermScreenCallbacks cb = {
+    .damage = term_damage,
+    .moverect = term_moverect,
+    .movecursor = term_movecursor,
+    .settermprop = term_settermprop,
+    .setmousefunc = term_setmousefunc,
+    .bell = term_bell,
+    // Resize requests are applied immediately, so callback is ignored
+    .resize = NULL,
+    .sb_pushline = term_sb_pushline,
+    .sb_popline = term_sb_popline,
+};
+
+static inline int toArgb(const VTermColor& color) {
+    return (0xff << 24 | color.red << 16 | color.green << 8 | color.blue);
+}
+
+/*
+ * Copies a NULL terminated array of strings into a single allocation, or
+ * returns NULL for a NULL array.
+ */
+static char** copyStrings(const char* const* strings) {
+    if (strings == NULL) {
+        return NULL;
+    }
+
+    size_t count = 0;
+    size_t bytes = 0;
+    for (; strings[count] != NULL; count++) {
+        bytes += strlen(strings[count]) + 1;
+    }
+
+    char** copy = (char**) malloc(sizeof(char*) * (count + 1) + bytes);
+    if (copy == NULL) {
+        return NULL;
+    }
+    char* dst = (char*) (copy + count + 1);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(strings[i]) + 1;
+        memcpy(dst, strings[i], len);
+        copy[i] = dst;
+        dst += len;
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+static inline void freeStrings(char** strings) {
+    free(strings);
+}
+
+Terminal::Terminal(TerminalListener* listener) :
+        mMasterFd(-1), mChildPid(0), mCommand(NULL), mArgv(NULL), mEnv(NULL),
+        mListener(listener), mRows(25), mCols(80), mStarted(false),
+        mCursorVisible(true), mDirtyRows(NULL), mDirtyWords(0), mDirtyStart(0), mDirtyEnd(0),
+        mCursorDirty(false), mScrollOffset(0), mDeliveredOffset(0), mRowVersions(NULL),
+        mRowHashes(NULL), mContentVersion(0), mParseFd(-1), mParseSession(this), mReaderDone(0),
+        mReadPaused(0),
+        mFrameIntervalMs(DEFAULT_FRAME_INTERVAL_MS),
+        mLastFlush(0), mFlushPending(0), mBracketedPaste(false), mModeState(MODE_GROUND),
+        mModeParam(0), mModeFound(false),
+        mJumpScrollBytes(DEFAULT_JUMP_SCROLL_BYTES), mJumping(false), mJumpDirty(false),
+        mQuietFrames(0), mBytesSinceFlush(0), mReadChars(NULL), mReadStyles(NULL), mReadCols(0),
+        mScrollCacheCols(0), mScroll(NULL), mScrollHead(0), mScrollCur(0), mScrollAlloc(0),
+        mScrollSize(100), mScrollSeq(SCROLL_SEQ_BASE), mScrollInvalidFrom(SIZE_MAX),
+        mScrollHotSize(0), mReflowing(false), mReflowCols(mCols), mReflowEnd(mScrollSeq),
+        mReflowNext(mScrollSeq), mReflowBase(0), mReflowReported(0), mReflowChars(NULL),
+        mReflowCharsAlloc(0), mReflowCells(NULL), mReflowCellsAlloc(0), mReadLineChars(NULL),
+        mReadLineStyles(NULL), mReadLineRuns(NULL), mReadLineAlloc(0) {
+    mCreated = systemTime();
+    memset(mScrollCache, 0, sizeof(mScrollCache));
+    invalidateScrollCacheLocked(0);
+    mCursorPos.row = 0;
+    mCursorPos.col = 0;
+    resizeDirtyLocked();
+
+    /* Create VTerm */
+    mVt = vterm_new(mRows, mCols);
+    vterm_parser_set_utf8(mVt, 1);
+
+    /* Set up screen */
+    mVts = vterm_obtain_screen(mVt);
+    vterm_screen_enable_altscreen(mVts, 1);
+    vterm_screen_set_callbacks(mVts, &cb, this);
+    vterm_screen_set_damage_merge(mVts, VTERM_DAMAGE_SCROLL);
+    vterm_screen_reset(mVts, 1);
+
+    publishFrameLocked();
+}
+
+Terminal::~Terminal() {
+    if (mStarted) {
+        // Each returns only once its reactor is done with us; stop the
+        // reader first so it can't signal a parser that's gone
+        TerminalReactor::getInstance().remove(this);
+        TerminalReactor::getParseInstance().remove(&mParseSession);
+        ScrollbackBudget::getInstance().remove(this);
+        close(mParseFd);
+        close(mMasterFd);
+        ::kill(mChildPid, SIGHUP);
+    }
+
+    vterm_free(mVt);
+
+    free(mCommand);
+    freeStrings(mArgv);
+    freeStrings(mEnv);
+
+    // Lines live in mScrollHeap, which releases them all at once
+    free(mScroll);
+    free(mDirtyRows);
+    free(mRowVersions);
+    free(mRowHashes);
+    free(mReadChars);
+    free(mReadStyles);
+    free(mReflowChars);
+    free(mReflowCells);
+    free(mReadLineChars);
+    free(mReadLineStyles);
+    free(mReadLineRuns);
+    for (size_t i = 0; i < SCROLL_CACHE_ROWS; i++) {
+        free(mScrollCache[i].chars);
+        free(mScrollCache[i].styles);
+        free(mScrollCache[i].runStarts);
+    }
+}
+
+status_t Terminal::setCommand(const char* path, const char* const* argv,
+        const char* const* envp) {
+    if (mStarted) {
+        return INVALID_OPERATION;
+    }
+
+    char* command = path != NULL ? strdup(path) : NULL;
+    char** args = copyStrings(argv);
+    char** env = copyStrings(envp);
+    if ((path != NULL && command == NULL) || (argv != NULL && args == NULL)
+            || (envp != NULL && env == NULL)) {
+        free(command);
+        freeStrings(args);
+        freeStrings(env);
+        return NO_MEMORY;
+    }
+
+    free(mCommand);
+    freeStrings(mArgv);
+    freeStrings(mEnv);
+    mCommand = command;
+    mArgv = args;
+    mEnv = env;
+    return OK;
+}
+
+status_t Terminal::start() {
+    struct termios termios;
+    memset(&termios, 0, sizeof(termios));
+    termios.c_iflag = ICRNL|IXON|IUTF8;
+    termios.c_oflag = OPOST|ONLCR|NL0|CR0|TAB0|BS0|VT0|FF0;
+    termios.c_cflag = CS8|CREAD;
+    termios.c_lflag = ISIG|ICANON|IEXTEN|ECHO|ECHOE|ECHOK;
+
+    cfsetispeed(&termios, B38400);
+    cfsetospeed(&termios, B38400);
+
+    termios.c_cc[VINTR]    = 0x1f & 'C';
+    termios.c_cc[VQUIT]    = 0x1f & '\\';
+    termios.c_cc[VERASE]   = 0x7f;
+    termios.c_cc[VKILL]    = 0x1f & 'U';
+    termios.c_cc[VEOF]     = 0x1f & 'D';
+    termios.c_cc[VSTART]   = 0x1f & 'Q';
+    termios.c_cc[VSTOP]    = 0x1f & 'S';
+    termios.c_cc[VSUSP]    = 0x1f & 'Z';
+    termios.c_cc[VREPRINT] = 0x1f & 'R';
+    termios.c_cc[VWERASE]  = 0x1f & 'W';
+    termios.c_cc[VLNEXT]   = 0x1f & 'V';
+    termios.c_cc[VMIN]     = 1;
+    termios.c_cc[VTIME]    = 0;
+
+    struct winsize size = { mRows, mCols, 0, 0 };
+
+#if USE_TEST_SHELL
+    if (mArgv == NULL) {
+        static const char* testArgs[] = { "/system/bin/sh", "-c", "x=1; c=0; while true; do echo -e \"stop \e[00;3${c}mechoing\e[00m yourself! ($x)\"; x=$(( $x + 1 )); c=$((($c+1)%7)); if [ $x -gt 110 ]; then sleep 0.5; fi; done", NULL };
+        setCommand(testArgs[0], testArgs, NULL);
+    }
+#endif
+
+    // We know execve(2) won't actually try to modify these.
+    const char* path = mCommand != NULL ? mCommand : DEFAULT_SHELL;
+    char* defaultArgs[] = { const_cast<char*>(path), NULL };
+    char* const* argv = mArgv != NULL ? mArgv : defaultArgs;
+
+    mChildPid = spawnPty(path, argv, mEnv, &termios, &size, &mMasterFd);
+    if (mChildPid == -1) {
+        int err = errno;
+        ALOGE("failed to spawn %s: %s", path, strerror(err));
+        return -err;
+    }
+
+    int flags = fcntl(mMasterFd, F_GETFL);
+    if (flags == -1 || fcntl(mMasterFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        int err = errno;
+        ALOGE("failed to make pty nonblocking: %s", strerror(err));
+        abortStart();
+        return -err;
+    }
+
+    if (!mReadRing.init(READ_RING_SIZE)) {
+        ALOGE("failed to allocate read ring");
+        abortStart();
+        return NO_MEMORY;
+    }
+    mParseFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mParseFd == -1) {
+        int err = errno;
+        ALOGE("failed to create parse eventfd: %s", strerror(err));
+        abortStart();
+        return -err;
+    }
+
+    ScrollbackBudget::getInstance().add(this);
+    status_t res = TerminalReactor::getParseInstance().add(mParseFd, &mParseSession);
+    if (res == OK) {
+        res = TerminalReactor::getInstance().add(mMasterFd, this);
+    }
+    if (res != OK) {
+        ALOGE("failed to watch pty: %d", res);
+        TerminalReactor::getParseInstance().remove(&mParseSession);
+        ScrollbackBudget::getInstance().remove(this);
+        abortStart();
+        return res;
+    }
+
+    mStarted = true;
+    return OK;
+}
+
+/*
+ * Undoes a start() that failed after spawning the child, so it isn't left
+ * running on a pty nobody reads, and start() can be tried again.
+ */
+void Terminal::abortStart() {
+    if (mParseFd != -1) {
+        close(mParseFd);
+        mParseFd = -1;
+    }
+    close(mMasterFd);
+    mMasterFd = -1;
+
+    ::kill(mChildPid, SIGKILL);
+    while (waitpid(mChildPid, NULL, 0) == -1 && errno == EINTR) {
+    }
+    mChildPid = 0;
+}
+
+/*
+ * Drains the pty into the ring until it runs dry or the ring fills. Takes
+ * no lock the parser holds while parsing, so the child is never left
+ * blocked on a full pty just because rendering is busy.
+ */
+bool Terminal::onReadable() {
+    size_t filled = 0;
+    size_t signalled = 0;
+    size_t calls = 0;
+    bool done = false;
+    while (1) {
+        size_t space;
+        char* dst = mReadRing.writeSpan(&space);
+        if (space == 0) {
+            break;
+        }
+
+        ssize_t bytes = ::read(mMasterFd, dst, space);
+        calls++;
+#if DEBUG_IO
+        ALOGD("read() returned %d bytes", bytes);
+#endif
+        if (bytes > 0) {
+            recordOutput(dst, bytes);
+            mReadRing.commitWrite(bytes);
+            filled += bytes;
+            // Get the parser going on a long run without waiting for the end
+            if (filled - signalled >= PARSE_SLICE) {
+                signalParser();
+                signalled = filled;
+            }
+        } else if (bytes == 0) {
+            ALOGD("read() found EOF");
+            done = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            ALOGE("read() failed: %s", strerror(errno));
+            done = true;
+            break;
+        }
+    }
+
+    if (filled > 0) {
+        Mutex::Autolock lock(mReaderLock);
+        mStats.recordBatch(filled, calls);
+    }
+
+    if (done) {
+        // Parser shows whatever arrived before the end, then stops too
+        android_atomic_release_store(1, &mReaderDone);
+        signalParser();
+        return false;
+    }
+    if (filled > signalled) {
+        signalParser();
+    }
+    pauseReadingIfFull();
+    return true;
+}
+
+/*
+ * The reader no longer has deadlines; frames are flushed by the parser.
+ */
+nsecs_t Terminal::getDeadline() {
+    return -1;
+}
+
+void Terminal::onDeadline(nsecs_t now) {
+}
+
+void Terminal::signalParser() {
+    uint64_t one = 1;
+    if (::write(mParseFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        ALOGW("failed to signal parser: %s", strerror(errno));
+    }
+}
+
+/*
+ * Stops watching the pty while the ring has no room, so a level-triggered
+ * reactor doesn't spin on output it can't take.
+ */
+void Terminal::pauseReadingIfFull() {
+    if (mReadRing.writable() > 0) {
+        return;
+    }
+
+    Mutex::Autolock lock(mReaderLock);
+    android_atomic_release_store(1, &mReadPaused);
+    android_memory_barrier();
+    if (mReadRing.writable() > 0) {
+        // Parser made room in the meantime
+        mReadPaused = 0;
+        return;
+    }
+    mStats.readPauses++;
+    TerminalReactor::getInstance().setReadInterest(this, false);
+}
+
+/*
+ * Called by the parser after consuming output. The barrier pairs with the
+ * one in pauseReadingIfFull(), so a pause is never missed.
+ */
+void Terminal::resumeReadingIfPaused() {
+    android_memory_barrier();
+    if (!mReadPaused) {
+        return;
+    }
+
+    Mutex::Autolock lock(mReaderLock);
+    if (mReadPaused) {
+        mReadPaused = 0;
+        TerminalReactor::getInstance().setReadInterest(this, true);
+    }
+}
+
+bool Terminal::ParseSession::onReadable() {
+    return mTerm->onParseReadable();
+}
+
+/*
+ * Runs under the reactor's lock, so takes none of ours. mLastFlush is only
+ * written on the parse thread this runs on, and mFlushPending is atomic.
+ * A flush racing with this at worst wakes onDeadline() for nothing.
+ */
+nsecs_t Terminal::ParseSession::getDeadline() {
+    if (!android_atomic_acquire_load(&mTerm->mFlushPending)) {
+        return -1;
+    }
+    return mTerm->mLastFlush + ms2ns(mTerm->mFrameIntervalMs);
+}
+
+void Terminal::ParseSession::onDeadline(nsecs_t now) {
+    StatsAutolock lock(mTerm->mLock, mTerm->mStats.lock);
+    mTerm->flushDamageIfDueLocked(now);
+}
+
+bool Terminal::onParseReadable() {
+    uint64_t count;
+    if (::read(mParseFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        ALOGW("failed to read parse eventfd: %s", strerror(errno));
+    }
+
+    // Whatever the reader committed before it stopped is visible once this is
+    bool done = android_atomic_acquire_load(&mReaderDone);
+    bool more = parseAvailable();
+    updateBudget();
+
+    if (more) {
+        // Come back for the rest after the other sessions have had a turn
+        signalParser();
+        return true;
+    }
+
+    StatsAutolock lock(mLock, mStats.lock);
+    if (!done) {
+        flushDamageIfDueLocked(systemTime());
+        return true;
+    }
+
+    // Show whatever arrived before the end
+    if (mFlushPending) {
+        flushDamageLocked();
+        android_atomic_release_store(0, &mFlushPending);
+    }
+    return false;
+}
+
+/*
+ * Parses up to PARSE_SLICES_PER_WAKEUP slices from the ring, returning
+ * whether output is left over. Space is handed back to the reader after
+ * every slice, and frames keep being flushed as they come due, so long
+ * runs of output still show progress.
+ */
+bool Terminal::parseAvailable() {
+    size_t len;
+    for (size_t i = 0; i < PARSE_SLICES_PER_WAKEUP; i++) {
+        const char* bytes = mReadRing.readSpan(&len);
+        if (len == 0) {
+            return false;
+        }
+        if (len > PARSE_SLICE) {
+            len = PARSE_SLICE;
+        }
+
+        {
+            StatsAutolock lock(mLock, mStats.lock);
+            parseLocked(bytes, len);
+            flushDamageIfDueLocked(systemTime());
+        }
+        mReadRing.commitRead(len);
+        resumeReadingIfPaused();
+    }
+
+    mReadRing.readSpan(&len);
+    return len > 0;
+}
+
+void Terminal::flushDamageIfDueLocked(nsecs_t now) {
+    if (!mFlushPending) {
+        return;
+    }
+    if (mFrameIntervalMs > 0 && now - mLastFlush < ms2ns(mFrameIntervalMs)) {
+        return;
+    }
+
+    flushDamageLocked();
+    mLastFlush = now;
+    android_atomic_release_store(0, &mFlushPending);
+}
+
+/*
+ * Publishes everything parsed so far and hands accumulated damage to Java.
+ */
+void Terminal::flushDamageLocked() {
+    vterm_screen_flush_damage(mVts);
+    if (mJumpDirty) {
+        // Everything in between was skipped, so the whole screen is suspect
+        markDirtyLocked(0, mRows);
+        mJumpDirty = false;
+        mStats.jumpFrames++;
+    }
+    publishFrameLocked();
+    deliverDamageLocked();
+    updateJumpScrollLocked();
+}
+
+/*
+ * Decides whether the next frame is jump scrolled, based on how much output
+ * arrived since the last flush.
+ */
+void Terminal::updateJumpScrollLocked() {
+    const size_t threshold = mJumpScrollBytes;
+    if (threshold > 0 && mBytesSinceFlush >= threshold) {
+        if (!mJumping) {
+            mJumping = true;
+            mStats.jumpScrolls++;
+        }
+        mQuietFrames = 0;
+    } else if (mJumping && ++mQuietFrames >= JUMP_SCROLL_EXIT_FRAMES) {
+        mJumping = false;
+    }
+    mBytesSinceFlush = 0;
+}
+
+void Terminal::pushBytes(const char* bytes, size_t len) {
+    StatsAutolock lock(mLock, mStats.lock);
+    parseLocked(bytes, len);
+}
+
+void Terminal::parseLocked(const char* bytes, size_t len) {
+    nsecs_t start = systemTime();
+    scanModesLocked(bytes, len);
+    vterm_push_bytes(mVt, bytes, len);
+    mStats.parseNs += systemTime() - start;
+    mStats.bytesParsed += len;
+    mBytesSinceFlush += len;
+    android_atomic_release_store(1, &mFlushPending);
+}
+
+void Terminal::flushDamage() {
+    StatsAutolock lock(mLock, mStats.lock);
+    flushDamageLocked();
+    android_atomic_release_store(0, &mFlushPending);
+}
+
+void Terminal::setFrameInterval(int millis) {
+    mFrameIntervalMs = millis > 0 ? millis : 0;
+}
+
+void Terminal::setJumpScroll(int bytesPerFrame) {
+    mJumpScrollBytes = bytesPerFrame > 0 ? bytesPerFrame : 0;
+}
+
+bool Terminal::write(const char *bytes, size_t len) {
+    Mutex::Autolock lock(mWriteLock);
+
+    // Refuse up front rather than send part and drop the rest
+    size_t queued = mWriteQueue.size();
+    if (queued > mWriteQueue.limit() || len > mWriteQueue.limit() - queued) {
+        mStats.writesRefused++;
+        ALOGW("input queue full, refused %zu bytes", len);
+        return false;
+    }
+
+    // Bypass the queue only while it's empty, so bytes stay in order
+    size_t done = 0;
+    while (queued == 0 && done < len) {
+        ssize_t written = ::write(mMasterFd, bytes + done, len - done);
+        if (written > 0) {
+            done += written;
+        } else if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            ALOGE("write() failed: %s", strerror(errno));
+            return false;
+        }
+    }
+    mStats.bytesWritten += done;
+    if (done == len) {
+        return true;
+    }
+
+    if (!mWriteQueue.append(bytes + done, len - done)) {
+        ALOGE("failed to queue %zu bytes of input", len - done);
+        return false;
+    }
+    if (mWriteQueue.size() > mStats.maxQueuedInput) {
+        mStats.maxQueuedInput = mWriteQueue.size();
+    }
+    TerminalReactor::getInstance().setWriteInterest(this, true);
+    return true;
+}
+
+/*
+ * Called on the reactor thread once the child has read some of its input.
+ */
+void Terminal::onWritable() {
+    Mutex::Autolock lock(mWriteLock);
+
+    ssize_t written = mWriteQueue.writeTo(mMasterFd);
+    if (written > 0) {
+        mStats.bytesWritten += written;
+    } else if (written < 0 && written != -EAGAIN) {
+        ALOGE("write() failed: %s", strerror(-written));
+        mWriteQueue.clear();
+    }
+
+    if (mWriteQueue.size() == 0) {
+        TerminalReactor::getInstance().setWriteInterest(this, false);
+    }
+}
+
+size_t Terminal::getQueuedInput() {
+    Mutex::Autolock lock(mWriteLock);
+    return mWriteQueue.size();
+}
+
+void Terminal::setInputQueueLimit(size_t bytes) {
+    Mutex::Autolock lock(mWriteLock);
+    mWriteQueue.setLimit(bytes);
+}
+
+bool Terminal::dispatchCharacter(int mod, int character) {
+    StatsAutolock lock(mLock, mStats.lock);
+    vterm_input_push_char(mVt, static_cast<VTermModifier>(mod), character);
+    return flushInput();
+}
+
+/*
+ * Watches output for the bracketed paste mode, which libvterm doesn't
+ * track. Picks 2004 out of any DECSET/DECRST parameter list, and clears it
+ * again on a full (RIS) or soft (DECSTR) reset. Skips ahead with memchr()
+ * between escapes, so plain text costs next to nothing, and carries partial
+ * sequences across batches.
+ */
+void Terminal::scanModesLocked(const char* bytes, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        const char c = bytes[i];
+        switch (mModeState) {
+        case MODE_GROUND: {
+            const char* esc = (const char*) memchr(bytes + i, '\033', len - i);
+            if (esc == NULL) {
+                return;
+            }
+            i = esc - bytes + 1;
+            mModeState = MODE_ESC;
+            continue;
+        }
+        case MODE_ESC:
+            if (c == '[') {
+                mModeState = MODE_CSI;
+            } else if (c == 'c') {
+                mBracketedPaste = false;
+                mModeState = MODE_GROUND;
+            } else {
+                mModeState = MODE_GROUND;
+                continue;
+            }
+            break;
+        case MODE_CSI:
+            if (c == '?') {
+                mModeState = MODE_PRIVATE;
+                mModeParam = 0;
+                mModeFound = false;
+            } else if (c == '!') {
+                mModeState = MODE_SOFT_RESET;
+            } else {
+                mModeState = MODE_GROUND;
+                continue;
+            }
+            break;
+        case MODE_SOFT_RESET:
+            mModeState = MODE_GROUND;
+            if (c != 'p') {
+                continue;
+            }
+            mBracketedPaste = false;
+            break;
+        case MODE_PRIVATE:
+            if (c >= '0' && c <= '9') {
+                // Saturate rather than wrap around onto 2004
+                if (mModeParam <= BRACKETED_PASTE_MODE) {
+                    mModeParam = mModeParam * 10 + (c - '0');
+                }
+            } else if (c == ';' || c == 'h' || c == 'l') {
+                mModeFound |= (mModeParam == BRACKETED_PASTE_MODE);
+                mModeParam = 0;
+                if (c != ';') {
+                    if (mModeFound) {
+                        mBracketedPaste = (c == 'h');
+                    }
+                    mModeState = MODE_GROUND;
+                }
+            } else {
+                mModeState = MODE_GROUND;
+                continue;
+            }
+            break;
+        }
+        i++;
+    }
+}
+
+/*
+ * Frames and writes already encoded text. Newlines are sent as carriage
+ * returns, with CRLF collapsed to one, and a pasted end marker is dropped
+ * so pasted text can't break out of the bracket early. The framing is
+ * decided and the text written under one hold of mLock, so the parser
+ * can't toggle bracketed paste in between.
+ */
+bool Terminal::sendText(const char* utf8, size_t len, bool paste) {
+    char* buf = (char*) malloc(len + 2 * PASTE_MARKER_LEN);
+    if (buf == NULL) {
+        return false;
+    }
+
+    bool res;
+    {
+        StatsAutolock lock(mLock, mStats.lock);
+        const bool bracketed = paste && mBracketedPaste;
+
+        size_t n = 0;
+        if (bracketed) {
+            memcpy(buf, PASTE_START, PASTE_MARKER_LEN);
+            n = PASTE_MARKER_LEN;
+        }
+        for (size_t i = 0; i < len; i++) {
+            char c = utf8[i];
+            if (c == '\n') {
+                if (i == 0 || utf8[i - 1] != '\r') {
+                    buf[n++] = '\r';
+                }
+            } else if (bracketed && c == '\033' && len - i >= PASTE_MARKER_LEN
+                    && memcmp(utf8 + i, PASTE_END, PASTE_MARKER_LEN) == 0) {
+                i += PASTE_MARKER_LEN - 1;
+            } else {
+                buf[n++] = c;
+            }
+        }
+        if (bracketed) {
+            memcpy(buf + n, PASTE_END, PASTE_MARKER_LEN);
+            n += PASTE_MARKER_LEN;
+        }
+
+        // Anything libvterm still holds goes out ahead of us
+        res = flushInput() && write(buf, n);
+    }
+    free(buf);
+    return res;
+}
+
+bool Terminal::dispatchUtf8(const char* text, size_t len, bool paste) {
+    return sendText(text, len, paste);
+}
+
+bool Terminal::dispatchText(const uint16_t* text, size_t len, bool paste) {
+    // Worst case is three bytes per UTF-16 unit
+    char* utf8 = (char*) malloc(len * 3);
+    if (utf8 == NULL) {
+        return false;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = text[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < len
+                && text[i + 1] >= 0xdc00 && text[i + 1] < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (text[++i] - 0xdc00);
+        } else if (c >= 0xd800 && c < 0xe000) {
+            // Unpaired surrogate
+            c = 0xfffd;
+        }
+
+        if (c < 0x80) {
+            utf8[n++] = c;
+        } else if (c < 0x800) {
+            utf8[n++] = 0xc0 | (c >> 6);
+            utf8[n++] = 0x80 | (c & 0x3f);
+        } else if (c < 0x10000) {
+            utf8[n++] = 0xe0 | (c >> 12);
+            utf8[n++] = 0x80 | ((c >> 6) & 0x3f);
+            utf8[n++] = 0x80 | (c & 0x3f);
+        } else {
+            utf8[n++] = 0xf0 | (c >> 18);
+            utf8[n++] = 0x80 | ((c >> 12) & 0x3f);
+            utf8[n++] = 0x80 | ((c >> 6) & 0x3f);
+            utf8[n++] = 0x80 | (c & 0x3f);
+        }
+    }
+
+    bool res = sendText(utf8, n, paste);
+    free(utf8);
+    return res;
+}
+
+bool Terminal::dispatchKey(int mod, int key) {
+    StatsAutolock lock(mLock, mStats.lock);
+    vterm_input_push_key(mVt, static_cast<VTermModifier>(mod), static_cast<VTermKey>(key));
+    return flushInput();
+}
+
+bool Terminal::flushInput() {
+    size_t len = vterm_output_get_buffer_current(mVt);
+    if (len) {
+        char buf[len];
+        len = vterm_output_bufferread(mVt, buf, len);
+        return write(buf, len);
+    }
+    return true;
+}
+
+status_t Terminal::resize(dimen_t rows, dimen_t cols, size_t scrollRows) {
+    ALOGD("resize(%d, %d, %zu)", rows, cols, scrollRows);
+
+    {
+        StatsAutolock lock(mLock, mStats.lock);
+
+        if (cols != mCols) {
+            // Only rows someone looks at or pops get rewrapped, so this is
+            // cheap however deep history is
+            Mutex::Autolock scrollLock(mScrollLock);
+            resetReflowLocked(cols);
+        }
+
+        mRows = rows;
+        mCols = cols;
+        setScrollSize(scrollRows);
+        resizeDirtyLocked();
+
+        if (mStarted) {
+            struct winsize size = { rows, cols, 0, 0 };
+            ioctl(mMasterFd, TIOCSWINSZ, &size);
+        }
+
+        vterm_set_size(mVt, rows, cols);
+        flushDamageLocked();
+    }
+
+    // Recorded outside mLock; the recorder skips sizes it already has
+    Mutex::Autolock lock(mRecordLock);
+    if (mRecorder.isOpen()) {
+        mRecorder.recordResize(systemTime(), rows, cols);
+    }
+    return 0;
+}
+
+status_t Terminal::setColors(int fg, int bg) {
+    StatsAutolock lock(mLock, mStats.lock);
+
+    ALOGD("setColors(0x%x, 0x%x)", fg, bg);
+
+    VTermState* state = vterm_obtain_state(mVt);
+    VTermColor oldFgColor, oldBgColor;
+    vterm_state_get_default_colors(state, &oldFgColor, &oldBgColor);
+
+    int changed = fg != toArgb(oldFgColor) || bg != toArgb(oldBgColor);
+    VTermColor fg_color = { (uint8_t)((fg>>16)&0xff),
+                            (uint8_t)((fg>>8)&0xff),
+                            (uint8_t)(fg&0xff) };
+    VTermColor bg_color = { (uint8_t)((bg>>16)&0xff),
+                            (uint8_t)((bg>>8)&0xff),
+                            (uint8_t)(bg&0xff) };
+    vterm_state_set_default_colors(state, &fg_color, &bg_color);
+
+    VTermPos oldPos, newPos;
+    vterm_state_get_cursorpos(state, &oldPos);
+    vterm_state_reset(state, changed);
+    vterm_state_get_cursorpos(state, &newPos);
+
+    if (oldPos.row != newPos.row || oldPos.col != newPos.col) {
+        onCursorChange(oldPos, newPos, mCursorVisible);
+    }
+
+    flushDamageLocked();
+
+    return 0;
+}
+
+int Terminal::onDamage(const VTermRect& rect) {
+    mStats.damageCallbacks++;
+    if (mJumping) {
+        mJumpDirty = true;
+        return 1;
+    }
+    markDirtyLocked(rect.start_row, rect.end_row);
+    return 1;
+}
+
+int Terminal::onMoveRect(const VTermRect& dest, const VTermRect& src) {
+    mStats.moveRectCallbacks++;
+    if (dest.start_row == 0 && src.start_row > 0 && src.end_row == mRows
+            && dest.start_col == 0 && src.start_col == 0
+            && dest.end_col == mCols && src.end_col == mCols) {
+        // Whole screen scrolled up; libvterm damages the exposed rows itself.
+        // Tracked even while jumping so the row hashes stay in step.
+        scrollDirtyLocked(src.start_row);
+        return 1;
+    }
+    if (mJumping) {
+        mJumpDirty = true;
+        return 1;
+    }
+    markDirtyLocked(dest.start_row, dest.end_row);
+    return 1;
+}
+
+int Terminal::onCursorChange(const VTermPos& oldPos, const VTermPos& newPos, bool visible) {
+    mStats.cursorCallbacks++;
+    mCursorVisible = visible;
+    mCursorPos = newPos;
+    mCursorDirty = true;
+    return 1;
+}
+
+void Terminal::markDirtyLocked(int startRow, int endRow) {
+    if (startRow < 0) {
+        startRow = 0;
+    }
+    if (endRow > mRows) {
+        endRow = mRows;
+    }
+    if (startRow >= endRow) {
+        return;
+    }
+
+    if (++mContentVersion == 0) {
+        mContentVersion = 1;
+    }
+    for (int row = startRow; row < endRow; row++) {
+        mDirtyRows[row >> 5] |= 1u << (row & 31);
+        mRowVersions[row] = mContentVersion;
+    }
+
+    if (mDirtyStart == mDirtyEnd) {
+        mDirtyStart = startRow;
+        mDirtyEnd = endRow;
+    } else {
+        if (startRow < mDirtyStart) mDirtyStart = startRow;
+        if (endRow > mDirtyEnd) mDirtyEnd = endRow;
+    }
+}
+
+/*
+ * Moves pending damage, row versions and row hashes up with a full screen
+ * scroll. Frames rotate their rows to match when next filled, so only the
+ * rows exposed at the bottom are due to be copied again.
+ */
+void Terminal::scrollDirtyLocked(dimen_t rows) {
+    if (rows > mRows) {
+        rows = mRows;
+    }
+
+    if (mDirtyStart != mDirtyEnd) {
+        const dimen_t start = mDirtyStart > rows ? mDirtyStart - rows : 0;
+        const dimen_t end = mDirtyEnd > rows ? mDirtyEnd - rows : 0;
+        for (dimen_t row = start; row < mDirtyEnd; row++) {
+            const dimen_t from = row + rows;
+            const bool dirty = from < mDirtyEnd
+                    && (mDirtyRows[from >> 5] & (1u << (from & 31)));
+            if (dirty) {
+                mDirtyRows[row >> 5] |= 1u << (row & 31);
+            } else {
+                mDirtyRows[row >> 5] &= ~(1u << (row & 31));
+            }
+        }
+        mDirtyStart = start < end ? start : 0;
+        mDirtyEnd = start < end ? end : 0;
+    }
+
+    memmove(mRowHashes, mRowHashes + rows, (mRows - rows) * sizeof(uint64_t));
+    memset(mRowHashes + mRows - rows, 0, rows * sizeof(uint64_t));
+
+    if (++mContentVersion == 0) {
+        mContentVersion = 1;
+    }
+    memmove(mRowVersions, mRowVersions + rows, (mRows - rows) * sizeof(uint32_t));
+    for (dimen_t row = mRows - rows; row < mRows; row++) {
+        mRowVersions[row] = mContentVersion;
+    }
+
+    mScrollOffset += rows;
+    mStats.shiftedRows += mRows - rows;
+}
+
+/*
+ * Sizes the dirty bitmap for the current number of rows. Pending damage is
+ * discarded, so the whole screen is marked dirty instead.
+ */
+void Terminal::resizeDirtyLocked() {
+    free(mRowVersions);
+    mRowVersions = (uint32_t*) malloc(mRows * sizeof(uint32_t));
+    free(mRowHashes);
+    mRowHashes = (uint64_t*) calloc(mRows, sizeof(uint64_t));
+
+    size_t words = (mRows + 31) / 32;
+    if (words != mDirtyWords) {
+        free(mDirtyRows);
+        mDirtyRows = (uint32_t*) malloc(words * sizeof(uint32_t));
+        mDirtyWords = words;
+    }
+
+    memset(mDirtyRows, 0, words * sizeof(uint32_t));
+    mDirtyStart = 0;
+    mDirtyEnd = 0;
+    mDeliveredOffset = mScrollOffset;
+    markDirtyLocked(0, mRows);
+}
+
+/*
+ * Brings the back frame up to date with the screen and publishes it. Rows
+ * whose content turns out the same as when their damage was last delivered
+ * are taken out of the pending damage.
+ */
+void Terminal::publishFrameLocked() {
+    ScreenFrame* frame = mSnapshot.backFrame();
+    if (frame->rows != mRows || frame->cols != mCols) {
+        frame->resize(mRows, mCols);
+    } else {
+        // Catch up with scrolls since this frame was last filled
+        frame->shiftRows(mScrollOffset - frame->scrollOffset);
+    }
+
+    VTermColor fg, bg;
+    vterm_state_get_default_colors(vterm_obtain_state(mVt), &fg, &bg);
+    frame->defaultFg = packColor(fg);
+    frame->defaultBg = packColor(bg);
+
+    VTermScreenCell cell;
+    VTermPos pos;
+    dimen_t dirtyStart = mRows;
+    dimen_t dirtyEnd = 0;
+    for (pos.row = 0; pos.row < mRows; pos.row++) {
+        // Rows dirty since the last delivery always have a version no
+        // frame has seen yet, so they never take this shortcut
+        uint32_t& version = frame->rowVersion(pos.row);
+        if (version == mRowVersions[pos.row]) {
+            continue;
+        }
+
+        uint32_t* chars = frame->rowChars(pos.row);
+        style_key_t* styles = frame->rowStyles(pos.row);
+        for (pos.col = 0; pos.col < mCols; pos.col++) {
+            vterm_screen_get_cell(mVts, pos, &cell);
+            chars[pos.col] = cell.chars[0];
+            styles[pos.col] = styleKey(cell);
+        }
+        frame->indexRow(pos.row);
+        version = mRowVersions[pos.row];
+
+        uint32_t& word = mDirtyRows[pos.row >> 5];
+        const uint32_t bit = 1u << (pos.row & 31);
+        if (word & bit) {
+            uint64_t hash = hashRow(chars, styles, mCols);
+            if (hash == mRowHashes[pos.row]) {
+                word &= ~bit;
+                mStats.unchangedRows++;
+            } else {
+                mRowHashes[pos.row] = hash;
+                if (pos.row < dirtyStart) dirtyStart = pos.row;
+                dirtyEnd = pos.row + 1;
+            }
+        }
+    }
+
+    if (mDirtyStart != mDirtyEnd) {
+        // Narrow the range to rows still dirty, possibly to nothing
+        mDirtyStart = dirtyStart < dirtyEnd ? dirtyStart : 0;
+        mDirtyEnd = dirtyStart < dirtyEnd ? dirtyEnd : 0;
+    }
+
+    // Only the parser moves lines in and out of scrollback, and it holds mLock
+    frame->scrollSeq = mScrollSeq;
+    frame->scrollOffset = mScrollOffset;
+
+    mSnapshot.publish();
+}
+
+/*
+ * Hands all damage accumulated since the last delivery to the listener in a
+ * single callback, then resets the accumulator.
+ */
+void Terminal::deliverDamageLocked() {
+    if (mDirtyStart == mDirtyEnd && !mCursorDirty && mScrollOffset == mDeliveredOffset) {
+        return;
+    }
+
+    size_t firstWord = mDirtyStart >> 5;
+    size_t lastWord = mDirtyStart == mDirtyEnd ? firstWord : ((mDirtyEnd - 1) >> 5) + 1;
+    mStats.damageDeliveries++;
+    mListener->onDamage(mDirtyStart, mDirtyEnd, mDirtyRows, mDirtyWords, mScrollSeq,
+            mScrollOffset, mCursorPos, mCursorVisible);
+
+    memset(mDirtyRows + firstWord, 0, (lastWord - firstWord) * sizeof(uint32_t));
+    mDirtyStart = 0;
+    mDirtyEnd = 0;
+    mDeliveredOffset = mScrollOffset;
+    mCursorDirty = false;
+}
+
+/*
+ * Returns slot holding given scrollback row, where row 1 is the most recently
+ * pushed line. Caller must ensure 1 <= scrollRow <= mScrollCur.
+ */
+ScrollbackLine*& Terminal::scrollLine(size_t scrollRow) {
+    size_t index = mScrollHead + mScrollAlloc - scrollRow;
+    if (index >= mScrollAlloc) {
+        index -= mScrollAlloc;
+    }
+    return mScroll[index];
+}
+
+/*
+ * Returns given scrollback row from either tier, or NULL if a spilled line
+ * couldn't be mapped. Caller must hold mScrollLock and ensure
+ * 1 <= scrollRow <= scrollCountLocked().
+ */
+const ScrollbackLine* Terminal::getScrollLineLocked(size_t scrollRow) {
+    if (scrollRow <= mScrollCur) {
+        return scrollLine(scrollRow);
+    }
+    return mSpill.get(scrollRow - mScrollCur - 1);
+}
+
+/*
+ * Number of lines the in-memory buffer may hold.
+ */
+size_t Terminal::hotLimitLocked() const {
+    if (mSpill.isOpen() && mScrollHotSize < mScrollSize) {
+        // Pushes always go through memory, so keep at least one slot
+        return mScrollHotSize > 0 ? mScrollHotSize : 1;
+    }
+    return mScrollSize;
+}
+
+/*
+ * Moves the oldest in-memory line to the spill. If it can't be written, the
+ * spill is dropped instead of leaving a hole in history.
+ */
+void Terminal::spillOldestLocked() {
+    ScrollbackLine*& oldest = scrollLine(mScrollCur);
+    if (mSpill.append(oldest) != OK) {
+        ALOGW("dropping %zu spilled scrollback lines", mSpill.size());
+        mSpill.clear();
+    }
+    ScrollbackLine::destroy(mScrollHeap, oldest);
+    oldest = NULL;
+    mScrollCur--;
+}
+
+status_t Terminal::setScrollbackSpill(const char* dir, size_t hotRows) {
+    StatsAutolock lock(mLock, mStats.lock);
+    Mutex::Autolock scrollLock(mScrollLock);
+
+    // Lines leave the spill from the old end, which readers see as a trim
+    if (dir == NULL) {
+        mSpill.close();
+    } else {
+        status_t res = mSpill.open(dir);
+        if (res != OK) {
+            return res;
+        }
+    }
+    mScrollHotSize = hotRows;
+
+    const size_t hotLimit = hotLimitLocked();
+    while (mScrollCur > hotLimit) {
+        spillOldestLocked();
+    }
+    if (mScrollAlloc > hotLimit) {
+        reallocScroll(hotLimit);
+    }
+    return OK;
+}
+
+void Terminal::setVisible(bool visible) {
+    ScrollbackBudget::getInstance().setVisible(this, visible);
+}
+
+/*
+ * Reports what scrollback holds now. Called with no locks held, since the
+ * budget may trim this or any other session in response.
+ */
+void Terminal::updateBudget() {
+    size_t bytes;
+    {
+        Mutex::Autolock lock(mScrollLock);
+        bytes = budgetBytesLocked();
+    }
+    ScrollbackBudget::getInstance().update(this, bytes);
+}
+
+/*
+ * Called by the budget to shed memory. Rewrapped rows deep in history go
+ * first, since they can be walked again, then slack left behind by earlier
+ * trims; after that the oldest in-memory lines are moved to the spill if
+ * there is one, keeping history intact, or dropped if there isn't.
+ */
+size_t Terminal::trimScrollback(size_t bytes) {
+    Mutex::Autolock lock(mScrollLock);
+
+    const size_t held = budgetBytesLocked();
+    if (mReflowing) {
+        shedReflowLocked();
+    }
+    const size_t shed = held - budgetBytesLocked();
+    const size_t rest = bytes > shed ? bytes - shed : 0;
+    const size_t lineBytes = mScrollHeap.bytesHeld() + mScrollAlloc * sizeof(ScrollbackLine*);
+    const size_t goal = lineBytes > rest ? lineBytes - rest : 0;
+    const size_t count = mScrollCur;
+    while (mScrollCur > 0
+            && mScrollHeap.bytesUsed() + mScrollCur * sizeof(ScrollbackLine*) > goal) {
+        if (mSpill.isOpen()) {
+            spillOldestLocked();
+        } else {
+            ScrollbackLine*& oldest = scrollLine(mScrollCur);
+            ScrollbackLine::destroy(mScrollHeap, oldest);
+            oldest = NULL;
+            mScrollCur--;
+        }
+    }
+
+    if (mReflowing && mReflowEnd <= mScrollSeq - scrollCountLocked()) {
+        // Everything that needed rewrapping was dropped
+        stopReflowLocked();
+    } else if (mReflowing) {
+        pruneReflowLocked();
+    }
+    compactScrollLocked();
+
+    if (mScrollCur < count) {
+        mStats.budgetTrims++;
+        ALOGD("budget trimmed %zu lines of scrollback, %zu -> %zu bytes", count - mScrollCur,
+                held, budgetBytesLocked());
+    }
+    return budgetBytesLocked();
+}
+
+/*
+ * Moves in-memory lines into a fresh heap and slot array sized for what's
+ * left, releasing slabs that trimming left mostly free. Keeps everything as
+ * is if too little of the heap is free to bother, or the copy can't be made.
+ */
+void Terminal::compactScrollLocked() {
+    const size_t slack = mScrollHeap.bytesHeld() - mScrollHeap.bytesUsed();
+    if (slack == 0 || (slack < COMPACT_MIN_SLACK && slack < mScrollHeap.bytesUsed())) {
+        return;
+    }
+
+    const size_t hotLimit = hotLimitLocked();
+    size_t alloc = mScrollCur > MIN_SCROLL_ALLOC ? mScrollCur : MIN_SCROLL_ALLOC;
+    if (alloc > hotLimit) {
+        alloc = hotLimit;
+    }
+    if (alloc == 0) {
+        return;
+    }
+
+    ScrollbackLine** scroll = (ScrollbackLine**) malloc(sizeof(ScrollbackLine*) * alloc);
+    if (scroll == NULL) {
+        return;
+    }
+    SlabAllocator heap;
+    for (size_t i = 0; i < mScrollCur; i++) {
+        scroll[i] = ScrollbackLine::clone(heap, scrollLine(mScrollCur - i));
+        if (scroll[i] == NULL) {
+            // Copies made so far go away with heap
+            free(scroll);
+            return;
+        }
+    }
+
+    free(mScroll);
+    mScroll = scroll;
+    mScrollAlloc = alloc;
+    mScrollHead = (mScrollCur == alloc) ? 0 : mScrollCur;
+
+    // Old lines and their slabs are released as heap goes out of scope
+    mScrollHeap.swap(heap);
+}
+
+status_t Terminal::startRecording(const char* path) {
+    Mutex::Autolock lock(mRecordLock);
+    dimen_t rows, cols;
+    {
+        // A resize racing with this records its new size after applying it
+        StatsAutolock termLock(mLock, mStats.lock);
+        rows = mRows;
+        cols = mCols;
+    }
+    return mRecorder.open(path, rows, cols);
+}
+
+void Terminal::stopRecording() {
+    Mutex::Autolock lock(mRecordLock);
+    mRecorder.close();
+}
+
+bool Terminal::isRecording() {
+    Mutex::Autolock lock(mRecordLock);
+    return mRecorder.isOpen();
+}
+
+/*
+ * Called by the reader for every chunk as it goes into the ring, so the
+ * recording keeps the timing the child produced output with.
+ */
+void Terminal::recordOutput(const char* bytes, size_t len) {
+    Mutex::Autolock lock(mRecordLock);
+    if (mRecorder.isOpen()) {
+        mRecorder.recordOutput(systemTime(), bytes, len);
+    }
+}
+
+/*
+ * Moves scrollback into a buffer of given number of slots, unwrapping it so
+ * the oldest line lands in slot 0. Caller must ensure all lines fit.
+ */
+void Terminal::reallocScroll(size_t alloc) {
+    ScrollbackLine** scroll = (ScrollbackLine**) malloc(sizeof(ScrollbackLine*) * alloc);
+    for (size_t i = 0; i < mScrollCur; i++) {
+        scroll[i] = scrollLine(mScrollCur - i);
+    }
+
+    free(mScroll);
+    mScroll = scroll;
+    mScrollAlloc = alloc;
+    mScrollHead = (mScrollCur == alloc) ? 0 : mScrollCur;
+}
+
+/*
+ * Changes scrollback capacity, keeping as many of the most recent lines as
+ * still fit.
+ */
+void Terminal::setScrollSize(size_t size) {
+    Mutex::Autolock lock(mScrollLock);
+
+    if (size == mScrollSize) {
+        return;
+    }
+
+    if (scrollCountLocked() > size) {
+        mSpill.trim(size > mScrollCur ? size - mScrollCur : 0);
+    }
+    while (mScrollCur > size) {
+        ScrollbackLine*& oldest = scrollLine(mScrollCur);
+        ScrollbackLine::destroy(mScrollHeap, oldest);
+        oldest = NULL;
+        mScrollCur--;
+    }
+
+    mScrollSize = size;
+    const size_t hotLimit = hotLimitLocked();
+    while (mScrollCur > hotLimit) {
+        spillOldestLocked();
+    }
+    if (mScrollAlloc > hotLimit) {
+        reallocScroll(hotLimit);
+    }
+}
+
+status_t Terminal::onPushline(dimen_t cols, const VTermScreenCell* cells) {
+    Mutex::Autolock lock(mScrollLock);
+
+    // libvterm doesn't say whether a line ended in a newline or ran into
+    // the margin, so treat a line whose last column is written as wrapped
+    bool wrapped = cols > 0 && cells[cols - 1].chars[0] != 0;
+    ScrollbackLine* line = ScrollbackLine::create(mScrollHeap, mStyles, cols, cells, wrapped);
+    if (line == NULL) {
+        return 0;
+    }
+    if (!pushLineLocked(line)) {
+        return 1;
+    }
+
+    if (cols != mReflowCols) {
+        // Pushed by libvterm while resizing, at the width it had before
+        resetReflowLocked(mReflowCols);
+    } else if (mReflowing && mReflowEnd <= mScrollSeq - scrollCountLocked()) {
+        // Everything that needed rewrapping has fallen off the end
+        stopReflowLocked();
+    } else if (mReflowing) {
+        pruneReflowLocked();
+    }
+    return 1;
+}
+
+/*
+ * Adds line as the newest scrollback line, taking ownership of it. Returns
+ * false if scrollback is disabled and the line was dropped.
+ */
+bool Terminal::pushLineLocked(ScrollbackLine* line) {
+    if (mScrollSize == 0) {
+        ScrollbackLine::destroy(mScrollHeap, line);
+        return false;
+    }
+
+    const size_t hotLimit = hotLimitLocked();
+    if (mScrollCur == mScrollAlloc && mScrollAlloc < hotLimit) {
+        /* Grow geometrically up to the configured capacity */
+        size_t alloc = mScrollAlloc < MIN_SCROLL_ALLOC ? MIN_SCROLL_ALLOC : mScrollAlloc * 2;
+        reallocScroll(alloc < hotLimit ? alloc : hotLimit);
+    }
+
+    if (mScrollCur == mScrollAlloc) {
+        /* Buffer is full, so head points at oldest row */
+        if (mSpill.isOpen()) {
+            spillOldestLocked();
+        } else {
+            ScrollbackLine::destroy(mScrollHeap, mScroll[mScrollHead]);
+            mScrollCur--;
+        }
+    }
+
+    mScroll[mScrollHead] = line;
+    if (++mScrollHead == mScrollAlloc) {
+        mScrollHead = 0;
+    }
+    mScrollCur++;
+    mScrollSeq++;
+
+    if (scrollCountLocked() > mScrollSize) {
+        mSpill.trim(mScrollSize - mScrollCur);
+    }
+    return true;
+}
+
+status_t Terminal::onPopline(dimen_t cols, VTermScreenCell* cells) {
+    Mutex::Autolock lock(mScrollLock);
+
+    if (mReflowing && mScrollSeq == mReflowEnd) {
+        return popReflowedLocked(cols, cells);
+    }
+    return popLineLocked(cols, cells);
+}
+
+/*
+ * Removes the newest scrollback line, expanding it into cols cells.
+ */
+bool Terminal::popLineLocked(dimen_t cols, VTermScreenCell* cells) {
+    if (scrollCountLocked() == 0) {
+        return false;
+    }
+
+    if (mScrollCur == 0) {
+        // Memory tier drained, so fault the newest spilled line back in
+        const ScrollbackLine* spilled = mSpill.get(0);
+        if (spilled == NULL) {
+            mSpill.clear();
+            return false;
+        }
+        spilled->expand(mStyles, cols, cells);
+        mSpill.removeNewest();
+    } else {
+        mScrollHead = (mScrollHead == 0 ? mScrollAlloc : mScrollHead) - 1;
+        mScrollCur--;
+
+        ScrollbackLine* line = mScroll[mScrollHead];
+        mScroll[mScrollHead] = NULL;
+
+        line->expand(mStyles, cols, cells);
+        ScrollbackLine::destroy(mScrollHeap, line);
+    }
+
+    mScrollSeq--;
+    if (mScrollSeq < mScrollInvalidFrom) {
+        mScrollInvalidFrom = mScrollSeq;
+    }
+    return true;
+}
+
+/*
+ * Starts rewrapping all of scrollback to cols, forgetting any earlier memo.
+ */
+void Terminal::resetReflowLocked(dimen_t cols) {
+    mReflowing = scrollCountLocked() > 0;
+    mReflowCols = cols;
+    mReflowEnd = mScrollSeq;
+    mReflowNext = mScrollSeq;
+    mReflowRows.clear();
+    mReflowBase = 0;
+    mReflowReported = 0;
+
+    // Cached rows are keyed by line or memo index, and both just changed
+    mScrollInvalidFrom = 0;
+}
+
+/*
+ * Goes back to mapping scrollback rows one to one with stored lines.
+ */
+void Terminal::stopReflowLocked() {
+    mReflowing = false;
+    mReflowRows.clear();
+    mReflowBase = 0;
+    mReflowReported = 0;
+}
+
+/*
+ * Walks older logical lines into the memo until it holds at least rows
+ * rows past mReflowBase, or all of scrollback has been walked.
+ */
+void Terminal::extendReflowLocked(size_t rows) {
+    const size_t oldest = mScrollSeq - scrollCountLocked();
+    const dimen_t width = mReflowCols > 0 ? mReflowCols : 1;
+
+    while (mReflowRows.size() - mReflowBase < rows && mReflowNext > oldest) {
+        // Logical line ends at the newest unwalked line and starts after
+        // the first older line that doesn't wrap
+        const size_t last = mReflowNext - 1;
+        size_t first = last;
+        while (first > oldest) {
+            const ScrollbackLine* prev = getScrollLineLocked(mScrollSeq - (first - 1));
+            if (prev == NULL || !prev->isWrapped()) {
+                break;
+            }
+            first--;
+        }
+
+        size_t len = 0;
+        for (size_t seq = first; seq <= last; seq++) {
+            const ScrollbackLine* line = getScrollLineLocked(mScrollSeq - seq);
+            if (line == NULL) {
+                break;
+            }
+            len += (seq < last) ? line->cols : line->length();
+        }
+
+        if (len <= width) {
+            ReflowRow row = { first, 0 };
+            mReflowRows.add(row);
+        } else {
+            // Need the text to avoid splitting wide characters across rows
+            if (mReflowCharsAlloc < len) {
+                free(mReflowChars);
+                mReflowChars = (uint32_t*) malloc(len * sizeof(uint32_t));
+                mReflowCharsAlloc = len;
+            }
+            size_t pos = 0;
+            for (size_t seq = first; seq <= last && pos < len; seq++) {
+                const ScrollbackLine* line = getScrollLineLocked(mScrollSeq - seq);
+                if (line == NULL) {
+                    break;
+                }
+                dimen_t n = (len - pos < line->cols) ? len - pos : line->cols;
+                line->expandChars(n, mReflowChars + pos);
+                pos += n;
+            }
+
+            // Rows go into the memo newest first, so flip them once added
+            const size_t start = mReflowRows.size();
+            for (size_t offset = 0; offset < len; ) {
+                ReflowRow row = { first, offset };
+                mReflowRows.add(row);
+                size_t end = offset + width;
+                if (end < len && width > 1 && mReflowChars[end] == CHAR_CONTINUATION) {
+                    end--;
+                }
+                offset = end;
+            }
+            for (size_t i = start, j = mReflowRows.size() - 1; i < j; i++, j--) {
+                const ReflowRow swap = mReflowRows[i];
+                mReflowRows.editItemAt(i) = mReflowRows[j];
+                mReflowRows.editItemAt(j) = swap;
+            }
+        }
+        mReflowNext = first;
+    }
+
+    if (mReflowRows.capacity() > mReflowReported && mStarted) {
+        // Readers grow the memo too, so tell the budget without waiting
+        // for more output to come along
+        mReflowReported = mReflowRows.capacity();
+        signalParser();
+    }
+}
+
+/*
+ * Forgets memo rows nobody can reach any more: ones popped back onto the
+ * screen, and ones whose lines were dropped off the old end. Only the
+ * parser calls this, since the popped rows going away renumbers the rest.
+ */
+void Terminal::pruneReflowLocked() {
+    const size_t oldest = mScrollSeq - scrollCountLocked();
+    size_t end = mReflowRows.size();
+    while (end > mReflowBase && mReflowRows[end - 1].seq < oldest) {
+        end--;
+    }
+    if (end < mReflowRows.size()) {
+        mReflowRows.removeItemsAt(end, mReflowRows.size() - end);
+    }
+
+    // Popped rows are reclaimed once they're half the memo, so the move is
+    // paid for by the pops that got there
+    if (mReflowBase > 0 && mReflowBase >= mReflowRows.size() / 2) {
+        mReflowRows.removeItemsAt(0, mReflowBase);
+        mReflowBase = 0;
+        mScrollInvalidFrom = 0;
+    }
+    mReflowReported = mReflowRows.capacity();
+}
+
+/*
+ * Drops memo rows more than REFLOW_KEEP_ROWS deep, so a search that walked
+ * all of history doesn't pin a row for each of its lines. The cut falls
+ * between logical lines, and whatever is looked at below it is walked
+ * again, coming out the same as before.
+ */
+void Terminal::shedReflowLocked() {
+    size_t end = mReflowBase + REFLOW_KEEP_ROWS;
+    while (end < mReflowRows.size() && mReflowRows[end - 1].offset != 0) {
+        end++;
+    }
+    if (end >= mReflowRows.size()) {
+        return;
+    }
+
+    mReflowNext = mReflowRows[end - 1].seq;
+    mReflowRows.removeItemsAt(end, mReflowRows.size() - end);
+    mReflowRows.setCapacity(end);
+    mReflowReported = mReflowRows.capacity();
+
+    free(mReflowChars);
+    mReflowChars = NULL;
+    mReflowCharsAlloc = 0;
+}
+
+/*
+ * Maps scrollback row k, where 1 is the newest, to either a stored row,
+ * setting reflowIndex to SIZE_MAX, or to a rewrapped row in the memo.
+ * Returns false if there is no such row.
+ */
+bool Terminal::findScrollRowLocked(size_t scrollRow, size_t* storedRow, size_t* reflowIndex) {
+    *reflowIndex = SIZE_MAX;
+    const size_t direct = mReflowing ? mScrollSeq - mReflowEnd : SIZE_MAX;
+    if (scrollRow <= direct) {
+        *storedRow = scrollRow;
+        return scrollRow >= 1 && scrollRow <= scrollCountLocked();
+    }
+
+    const size_t memoRow = scrollRow - direct - 1;
+    extendReflowLocked(memoRow + 1);
+    const size_t index = mReflowBase + memoRow;
+    if (index >= mReflowRows.size()
+            || mReflowRows[index].seq < mScrollSeq - scrollCountLocked()) {
+        return false;
+    }
+    *reflowIndex = index;
+    return true;
+}
+
+/*
+ * Scrollback rows as readers see them. Rows below what's been walked are
+ * counted one per stored line, so this grows as the memo is extended.
+ */
+size_t Terminal::scrollDisplayCountLocked() {
+    const size_t count = scrollCountLocked();
+    if (!mReflowing) {
+        return count;
+    }
+    const size_t oldest = mScrollSeq - count;
+    return (mScrollSeq - mReflowEnd) + (mReflowRows.size() - mReflowBase)
+            + (mReflowNext > oldest ? mReflowNext - oldest : 0);
+}
+
+/*
+ * Fills cols cells of a rewrapped row into the given arrays, of which keys
+ * and runStarts may be NULL, and returns the number of runs. Only the part
+ * of the logical line under the row is expanded. Caller must hold mReadLock
+ * and mScrollLock.
+ */
+dimen_t Terminal::expandReflowRowLocked(size_t index, dimen_t cols, uint32_t* chars,
+        style_key_t* keys, dimen_t* runStarts) {
+    const ReflowRow& row = mReflowRows[index];
+    const dimen_t width = mReflowCols < cols ? mReflowCols : cols;
+    size_t end = row.offset + width;
+    if (index > mReflowBase && mReflowRows[index - 1].seq == row.seq
+            && mReflowRows[index - 1].offset < end) {
+        end = mReflowRows[index - 1].offset;
+    }
+
+    // Expand just the stored lines overlapping [offset, end), with room to
+    // pad the last one out past its own width
+    size_t filled = 0;
+    size_t pos = 0;
+    for (size_t seq = row.seq; seq < mScrollSeq && pos < end; seq++) {
+        const ScrollbackLine* line = getScrollLineLocked(mScrollSeq - seq);
+        if (line == NULL) {
+            break;
+        }
+        const bool last = !line->isWrapped() || seq + 1 == mReflowEnd;
+        if (pos + line->cols <= row.offset && !last) {
+            pos += line->cols;
+            continue;
+        }
+
+        const size_t skip = row.offset > pos ? row.offset - pos : 0;
+        const dimen_t n = last ? skip + width : line->cols;
+        if (mReadLineAlloc < filled + n) {
+            size_t alloc = (filled + n) * 2;
+            mReadLineChars = (uint32_t*) realloc(mReadLineChars, alloc * sizeof(uint32_t));
+            mReadLineStyles = (style_key_t*) realloc(mReadLineStyles,
+                    alloc * sizeof(style_key_t));
+            mReadLineRuns = (dimen_t*) realloc(mReadLineRuns, alloc * sizeof(dimen_t));
+            mReadLineAlloc = alloc;
+        }
+        line->expandRow(mStyles, n, mReadLineChars + filled, mReadLineStyles + filled,
+                mReadLineRuns);
+
+        // Keep everything from the row's first cell on
+        if (skip > 0) {
+            memmove(mReadLineChars, mReadLineChars + filled + skip,
+                    (n - skip) * sizeof(uint32_t));
+            memmove(mReadLineStyles, mReadLineStyles + filled + skip,
+                    (n - skip) * sizeof(style_key_t));
+            filled = n - skip;
+        } else {
+            filled += n;
+        }
+        pos += line->cols;
+        if (last) {
+            break;
+        }
+    }
+
+    // Cells past the row's end belong to the next row or to nothing
+    size_t used = end - row.offset;
+    if (used > filled) {
+        used = filled;
+    }
+    style_key_t fillKey = used < filled ? mReadLineStyles[used]
+            : (used > 0 ? mReadLineStyles[used - 1] : 0);
+    for (size_t col = 0; col < cols; col++) {
+        bool inside = col < used;
+        chars[col] = inside ? mReadLineChars[col] : 0;
+        if (keys != NULL) {
+            keys[col] = inside ? mReadLineStyles[col] : fillKey;
+        }
+    }
+
+    if (keys == NULL || runStarts == NULL) {
+        return 0;
+    }
+    dimen_t runCount = 0;
+    for (size_t col = 0; col < cols; col = findStyleRunEnd(keys, col, cols)) {
+        runStarts[runCount++] = col;
+    }
+    return runCount;
+}
+
+/*
+ * Pops the newest rewrapped row. Its whole logical line comes out of
+ * scrollback and goes back in at the new width, minus the row being popped,
+ * so lines below it keep their numbers and memo rows.
+ */
+bool Terminal::popReflowedLocked(dimen_t cols, VTermScreenCell* cells) {
+    extendReflowLocked(1);
+    const size_t oldest = mScrollSeq - scrollCountLocked();
+    if (mReflowBase == mReflowRows.size() || mReflowRows[mReflowBase].seq < oldest) {
+        // Start of the logical line is gone; pop what's left as it is
+        stopReflowLocked();
+        return popLineLocked(cols, cells);
+    }
+
+    const size_t first = mReflowRows[mReflowBase].seq;
+    size_t rows = 1;
+    while (mReflowBase + rows < mReflowRows.size()
+            && mReflowRows[mReflowBase + rows].seq == first) {
+        rows++;
+    }
+
+    // Lay the logical line out in one buffer, padded past its end, with a
+    // spare row at the back for rows that end early
+    const dimen_t width = mReflowCols > 0 ? mReflowCols : 1;
+    const dimen_t pad = width > cols ? width : cols;
+    size_t len = 0;
+    for (size_t seq = first; seq < mScrollSeq; seq++) {
+        const ScrollbackLine* line = getScrollLineLocked(mScrollSeq - seq);
+        if (line == NULL) {
+            stopReflowLocked();
+            return popLineLocked(cols, cells);
+        }
+        len += line->cols;
+    }
+    const size_t alloc = len + pad + width;
+    if (mReflowCellsAlloc < alloc) {
+        free(mReflowCells);
+        mReflowCells = (VTermScreenCell*) malloc(alloc * sizeof(VTermScreenCell));
+        mReflowCellsAlloc = alloc;
+    }
+
+    size_t pos = len;
+    bool newest = true;
+    while (mScrollSeq > first) {
+        const ScrollbackLine* line = getScrollLineLocked(1);
+        if (line == NULL) {
+            break;
+        }
+        pos -= line->cols;
+        popLineLocked(newest ? line->cols + pad : line->cols, mReflowCells + pos);
+        newest = false;
+    }
+    if (mScrollSeq > first) {
+        stopReflowLocked();
+        return popLineLocked(cols, cells);
+    }
+
+    // Push rows back oldest first; all but the popped one continue on
+    VTermScreenCell* spare = mReflowCells + len + pad;
+    for (size_t i = rows - 1; i > 0; i--) {
+        const size_t offset = mReflowRows[mReflowBase + i].offset;
+        const size_t end = mReflowRows[mReflowBase + i - 1].offset;
+        const VTermScreenCell* rowCells = mReflowCells + offset;
+        if (end - offset < width) {
+            memcpy(spare, rowCells, (end - offset) * sizeof(VTermScreenCell));
+            for (size_t col = end - offset; col < width; col++) {
+                spare[col] = mReflowCells[end];
+                spare[col].chars[0] = 0;
+                spare[col].width = 1;
+            }
+            rowCells = spare;
+        }
+        ScrollbackLine* line = ScrollbackLine::create(mScrollHeap, mStyles, width, rowCells,
+                true);
+        if (line != NULL) {
+            pushLineLocked(line);
+        }
+    }
+
+    const size_t offset = mReflowRows[mReflowBase].offset;
+    memcpy(cells, mReflowCells + offset, cols * sizeof(VTermScreenCell));
+
+    mReflowBase += rows;
+    mReflowEnd = first;
+    if (mReflowEnd > mScrollSeq) {
+        mReflowEnd = mScrollSeq;
+    }
+    pruneReflowLocked();
+    return true;
+}
+
+const ScreenFrame* Terminal::acquireFrameLocked() {
+    return mSnapshot.acquire();
+}
+
+bool Terminal::getRowLocked(const ScreenFrame* frame, int row, CellRow* out) {
+    // The UI may be asking for rows while the model is changing underneath
+    // it, so we always fill with meaningful data.
+    out->cols = frame->cols;
+
+    if (row >= 0 && row < frame->rows) {
+        out->chars = frame->rowChars(row);
+        out->styles = frame->rowStyles(row);
+        out->runStarts = frame->rowRunStarts(row);
+        out->runCount = frame->rowRunCount(row);
+        out->valid = true;
+        return true;
+    }
+
+    if (row < 0) {
+        Mutex::Autolock lock(mScrollLock);
+        if (mScrollInvalidFrom != SIZE_MAX) {
+            invalidateScrollCacheLocked(mScrollInvalidFrom);
+            mScrollInvalidFrom = SIZE_MAX;
+        }
+
+        // Rows above the frame are numbered from its first line, so output
+        // pushed since the frame was published doesn't shift them
+        size_t scrollRow = -row;
+        size_t storedRow;
+        size_t reflowIndex;
+        const ScrollbackLine* line = NULL;
+        bool found = false;
+        if (scrollRow <= frame->scrollSeq && frame->scrollSeq - scrollRow < mScrollSeq) {
+            scrollRow = mScrollSeq - (frame->scrollSeq - scrollRow);
+            found = findScrollRowLocked(scrollRow, &storedRow, &reflowIndex);
+        }
+        if (found && reflowIndex == SIZE_MAX) {
+            line = getScrollLineLocked(storedRow);
+            found = line != NULL;
+        }
+        if (found) {
+            if (mScrollCacheCols < frame->cols) {
+                for (size_t i = 0; i < SCROLL_CACHE_ROWS; i++) {
+                    ScrollCacheEntry& entry = mScrollCache[i];
+                    free(entry.chars);
+                    free(entry.styles);
+                    free(entry.runStarts);
+                    entry.chars = NULL;
+                    entry.styles = NULL;
+                    entry.runStarts = NULL;
+                    entry.seq = SIZE_MAX;
+                }
+                mScrollCacheCols = frame->cols;
+            }
+
+            // Rewrapped rows are keyed by their place in the memo instead
+            const bool reflowed = line == NULL;
+            size_t seq = reflowed ? reflowIndex : mScrollSeq - scrollRow;
+            ScrollCacheEntry& entry = mScrollCache[seq % SCROLL_CACHE_ROWS];
+            if (entry.seq == seq && entry.reflowed == reflowed && entry.cols == frame->cols) {
+                mStats.scrollCacheHits++;
+            } else {
+                if (entry.chars == NULL) {
+                    entry.chars = (uint32_t*) malloc(mScrollCacheCols * sizeof(uint32_t));
+                    entry.styles = (style_key_t*) malloc(mScrollCacheCols * sizeof(style_key_t));
+                    entry.runStarts = (dimen_t*) malloc(mScrollCacheCols * sizeof(dimen_t));
+                }
+                if (reflowed) {
+                    entry.runCount = expandReflowRowLocked(reflowIndex, frame->cols,
+                            entry.chars, entry.styles, entry.runStarts);
+                } else {
+                    entry.runCount = line->expandRow(mStyles, frame->cols,
+                            entry.chars, entry.styles, entry.runStarts);
+                }
+                entry.seq = seq;
+                entry.reflowed = reflowed;
+                entry.cols = frame->cols;
+                mStats.scrollCacheMisses++;
+            }
+
+            out->chars = entry.chars;
+            out->styles = entry.styles;
+            out->runStarts = entry.runStarts;
+            out->runCount = entry.runCount;
+            out->valid = true;
+            return true;
+        }
+    }
+
+    // Invalid region above scrollback or below screen
+    if (mReadCols < frame->cols) {
+        free(mReadChars);
+        free(mReadStyles);
+        mReadChars = (uint32_t*) calloc(frame->cols, sizeof(uint32_t));
+        mReadStyles = (style_key_t*) calloc(frame->cols, sizeof(style_key_t));
+        mReadCols = frame->cols;
+    }
+
+    static const dimen_t wholeRow = 0;
+    out->chars = mReadChars;
+    out->styles = mReadStyles;
+    out->runStarts = &wholeRow;
+    out->runCount = frame->cols > 0 ? 1 : 0;
+    out->valid = false;
+    return false;
+}
+
+/*
+ * Returns the range [first, end) of absolute line numbers currently held in
+ * scrollback or on the given frame. Caller must hold mReadLock.
+ */
+void Terminal::getLineRangeLocked(const ScreenFrame* frame, size_t* first, size_t* end) {
+    Mutex::Autolock lock(mScrollLock);
+    *first = mScrollSeq - scrollDisplayCountLocked();
+    *end = frame->scrollSeq + frame->rows;
+    if (*first > *end) {
+        *first = *end;
+    }
+}
+
+/*
+ * Returns the codepoints of an absolute line, either straight from the
+ * frame or expanded from scrollback into scratch, which must hold at least
+ * frame->cols cells. Scrollback wins when a line is in both, since it's
+ * newer than the frame. Returns NULL if the line isn't available. Caller
+ * must hold mReadLock.
+ */
+const uint32_t* Terminal::getLineCharsLocked(const ScreenFrame* frame, size_t line,
+        uint32_t* scratch) {
+    {
+        Mutex::Autolock lock(mScrollLock);
+        if (line < mScrollSeq) {
+            size_t storedRow;
+            size_t reflowIndex;
+            if (!findScrollRowLocked(mScrollSeq - line, &storedRow, &reflowIndex)) {
+                return NULL;
+            }
+            if (reflowIndex != SIZE_MAX) {
+                expandReflowRowLocked(reflowIndex, frame->cols, scratch, NULL, NULL);
+                return scratch;
+            }
+            const ScrollbackLine* scrolled = getScrollLineLocked(storedRow);
+            if (scrolled == NULL) {
+                return NULL;
+            }
+            scrolled->expandChars(frame->cols, scratch);
+            return scratch;
+        }
+    }
+
+    if (line >= frame->scrollSeq && line < frame->scrollSeq + frame->rows) {
+        return frame->rowChars(line - frame->scrollSeq);
+    }
+    return NULL;
+}
+
+/*
+ * Drops cached scrollback rows numbered fromSeq and up. Caller must hold
+ * mReadLock.
+ */
+void Terminal::invalidateScrollCacheLocked(size_t fromSeq) {
+    for (size_t i = 0; i < SCROLL_CACHE_ROWS; i++) {
+        if (mScrollCache[i].seq != SIZE_MAX && mScrollCache[i].seq >= fromSeq) {
+            mScrollCache[i].seq = SIZE_MAX;
+        }
+    }
+}
+
+/*
+ * Collects the run of identically styled cells starting at col into data as
+ * UTF-16, stopping early if the next cell wouldn't fit. The tail of a wide
+ * character is emitted as a space so runs stay aligned to columns.
+ */
+void Terminal::getRun(const CellRow& row, dimen_t col, uint16_t* data, size_t capacity,
+        size_t* dataSize, size_t* colSize) {
+    // Run ends where the next indexed run starts
+    size_t lo = 0;
+    size_t hi = row.runCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (row.runStarts[mid] <= col) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const size_t end = lo < row.runCount ? row.runStarts[lo] : row.cols;
+
+    *dataSize = 0;
+    *colSize = 0;
+    while (col < end) {
+        // Bulk of most runs is BMP text that maps one cell to one unit
+        size_t room = capacity - *dataSize;
+        size_t n = widenBmpChars(row.chars + col, end - col < room ? end - col : room,
+                data + *dataSize);
+        col += n;
+        *dataSize += n;
+        *colSize += n;
+        if (col == end || *dataSize == capacity) {
+            break;
+        }
+
+        // Stopped at an astral character; only include it if it fits
+        if (*dataSize + 2 > capacity) {
+            break;
+        }
+        uint32_t rawCell = row.chars[col];
+        data[(*dataSize)++] = (((rawCell - 0x10000) >> 10) & 0x3ff) + 0xd800;
+        data[(*dataSize)++] = ((rawCell - 0x10000) & 0x3ff) + 0xdc00;
+        (*colSize)++;
+        col++;
+    }
+}
+
+dimen_t Terminal::getRows() const {
+    return mRows;
+}
+
+dimen_t Terminal::getCols() const {
+    return mCols;
+}
+
+size_t Terminal::getScrollRows() const {
+    return mScrollSize;
+}
+
+/*
+ * Scrollback rows currently held above the latest frame, as readers count
+ * them, which is never more than getScrollRows().
+ */
+size_t Terminal::getScrollbackLines() {
+    Mutex::Autolock readLock(mReadLock);
+    const ScreenFrame* frame = acquireFrameLocked();
+    Mutex::Autolock lock(mScrollLock);
+    const size_t count = scrollDisplayCountLocked();
+    const size_t newer = mScrollSeq > frame->scrollSeq ? mScrollSeq - frame->scrollSeq : 0;
+    return count > newer ? count - newer : 0;
+}
+
+size_t Terminal::getScrollbackBytesHeld() {
+    Mutex::Autolock lock(mScrollLock);
+    return mScrollHeap.bytesHeld() + mScrollAlloc * sizeof(ScrollbackLine*)
+            + mSpill.bytesMapped();
+}
+
+size_t Terminal::getScrollbackBytesUsed() {
+    Mutex::Autolock lock(mScrollLock);
+    return mScrollHeap.bytesUsed() + mScrollCur * sizeof(ScrollbackLine*);
+}
+
+/*
+ * Copies up to count values, ordered by the STAT_* indices, into out and
+ * returns the number written. Each group is read under its own lock, so
+ * values may be from slightly different moments.
+ */
+size_t Terminal::getStats(uint64_t* out, size_t count) {
+    uint64_t values[STAT_COUNT];
+
+    {
+        Mutex::Autolock lock(mLock);
+        values[STAT_UPTIME_NS] = systemTime() - mCreated;
+        values[STAT_BYTES_PARSED] = mStats.bytesParsed;
+        values[STAT_PARSE_NS] = mStats.parseNs;
+        values[STAT_DAMAGE_CALLBACKS] = mStats.damageCallbacks;
+        values[STAT_MOVERECT_CALLBACKS] = mStats.moveRectCallbacks;
+        values[STAT_CURSOR_CALLBACKS] = mStats.cursorCallbacks;
+        values[STAT_DAMAGE_DELIVERIES] = mStats.damageDeliveries;
+        values[STAT_JUMP_SCROLLS] = mStats.jumpScrolls;
+        values[STAT_JUMP_FRAMES] = mStats.jumpFrames;
+        values[STAT_UNCHANGED_ROWS] = mStats.unchangedRows;
+        values[STAT_SHIFTED_ROWS] = mStats.shiftedRows;
+        values[STAT_LOCK_ACQUISITIONS] = mStats.lock.acquisitions;
+        values[STAT_LOCK_WAIT_NS] = mStats.lock.waitNs;
+        values[STAT_LOCK_MAX_WAIT_NS] = mStats.lock.maxWaitNs;
+        values[STAT_LOCK_HOLD_NS] = mStats.lock.holdNs;
+        values[STAT_LOCK_MAX_HOLD_NS] = mStats.lock.maxHoldNs;
+    }
+    {
+        Mutex::Autolock lock(mReaderLock);
+        values[STAT_BYTES_READ] = mStats.bytesRead;
+        values[STAT_READ_CALLS] = mStats.readCalls;
+        values[STAT_READ_BATCHES] = mStats.readBatches;
+        for (size_t i = 0; i < STATS_BATCH_BUCKETS; i++) {
+            values[STAT_BATCH_HISTOGRAM + i] = mStats.batchHistogram[i];
+        }
+        values[STAT_READ_PAUSES] = mStats.readPauses;
+    }
+    {
+        Mutex::Autolock lock(mReadLock);
+        values[STAT_CELL_RUN_CALLS] = mStats.cellRunCalls;
+        values[STAT_ROW_RUNS_CALLS] = mStats.rowRunsCalls;
+        values[STAT_SCROLL_CACHE_HITS] = mStats.scrollCacheHits;
+        values[STAT_SCROLL_CACHE_MISSES] = mStats.scrollCacheMisses;
+    }
+    {
+        Mutex::Autolock lock(mScrollLock);
+        values[STAT_SCROLLBACK_LINES] = scrollCountLocked();
+        values[STAT_SPILL_LINES] = mSpill.size();
+        values[STAT_SPILL_FILE_BYTES] = mSpill.fileBytes();
+        values[STAT_REFLOW_ROWS] = mReflowRows.size() - mReflowBase;
+        values[STAT_BUDGET_TRIMS] = mStats.budgetTrims;
+    }
+    {
+        Mutex::Autolock lock(mWriteLock);
+        values[STAT_BYTES_WRITTEN] = mStats.bytesWritten;
+        values[STAT_QUEUED_INPUT] = mWriteQueue.size();
+        values[STAT_MAX_QUEUED_INPUT] = mStats.maxQueuedInput;
+        values[STAT_WRITES_REFUSED] = mStats.writesRefused;
+    }
+    values[STAT_SCROLLBACK_BYTES_USED] = getScrollbackBytesUsed();
+    values[STAT_SCROLLBACK_BYTES_HELD] = getScrollbackBytesHeld();
+
+    if (count > STAT_COUNT) {
+        count = STAT_COUNT;
+    }
+    memcpy(out, values, count * sizeof(uint64_t));
+    return count;
+}
+
+TerminalListener* Terminal::getListener() const {
+    return mListener;
+}
+
+} /* namespace android */
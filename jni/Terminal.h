@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vterm.h>
+
+#include "ByteRing.h"
+#include "CellStyle.h"
+#include "OutputQueue.h"
+#include "ScreenSnapshot.h"
+#include "ScrollbackBudget.h"
+#include "ScrollbackLine.h"
+#include "ScrollbackSpill.h"
+#include "SessionRecording.h"
+#include "SlabAllocator.h"
+#include "TerminalReactor.h"
+#include "TerminalStats.h"
+
+namespace android {
+
+/*
+ * Row of cells as seen by run extraction, either from a published screen
+ * frame or expanded from scrollback.
+ */
+struct CellRow {
+    const uint32_t* chars;
+    const style_key_t* styles;
+    /* Start column of each style run, in order */
+    const dimen_t* runStarts;
+    dimen_t runCount;
+    dimen_t cols;
+    bool valid;
+};
+
+/*
+ * Receives batched output events from a Terminal. Called on whichever thread
+ * parsed the output, with the terminal's mLock held.
+ */
+class TerminalListener {
+public:
+    virtual ~TerminalListener() {}
+
+    /*
+     * Damage up to the frame just published, whose row 0 is line screenLine
+     * and which had scrolled scrollOffset rows in total. Rows that only
+     * moved with full screen scrolls since the last call aren't reported;
+     * the growth in scrollOffset says how far they went. Rows that changed
+     * on top of that are set in dirtyRows, one bit per screen row, and only
+     * rows in [startRow, endRow) may be set. Cursor state is as of the end
+     * of the batch.
+     */
+    virtual void onDamage(dimen_t startRow, dimen_t endRow, const uint32_t* dirtyRows,
+            size_t dirtyWords, size_t screenLine, uint64_t scrollOffset,
+            const VTermPos& cursorPos, bool cursorVisible) = 0;
+    virtual int onTermProp(VTermProp prop, const VTermValue& val) = 0;
+    virtual int onBell() = 0;
+};
+
+/*
+ * Terminal session: a pty, the libvterm state parsing its output, and the
+ * scrollback and published frames rendering reads from. Has no dependency
+ * on the VM, so it can also be driven directly on a host.
+ */
+class Terminal : public TerminalReactor::Session, public ScrollbackBudget::Client {
+public:
+    Terminal(TerminalListener* listener);
+    ~Terminal();
+
+    /*
+     * Program start() runs instead of the default shell, or the default
+     * shell again for a NULL path. A NULL argv runs path with just its own
+     * name, and a NULL envp passes on the app's environment. Only allowed
+     * before start().
+     */
+    status_t setCommand(const char* path, const char* const* argv, const char* const* envp);
+
+    /* Spawns the shell and hands the pty to the reactors */
+    status_t start();
+
+    /* Reading side, on the I/O reactor; never takes mLock */
+    virtual bool onReadable();
+    virtual void onWritable();
+    virtual nsecs_t getDeadline();
+    virtual void onDeadline(nsecs_t now);
+
+    /*
+     * Parses output as if it had been read from the pty. Damage is held
+     * until the next flushDamage() or frame deadline.
+     */
+    void pushBytes(const char* bytes, size_t len);
+    void flushDamage();
+
+    /*
+     * Sends bytes to the child without blocking. Whatever the pty doesn't
+     * take right away is queued, in order, and written by the reactor as
+     * the child drains its input. Returns false, sending nothing, if that
+     * would take more queued input than the limit allows.
+     */
+    bool write(const char *bytes, size_t len);
+
+    size_t getQueuedInput();
+    void setInputQueueLimit(size_t bytes);
+
+    bool dispatchCharacter(int mod, int character);
+    bool dispatchKey(int mod, int key);
+    bool flushInput();
+
+    /*
+     * Sends a whole run of text, typed or pasted, in as few writes as
+     * possible. Pasted text is wrapped in bracketed paste markers when the
+     * application has enabled them, and newlines become carriage returns
+     * like the Enter key. Returns false if it was refused because too much
+     * input is already waiting for the child.
+     */
+    bool dispatchText(const uint16_t* text, size_t len, bool paste);
+    bool dispatchUtf8(const char* text, size_t len, bool paste);
+
+    status_t resize(dimen_t rows, dimen_t cols, size_t scrollRows);
+    status_t setColors(int fg, int bg);
+    void setFrameInterval(int millis);
+    void setJumpScroll(int bytesPerFrame);
+
+    /*
+     * Keeps only the newest hotRows lines of scrollback in memory, spilling
+     * older ones to a file under dir. A NULL dir stops spilling and drops
+     * whatever was spilled.
+     */
+    status_t setScrollbackSpill(const char* dir, size_t hotRows);
+
+    /*
+     * Whether the session is on screen. Hidden sessions give up scrollback
+     * memory first when the process-wide ScrollbackBudget runs over.
+     */
+    void setVisible(bool visible);
+    virtual size_t trimScrollback(size_t bytes);
+
+    /*
+     * Records raw pty output and resizes to a file from now on, for
+     * replaying later with SessionPlayer.
+     */
+    status_t startRecording(const char* path);
+    void stopRecording();
+    bool isRecording();
+
+    status_t onPushline(dimen_t cols, const VTermScreenCell* cells);
+    status_t onPopline(dimen_t cols, VTermScreenCell* cells);
+    int onDamage(const VTermRect& rect);
+    int onMoveRect(const VTermRect& dest, const VTermRect& src);
+    int onCursorChange(const VTermPos& oldPos, const VTermPos& newPos, bool visible);
+
+    /*
+     * Latest published screen frame. Never waits on the parser; caller must
+     * hold mReadLock, and the frame stays valid until it's released.
+     */
+    const ScreenFrame* acquireFrameLocked();
+    bool getRowLocked(const ScreenFrame* frame, int row, CellRow* out);
+
+    /*
+     * Lines are also numbered absolutely, so a line keeps its number as it
+     * moves between screen and scrollback: scrollback row k is line
+     * mScrollSeq - k, and screen row r of a frame is frame->scrollSeq + r.
+     * Numbers only go away once lines fall off the end of scrollback. While
+     * history is being rewrapped after a width change, scrollback rows and
+     * their numbers are those of the rewrapped rows.
+     */
+    void getLineRangeLocked(const ScreenFrame* frame, size_t* first, size_t* end);
+    const uint32_t* getLineCharsLocked(const ScreenFrame* frame, size_t line,
+            uint32_t* scratch);
+
+    static void getRun(const CellRow& row, dimen_t col, uint16_t* data, size_t capacity,
+            size_t* dataSize, size_t* colSize);
+
+    dimen_t getRows() const;
+    dimen_t getCols() const;
+    size_t getScrollRows() const;
+    size_t getScrollbackLines();
+    size_t getScrollbackBytesHeld();
+    size_t getScrollbackBytesUsed();
+
+    size_t getStats(uint64_t* out, size_t count);
+
+    /* Counts reader calls for stats; caller must hold mReadLock */
+    inline void noteCellRunLocked() {
+        mStats.cellRunCalls++;
+    }
+
+    inline void noteRowRunsLocked() {
+        mStats.rowRunsCalls++;
+    }
+
+    TerminalListener* getListener() const;
+
+    // Lock protecting mutations of internal libvterm state
+    Mutex mLock;
+    // Lock serializing readers of published frames and their scratch rows
+    Mutex mReadLock;
+
+private:
+    int mMasterFd;
+    pid_t mChildPid;
+    /* Owned copies of what setCommand() was given, or NULL for defaults */
+    char* mCommand;
+    char** mArgv;
+    char** mEnv;
+    VTerm *mVt;
+    VTermScreen *mVts;
+
+    TerminalListener* mListener;
+
+    dimen_t mRows;
+    dimen_t mCols;
+    bool mStarted;
+    bool mCursorVisible;
+    VTermPos mCursorPos;
+
+    nsecs_t mCreated;
+    TerminalStats mStats;
+
+    /*
+     * Damage accumulated from libvterm callbacks and handed to the listener
+     * in a single call by deliverDamageLocked(). mDirtyRows is a bitmap with one
+     * bit per screen row, and rows in [mDirtyStart, mDirtyEnd) may be set.
+     */
+    uint32_t* mDirtyRows;
+    size_t mDirtyWords;
+    dimen_t mDirtyStart;
+    dimen_t mDirtyEnd;
+    bool mCursorDirty;
+
+    /*
+     * Rows the whole screen has scrolled up in total, from libvterm moving
+     * the full screen rect. Rows that only moved aren't marked dirty;
+     * instead the listener is given the new total, which it compares with
+     * what it had at the previous delivery, so each scrolled line costs it
+     * one newly exposed row rather than a screenful.
+     */
+    uint64_t mScrollOffset;
+    uint64_t mDeliveredOffset;
+
+    void markDirtyLocked(int startRow, int endRow);
+    void scrollDirtyLocked(dimen_t rows);
+    void resizeDirtyLocked();
+    void deliverDamageLocked();
+
+    /*
+     * Screen contents are published to readers as immutable frames after
+     * each batch. mRowVersions tracks the content version of each screen
+     * row, bumped on damage and moved along with scrolls, so publishing
+     * only copies rows that changed since the back frame was last filled.
+     */
+    ScreenSnapshot mSnapshot;
+    uint32_t* mRowVersions;
+
+    /*
+     * Content hash of each screen row as of the last damage delivered for
+     * it, or zero if unknown. Rows libvterm damaged without changing what
+     * they show, like full screen apps repainting, are dropped from the
+     * damage before it reaches the listener.
+     */
+    uint64_t* mRowHashes;
+    uint32_t mContentVersion;
+
+    void publishFrameLocked();
+    void flushDamageLocked();
+
+    /*
+     * Output is read and parsed on different threads. The I/O reactor only
+     * drains the nonblocking pty into mReadRing and pokes mParseFd, so the
+     * child keeps writing while the parser is busy or waiting on mLock. The
+     * parse reactor, watching mParseFd through mParseSession, consumes the
+     * ring in slices. Reading pauses only while the ring is full.
+     */
+    class ParseSession : public TerminalReactor::Session {
+    public:
+        ParseSession(Terminal* term) : mTerm(term) {}
+
+        virtual bool onReadable();
+        virtual void onWritable() {}
+        virtual nsecs_t getDeadline();
+        virtual void onDeadline(nsecs_t now);
+
+    private:
+        Terminal* mTerm;
+    };
+
+    ByteRing mReadRing;
+    /* eventfd signalled whenever the reader commits output or stops */
+    int mParseFd;
+    ParseSession mParseSession;
+    /* Set by the reader once the pty hit EOF or failed */
+    volatile int32_t mReaderDone;
+
+    /*
+     * Guards pausing the reader and its stats. Reader and parser each check
+     * the other's progress after a barrier, so whichever side runs last
+     * sees the pause, and the ring can't be left full with reading paused
+     * and the parser idle. Taken before the I/O reactor's lock, and never
+     * while holding mLock.
+     */
+    Mutex mReaderLock;
+    volatile int32_t mReadPaused;
+
+    void abortStart();
+    void signalParser();
+    void pauseReadingIfFull();
+    void resumeReadingIfPaused();
+    bool onParseReadable();
+    bool parseAvailable();
+
+    /*
+     * Damage is flushed to Java at most once every mFrameIntervalMs.
+     * Output arriving after an idle period is flushed immediately, so
+     * interactive echo isn't delayed. Zero flushes after every batch.
+     * mLastFlush is only touched on the parse thread. mFlushPending is
+     * written under mLock, but read without it by getDeadline().
+     */
+    volatile int32_t mFrameIntervalMs;
+    nsecs_t mLastFlush;
+    volatile int32_t mFlushPending;
+
+    /*
+     * Guards mRecorder, so recording does its file I/O without holding
+     * mLock. Taken before mLock, and never while holding it.
+     */
+    Mutex mRecordLock;
+    SessionRecorder mRecorder;
+
+    void recordOutput(const char* bytes, size_t len);
+
+    /*
+     * Whether the application enabled bracketed paste (DECSET 2004), and
+     * where the scan for mode changes left off in the last batch: the
+     * sequence state, the private mode parameter being read, and whether
+     * 2004 was among those already read. Guarded by mLock.
+     */
+    enum ModeState {
+        MODE_GROUND,
+        MODE_ESC,
+        MODE_CSI,
+        MODE_PRIVATE,
+        MODE_SOFT_RESET,
+    };
+
+    bool mBracketedPaste;
+    ModeState mModeState;
+    unsigned mModeParam;
+    bool mModeFound;
+
+    void scanModesLocked(const char* bytes, size_t len);
+    bool sendText(const char* utf8, size_t len, bool paste);
+
+    /*
+     * Input the child hasn't read yet. Nests inside mLock, and is never held
+     * across a blocking call, so neither typing nor the reactor waits on a
+     * child that stopped reading.
+     */
+    Mutex mWriteLock;
+    OutputQueue mWriteQueue;
+
+    /*
+     * Jump scrolling: while output arrives faster than mJumpScrollBytes per
+     * frame, damage callbacks only set mJumpDirty instead of tracking rows,
+     * and each flush repaints the whole screen once. Parsing and scrollback
+     * carry on at full speed. Zero disables it.
+     */
+    volatile int32_t mJumpScrollBytes;
+    bool mJumping;
+    bool mJumpDirty;
+    int mQuietFrames;
+    size_t mBytesSinceFlush;
+
+    void parseLocked(const char* bytes, size_t len);
+    void flushDamageIfDueLocked(nsecs_t now);
+    void updateJumpScrollLocked();
+
+    /* Reader-owned scratch for rows outside the valid region */
+    uint32_t* mReadChars;
+    style_key_t* mReadStyles;
+    dimen_t mReadCols;
+
+    /*
+     * Reader-owned cache of expanded scrollback rows and their run indexes,
+     * direct mapped by line sequence number. Lines never change once pushed,
+     * so entries only go stale when lines are popped back onto the screen;
+     * the parser records that in mScrollInvalidFrom for readers to apply.
+     */
+    enum {
+        SCROLL_CACHE_ROWS = 128,
+    };
+
+    struct ScrollCacheEntry {
+        /* Sequence number of cached line, or SIZE_MAX when empty */
+        size_t seq;
+        /* Row was rewrapped, and seq is its index in mReflowRows instead */
+        bool reflowed;
+        dimen_t cols;
+        dimen_t runCount;
+        uint32_t* chars;
+        style_key_t* styles;
+        dimen_t* runStarts;
+    };
+
+    ScrollCacheEntry mScrollCache[SCROLL_CACHE_ROWS];
+    dimen_t mScrollCacheCols;
+
+    void invalidateScrollCacheLocked(size_t fromSeq);
+
+    /*
+     * Lock protecting scrollback and mStyles. The parser holds it only for
+     * individual pushes and pops, so readers never wait for a whole batch.
+     */
+    Mutex mScrollLock;
+
+    /*
+     * Scrollback is a circular buffer of mScrollAlloc slots. mScrollHead is
+     * the slot the next pushed line will occupy, so the most recent line
+     * lives just behind it. mScrollCur counts valid lines. The buffer grows
+     * on demand until it holds mScrollSize lines, so sessions only pay for
+     * history they actually have.
+     *
+     * When spilling is enabled the buffer is only the hot tier, holding up
+     * to mScrollHotSize lines, and older lines continue in mSpill for a
+     * total of mScrollSize.
+     */
+    ScrollbackLine **mScroll;
+    SlabAllocator mScrollHeap;
+    StyleTable mStyles;
+    size_t mScrollHead;
+    size_t mScrollCur;
+    size_t mScrollAlloc;
+    size_t mScrollSize;
+    /* Lines pushed minus lines popped; the line at scrollRow k is number
+     * mScrollSeq - k */
+    size_t mScrollSeq;
+    /* Lowest sequence number popped since readers last looked */
+    size_t mScrollInvalidFrom;
+
+    ScrollbackSpill mSpill;
+    size_t mScrollHotSize;
+
+    /*
+     * Lazy reflow of scrollback after a width change. Lines keep the width
+     * they were pushed at, and readers see them rewrapped to mReflowCols
+     * through a memo of rows built from the newest end, only as deep as
+     * anyone has looked. Lines numbered mReflowEnd and up were pushed at
+     * the new width and map one to one; below them rows come from the memo,
+     * newest first from mReflowBase. mReflowNext is one past the newest
+     * line not walked yet. Popping a rewrapped row back onto the screen
+     * rewrites just its own logical line. mReflowReported is the memo's
+     * capacity when the budget last heard about it. Guarded by mScrollLock.
+     */
+    enum {
+        /* Memo rows kept past mReflowBase when the budget asks for memory */
+        REFLOW_KEEP_ROWS = 4096,
+    };
+
+    struct ReflowRow {
+        /* First stored line of the logical line holding this row */
+        size_t seq;
+        /* Offset of the row's first cell into the logical line */
+        size_t offset;
+    };
+
+    bool mReflowing;
+    dimen_t mReflowCols;
+    size_t mReflowEnd;
+    size_t mReflowNext;
+    Vector<ReflowRow> mReflowRows;
+    size_t mReflowBase;
+    size_t mReflowReported;
+    uint32_t* mReflowChars;
+    size_t mReflowCharsAlloc;
+
+    /* Parser-owned scratch for rewriting a logical line as it's popped */
+    VTermScreenCell* mReflowCells;
+    size_t mReflowCellsAlloc;
+
+    /* Reader-owned scratch for expanding part of a logical line */
+    uint32_t* mReadLineChars;
+    style_key_t* mReadLineStyles;
+    dimen_t* mReadLineRuns;
+    size_t mReadLineAlloc;
+
+    void resetReflowLocked(dimen_t cols);
+    void stopReflowLocked();
+    void extendReflowLocked(size_t rows);
+    void pruneReflowLocked();
+    void shedReflowLocked();
+    bool findScrollRowLocked(size_t scrollRow, size_t* storedRow, size_t* reflowIndex);
+    dimen_t expandReflowRowLocked(size_t index, dimen_t cols, uint32_t* chars,
+            style_key_t* keys, dimen_t* runStarts);
+    size_t scrollDisplayCountLocked();
+    bool popReflowedLocked(dimen_t cols, VTermScreenCell* cells);
+    bool pushLineLocked(ScrollbackLine* line);
+    bool popLineLocked(dimen_t cols, VTermScreenCell* cells);
+
+    inline size_t scrollCountLocked() const {
+        return mScrollCur + mSpill.size();
+    }
+
+    ScrollbackLine*& scrollLine(size_t scrollRow);
+    const ScrollbackLine* getScrollLineLocked(size_t scrollRow);
+    size_t hotLimitLocked() const;
+    void spillOldestLocked();
+    void reallocScroll(size_t alloc);
+    void setScrollSize(size_t size);
+    void compactScrollLocked();
+
+    /*
+     * Memory counted against the ScrollbackBudget: in-memory lines and their
+     * slots, the reflow memo, and the expanded row cache, counted as if every
+     * entry were filled. Spilled lines are free.
+     */
+    inline size_t budgetBytesLocked() const {
+        return mScrollHeap.bytesHeld() + mScrollAlloc * sizeof(ScrollbackLine*)
+                + mReflowRows.capacity() * sizeof(ReflowRow)
+                + SCROLL_CACHE_ROWS * mScrollCacheCols
+                        * (sizeof(uint32_t) + sizeof(style_key_t) + sizeof(dimen_t));
+    }
+    void updateBudget();
+
+};
+
+} /* namespace android */
+
+#endif /* TERMINAL_H */
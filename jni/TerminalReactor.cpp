@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Terminal"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "TerminalReactor.h"
+
+#define DEBUG_REACTOR 0
+
+namespace android {
+
+static const int MAX_EVENTS = 16;
+
+TerminalReactor& TerminalReactor::getInstance() {
+    // Lives for the rest of the process once created
+    static TerminalReactor* instance = new TerminalReactor();
+    return *instance;
+}
+
+TerminalReactor& TerminalReactor::getParseInstance() {
+    static TerminalReactor* instance = new TerminalReactor();
+    return *instance;
+}
+
+TerminalReactor::TerminalReactor() :
+        mThreadStarted(false), mDispatching(NULL) {
+    mEpollFd = epoll_create(MAX_EVENTS);
+    if (mEpollFd == -1) {
+        ALOGE("epoll_create() failed: %s", strerror(errno));
+    }
+
+    mWakeFd = eventfd(0, EFD_NONBLOCK);
+    if (mWakeFd == -1) {
+        ALOGE("eventfd() failed: %s", strerror(errno));
+        return;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event) == -1) {
+        ALOGE("failed to watch wake fd: %s", strerror(errno));
+    }
+}
+
+TerminalReactor::~TerminalReactor() {
+    close(mWakeFd);
+    close(mEpollFd);
+}
+
+status_t TerminalReactor::add(int fd, Session* session) {
+    Mutex::Autolock lock(mLock);
+
+    if (mEpollFd == -1 || mWakeFd == -1) {
+        return INVALID_OPERATION;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        ALOGE("failed to watch fd %d: %s", fd, strerror(errno));
+        return -errno;
+    }
+
+    Entry entry;
+    entry.fd = fd;
+    entry.session = session;
+    entry.readInterest = true;
+    entry.writeInterest = false;
+    entry.hungUp = false;
+    mEntries.add(entry);
+
+    if (!mThreadStarted) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&thread, &attr, threadEntry, this);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            ALOGE("failed to start reactor thread: %s", strerror(err));
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
+            mEntries.removeAt(mEntries.size() - 1);
+            return -err;
+        }
+        mThreadStarted = true;
+    }
+
+    return OK;
+}
+
+void TerminalReactor::remove(Session* session) {
+    Mutex::Autolock lock(mLock);
+
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries[i].session == session) {
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mEntries[i].fd, NULL);
+            mEntries.removeAt(i);
+            break;
+        }
+    }
+
+    // Deadlines may have changed; don't sleep on one that no longer exists
+    wake();
+
+    // Wait out a callback in flight, unless we're being called from it
+    while (mDispatching == session && !pthread_equal(mDispatchThread, pthread_self())) {
+        mDispatchDone.wait(mLock);
+    }
+}
+
+status_t TerminalReactor::setWriteInterest(Session* session, bool enabled) {
+    Mutex::Autolock lock(mLock);
+    return setInterest(session, &Entry::writeInterest, enabled);
+}
+
+status_t TerminalReactor::setReadInterest(Session* session, bool enabled) {
+    Mutex::Autolock lock(mLock);
+    return setInterest(session, &Entry::readInterest, enabled);
+}
+
+/*
+ * Updates one of the interest flags of a session's entry, along with the
+ * events epoll watches its descriptor for. A descriptor with no interest
+ * left is taken out of the set entirely, since epoll reports hangups
+ * regardless and a paused reader would otherwise spin on them. So is one
+ * that hung up while reading was paused, until reading resumes.
+ */
+status_t TerminalReactor::setInterest(Session* session, bool Entry::* field, bool enabled) {
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry& entry = mEntries.editItemAt(i);
+        if (entry.session != session) {
+            continue;
+        }
+        if (entry.*field == enabled) {
+            return OK;
+        }
+
+        bool watched = (entry.readInterest || entry.writeInterest) && !entry.hungUp;
+        entry.*field = enabled;
+        if (entry.hungUp && !entry.readInterest) {
+            return OK;
+        }
+        entry.hungUp = false;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        if (entry.readInterest) {
+            event.events |= EPOLLIN;
+        }
+        if (entry.writeInterest) {
+            event.events |= EPOLLOUT;
+        }
+        event.data.ptr = session;
+        int op = event.events == 0 ? EPOLL_CTL_DEL : (watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+        if (epoll_ctl(mEpollFd, op, entry.fd, &event) == -1) {
+            ALOGE("failed to update fd %d: %s", entry.fd, strerror(errno));
+            entry.*field = !enabled;
+            return -errno;
+        }
+        return OK;
+    }
+    return NAME_NOT_FOUND;
+}
+
+/*
+ * Hangups are reported whatever events were asked for. Returns whether the
+ * session should read to find out about one. If its reading is paused,
+ * the descriptor is dropped from the set instead until reading resumes,
+ * since write interest alone would have epoll_wait() return at once, over
+ * and over, for as long as the pause lasts.
+ */
+bool TerminalReactor::shouldReadHangup(Session* session) {
+    Mutex::Autolock lock(mLock);
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry& entry = mEntries.editItemAt(i);
+        if (entry.session != session) {
+            continue;
+        }
+        if (entry.readInterest) {
+            return true;
+        }
+        if (!entry.hungUp) {
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, entry.fd, NULL);
+            entry.hungUp = true;
+        }
+        return false;
+    }
+    return false;
+}
+
+void TerminalReactor::wake() {
+    uint64_t one = 1;
+    if (::write(mWakeFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        ALOGW("failed to wake reactor: %s", strerror(errno));
+    }
+}
+
+void* TerminalReactor::threadEntry(void* arg) {
+    reinterpret_cast<TerminalReactor*>(arg)->loop();
+    return NULL;
+}
+
+bool TerminalReactor::isRegisteredLocked(Session* session) const {
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries[i].session == session) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Milliseconds until the earliest session deadline, or -1 to wait forever.
+ * Sessions must answer getDeadline() without taking locks of their own.
+ */
+int TerminalReactor::computeTimeoutLocked(nsecs_t now) {
+    nsecs_t earliest = -1;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        nsecs_t deadline = mEntries[i].session->getDeadline();
+        if (deadline >= 0 && (earliest < 0 || deadline < earliest)) {
+            earliest = deadline;
+        }
+    }
+    return earliest < 0 ? -1 : toMillisecondTimeoutDelay(now, earliest);
+}
+
+/*
+ * Runs one callback for a session with the reactor lock released, skipping
+ * sessions removed since their event was collected.
+ */
+void TerminalReactor::dispatch(Session* session, DispatchKind kind, nsecs_t now) {
+    Mutex::Autolock lock(mLock);
+    if (!isRegisteredLocked(session)) {
+        return;
+    }
+
+    mDispatching = session;
+    mDispatchThread = pthread_self();
+    mLock.unlock();
+
+    bool keep = true;
+    switch (kind) {
+    case DISPATCH_READABLE:
+        keep = session->onReadable();
+        break;
+    case DISPATCH_WRITABLE:
+        session->onWritable();
+        break;
+    case DISPATCH_DEADLINE:
+        session->onDeadline(now);
+        break;
+    }
+
+    mLock.lock();
+    mDispatching = NULL;
+    if (!keep) {
+        for (size_t i = 0; i < mEntries.size(); i++) {
+            if (mEntries[i].session == session) {
+                epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mEntries[i].fd, NULL);
+                mEntries.removeAt(i);
+                break;
+            }
+        }
+    }
+    mDispatchDone.broadcast();
+}
+
+void TerminalReactor::loop() {
+    ALOGD("entering reactor loop");
+    struct epoll_event events[MAX_EVENTS];
+    Vector<Session*> due;
+    while (1) {
+        int timeout;
+        {
+            Mutex::Autolock lock(mLock);
+            timeout = computeTimeoutLocked(systemTime());
+        }
+
+        int count = epoll_wait(mEpollFd, events, MAX_EVENTS, timeout);
+        if (count == -1) {
+            if (errno != EINTR) {
+                ALOGE("epoll_wait() failed: %s", strerror(errno));
+            }
+            continue;
+        }
+#if DEBUG_REACTOR
+        ALOGD("epoll_wait() returned %d events", count);
+#endif
+
+        nsecs_t now = systemTime();
+        for (int i = 0; i < count; i++) {
+            Session* session = reinterpret_cast<Session*>(events[i].data.ptr);
+            if (session == NULL) {
+                uint64_t value;
+                while (::read(mWakeFd, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+
+            const uint32_t revents = events[i].events;
+            if ((revents & (EPOLLHUP | EPOLLERR)) && !(revents & EPOLLIN)
+                    && !shouldReadHangup(session)) {
+                continue;
+            }
+
+            // Drain queued input first, so a child blocked writing to us
+            // while waiting on its stdin gets both ends moving
+            if (revents & EPOLLOUT) {
+                dispatch(session, DISPATCH_WRITABLE, now);
+            }
+            if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                dispatch(session, DISPATCH_READABLE, now);
+            }
+        }
+
+        // Callbacks run unlocked, so collect due sessions first and let
+        // dispatch() skip any removed in the meantime
+        now = systemTime();
+        due.clear();
+        {
+            Mutex::Autolock lock(mLock);
+            for (size_t i = 0; i < mEntries.size(); i++) {
+                nsecs_t deadline = mEntries[i].session->getDeadline();
+                if (deadline >= 0 && deadline <= now) {
+                    due.add(mEntries[i].session);
+                }
+            }
+        }
+        for (size_t i = 0; i < due.size(); i++) {
+            dispatch(due[i], DISPATCH_DEADLINE, now);
+        }
+    }
+}
+
+} /* namespace android */
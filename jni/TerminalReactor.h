@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TERMINAL_REACTOR_H
+#define TERMINAL_REACTOR_H
+
+#include <pthread.h>
+
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * Epoll thread multiplexing descriptors of every session in the process, so
+ * the number of threads doesn't grow with the number of tabs. There's one
+ * for pty I/O and one for parsing what it reads.
+ * The thread is started on first use; sessions that call into the VM from
+ * their callbacks are responsible for attaching it.
+ */
+class TerminalReactor {
+public:
+    /*
+     * Session callbacks, always invoked on the reactor thread.
+     */
+    class Session {
+    public:
+        virtual ~Session() {}
+
+        /* Descriptor is readable or hung up. Return false to stop watching it. */
+        virtual bool onReadable() = 0;
+
+        /* Descriptor accepts writes again, while setWriteInterest() is on */
+        virtual void onWritable() = 0;
+
+        /* Absolute time onDeadline() is wanted at, or -1 for none */
+        virtual nsecs_t getDeadline() = 0;
+        virtual void onDeadline(nsecs_t now) = 0;
+    };
+
+    /* Reactor servicing pty masters */
+    static TerminalReactor& getInstance();
+
+    /*
+     * Second reactor for work that shouldn't hold up I/O, like parsing
+     * output the first one read. Sessions there usually watch an eventfd.
+     */
+    static TerminalReactor& getParseInstance();
+
+    status_t add(int fd, Session* session);
+
+    /*
+     * Stops watching the session. Once this returns no callback for it is
+     * running or will run, so the session can be destroyed, even if it is
+     * still waiting on output that never comes.
+     */
+    void remove(Session* session);
+
+    /*
+     * Whether onWritable() is wanted for the session. Turned on while output
+     * is queued and off once it drains, so idle sessions don't spin on a
+     * descriptor that is always writable.
+     */
+    status_t setWriteInterest(Session* session, bool enabled);
+
+    /*
+     * Whether onReadable() is wanted for the session, on by default. Lets a
+     * session that has nowhere to put more input stop the descriptor from
+     * waking the reactor until it does.
+     */
+    status_t setReadInterest(Session* session, bool enabled);
+
+    /* Makes the reactor recompute deadlines, e.g. after one moved earlier */
+    void wake();
+
+private:
+    TerminalReactor();
+    ~TerminalReactor();
+
+    struct Entry {
+        int fd;
+        Session* session;
+        bool readInterest;
+        bool writeInterest;
+        /* Hung up while reading was paused, so left out of the set */
+        bool hungUp;
+    };
+
+    enum DispatchKind {
+        DISPATCH_READABLE,
+        DISPATCH_WRITABLE,
+        DISPATCH_DEADLINE,
+    };
+
+    static void* threadEntry(void* arg);
+    void loop();
+    int computeTimeoutLocked(nsecs_t now);
+    bool isRegisteredLocked(Session* session) const;
+    status_t setInterest(Session* session, bool Entry::* field, bool enabled);
+    bool shouldReadHangup(Session* session);
+    void dispatch(Session* session, DispatchKind kind, nsecs_t now);
+
+    Mutex mLock;
+    Condition mDispatchDone;
+
+    int mEpollFd;
+    /* eventfd used to interrupt epoll_wait() */
+    int mWakeFd;
+    bool mThreadStarted;
+
+    Vector<Entry> mEntries;
+    /* Session whose callback is running on the reactor thread, if any */
+    Session* mDispatching;
+    pthread_t mDispatchThread;
+};
+
+} /* namespace android */
+
+#endif /* TERMINAL_REACTOR_H */
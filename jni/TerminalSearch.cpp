@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "RunScan.h"
+#include "Terminal.h"
+#include "TerminalSearch.h"
+
+namespace android {
+
+/* Lines looked at by one nextLocked() call before returning to the caller */
+static const size_t LINES_PER_CALL = 2048;
+
+/*
+ * Scripts whose capitals are a fixed offset from their small letters, which
+ * covers what people type into a terminal search box.
+ */
+struct CaseRange {
+    uint32_t first;
+    uint32_t last;
+    uint32_t delta;
+    uint32_t skip;
+};
+
+static const CaseRange CASE_RANGES[] = {
+    { 'A', 'Z', 0x20, 0 },
+    /* Latin-1, except the multiplication sign */
+    { 0xc0, 0xde, 0x20, 0xd7 },
+    /* Greek, except the unassigned slot matching final sigma, folded below */
+    { 0x391, 0x3a9, 0x20, 0x3a2 },
+    /* Cyrillic */
+    { 0x400, 0x40f, 0x50, 0 },
+    { 0x410, 0x42f, 0x20, 0 },
+};
+
+static const size_t CASE_RANGE_COUNT = sizeof(CASE_RANGES) / sizeof(CASE_RANGES[0]);
+
+/* Word-final form of small sigma, which folds to the usual one */
+static const uint32_t FINAL_SIGMA = 0x3c2;
+static const uint32_t SMALL_SIGMA = 0x3c3;
+
+static uint32_t toLower(uint32_t c) {
+    if (c == FINAL_SIGMA) {
+        return SMALL_SIGMA;
+    }
+    for (size_t i = 0; i < CASE_RANGE_COUNT; i++) {
+        const CaseRange& r = CASE_RANGES[i];
+        if (c >= r.first && c <= r.last && c != r.skip) {
+            return c + r.delta;
+        }
+    }
+    return c;
+}
+
+static uint32_t toUpper(uint32_t c) {
+    for (size_t i = 0; i < CASE_RANGE_COUNT; i++) {
+        const CaseRange& r = CASE_RANGES[i];
+        if (c >= r.first + r.delta && c <= r.last + r.delta && c != r.skip + r.delta) {
+            return c - r.delta;
+        }
+    }
+    return c;
+}
+
+/* Erased cells read as spaces */
+static inline uint32_t cellChar(uint32_t c) {
+    return c == 0 ? ' ' : c;
+}
+
+TerminalSearch::TerminalSearch(const uint32_t* pattern, size_t len, int flags) :
+        mLen(len), mFlags(flags), mFirst(0), mFirstAlt(0), mFirstFinal(0), mStarted(false), mDone(len == 0),
+        mLine(0), mCol(0), mScratch(NULL), mScratchCols(0) {
+    mPattern = (uint32_t*) malloc(len * sizeof(uint32_t));
+    for (size_t i = 0; i < len; i++) {
+        mPattern[i] = (flags & FLAG_IGNORE_CASE) ? toLower(pattern[i]) : pattern[i];
+    }
+
+    if (len > 0) {
+        mFirst = mPattern[0];
+        if (mFirst == ' ') {
+            mFirstAlt = 0;
+        } else if (flags & FLAG_IGNORE_CASE) {
+            mFirstAlt = toUpper(mFirst);
+            if (mFirst == SMALL_SIGMA) {
+                mFirstFinal = FINAL_SIGMA;
+            }
+        } else {
+            mFirstAlt = mFirst;
+        }
+    }
+}
+
+TerminalSearch::~TerminalSearch() {
+    free(mPattern);
+    free(mScratch);
+}
+
+/*
+ * Checks for the pattern at col, stepping over the continuation cells of
+ * wide characters. On a match, sets end to the cell just past it.
+ */
+bool TerminalSearch::matchAt(const uint32_t* chars, dimen_t cols, dimen_t col,
+        dimen_t* end) const {
+    const bool ignoreCase = mFlags & FLAG_IGNORE_CASE;
+    size_t i = col;
+    for (size_t p = 0; p < mLen; p++) {
+        while (i < cols && chars[i] == CHAR_CONTINUATION) {
+            i++;
+        }
+        if (i == cols) {
+            return false;
+        }
+        uint32_t c = cellChar(chars[i]);
+        if ((ignoreCase ? toLower(c) : c) != mPattern[p]) {
+            return false;
+        }
+        i++;
+    }
+    while (i < cols && chars[i] == CHAR_CONTINUATION) {
+        i++;
+    }
+    *end = i;
+    return true;
+}
+
+size_t TerminalSearch::nextLocked(Terminal* term, SearchMatch* out, size_t capacity) {
+    if (mDone || capacity == 0) {
+        return 0;
+    }
+
+    const ScreenFrame* frame = term->acquireFrameLocked();
+    size_t first, end;
+    term->getLineRangeLocked(frame, &first, &end);
+    if (!mStarted) {
+        mStarted = true;
+        mLine = end;
+        mCol = 0;
+        if (mLine == first) {
+            mDone = true;
+            return 0;
+        }
+        mLine--;
+    }
+
+    if (mScratchCols < frame->cols) {
+        free(mScratch);
+        mScratch = (uint32_t*) malloc(frame->cols * sizeof(uint32_t));
+        mScratchCols = frame->cols;
+    }
+
+    size_t count = 0;
+    for (size_t scanned = 0; scanned < LINES_PER_CALL; scanned++) {
+        // History we haven't reached yet may have fallen off the end
+        if (mLine < first) {
+            mDone = true;
+            break;
+        }
+
+        const uint32_t* chars = term->getLineCharsLocked(frame, mLine, mScratch);
+        const dimen_t cols = frame->cols;
+        while (chars != NULL && mCol < cols) {
+            size_t col = findEitherChar(chars, mCol, cols, mFirst, mFirstAlt);
+            if (mFirstFinal != 0) {
+                col = findEitherChar(chars, mCol, col, mFirstFinal, mFirstFinal);
+            }
+            if (col == cols) {
+                mCol = cols;
+                break;
+            }
+
+            dimen_t matchEnd;
+            if (!matchAt(chars, cols, col, &matchEnd)) {
+                mCol = col + 1;
+                continue;
+            }
+
+            out[count].line = mLine;
+            out[count].col = col;
+            out[count].cols = matchEnd - col;
+            mCol = matchEnd;
+            if (++count == capacity) {
+                return count;
+            }
+        }
+
+        mCol = 0;
+        if (mLine == first) {
+            mDone = true;
+            break;
+        }
+        mLine--;
+    }
+    return count;
+}
+
+} /* namespace android */
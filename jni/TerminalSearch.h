@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TERMINAL_SEARCH_H
+#define TERMINAL_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CellStyle.h"
+
+namespace android {
+
+class Terminal;
+
+/*
+ * Occurrence of a search pattern, spanning cols cells of an absolute line.
+ */
+struct SearchMatch {
+    size_t line;
+    dimen_t col;
+    dimen_t cols;
+};
+
+/*
+ * Literal search over a session's scrollback and screen, walking from the
+ * newest line towards the oldest and handing back matches in chunks, so
+ * the UI can show the first hits while the rest of history is scanned.
+ *
+ * Progress is kept as an absolute line number, which doesn't change as
+ * output pushes lines into scrollback, so a search can be resumed across
+ * any amount of output without repeating or skipping lines. Lines that
+ * arrive after the search started are newer than where it began, and are
+ * left for the next search.
+ */
+class TerminalSearch {
+public:
+    enum {
+        /* Compare with simple case folding */
+        FLAG_IGNORE_CASE = 1 << 0,
+    };
+
+    TerminalSearch(const uint32_t* pattern, size_t len, int flags);
+    ~TerminalSearch();
+
+    /*
+     * Scans forward from where the last call stopped, writing up to capacity
+     * matches into out and returning how many were written. Each call looks
+     * at a bounded number of lines, so it may return zero before the search
+     * is done. Caller must hold term->mReadLock.
+     */
+    size_t nextLocked(Terminal* term, SearchMatch* out, size_t capacity);
+
+    inline bool isDone() const {
+        return mDone;
+    }
+
+private:
+    bool matchAt(const uint32_t* chars, dimen_t cols, dimen_t col, dimen_t* end) const;
+
+    uint32_t* mPattern;
+    size_t mLen;
+    int mFlags;
+    /* Cell values a match can start with */
+    uint32_t mFirst;
+    uint32_t mFirstAlt;
+    /* Final sigma, when the pattern starts with a sigma and ignores case */
+    uint32_t mFirstFinal;
+
+    bool mStarted;
+    bool mDone;
+    /* Line being scanned, and where in it to carry on */
+    size_t mLine;
+    dimen_t mCol;
+
+    uint32_t* mScratch;
+    dimen_t mScratchCols;
+};
+
+} /* namespace android */
+
+#endif /* TERMINAL_SEARCH_H */
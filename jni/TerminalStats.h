@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TERMINAL_STATS_H
+#define TERMINAL_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+/*
+ * Order in which Terminal::getStats() reports values. Mirrored by
+ * Terminal.Stats in Java, so only ever append.
+ */
+enum {
+    STAT_UPTIME_NS,
+    STAT_BYTES_READ,
+    STAT_READ_CALLS,
+    STAT_READ_BATCHES,
+    /* Read batches by size: <64, <256, <1K, <4K, <16K, <64K, <256K, larger */
+    STAT_BATCH_HISTOGRAM,
+    STAT_BYTES_PARSED = STAT_BATCH_HISTOGRAM + 8,
+    STAT_PARSE_NS,
+    STAT_DAMAGE_CALLBACKS,
+    STAT_MOVERECT_CALLBACKS,
+    STAT_CURSOR_CALLBACKS,
+    STAT_DAMAGE_DELIVERIES,
+    STAT_CELL_RUN_CALLS,
+    STAT_ROW_RUNS_CALLS,
+    STAT_LOCK_ACQUISITIONS,
+    STAT_LOCK_WAIT_NS,
+    STAT_LOCK_MAX_WAIT_NS,
+    STAT_LOCK_HOLD_NS,
+    STAT_LOCK_MAX_HOLD_NS,
+    STAT_SCROLLBACK_LINES,
+    STAT_SCROLLBACK_BYTES_USED,
+    STAT_SCROLLBACK_BYTES_HELD,
+    STAT_SCROLL_CACHE_HITS,
+    STAT_SCROLL_CACHE_MISSES,
+    STAT_SPILL_LINES,
+    STAT_SPILL_FILE_BYTES,
+    STAT_JUMP_SCROLLS,
+    STAT_JUMP_FRAMES,
+    STAT_BYTES_WRITTEN,
+    STAT_QUEUED_INPUT,
+    STAT_MAX_QUEUED_INPUT,
+    STAT_WRITES_REFUSED,
+    STAT_REFLOW_ROWS,
+    STAT_READ_PAUSES,
+    STAT_BUDGET_TRIMS,
+    STAT_UNCHANGED_ROWS,
+    STAT_SHIFTED_ROWS,
+    STAT_COUNT
+};
+
+static const size_t STATS_BATCH_BUCKETS = 8;
+
+/*
+ * Contention on a lock, updated only while it's held.
+ */
+struct LockStats {
+    uint64_t acquisitions;
+    uint64_t waitNs;
+    uint64_t maxWaitNs;
+    uint64_t holdNs;
+    uint64_t maxHoldNs;
+
+    LockStats() : acquisitions(0), waitNs(0), maxWaitNs(0), holdNs(0), maxHoldNs(0) {
+    }
+};
+
+/*
+ * Scoped lock that also measures how long it waited for and held the lock.
+ * Uncontended acquisitions cost one clock read on each side.
+ */
+class StatsAutolock {
+public:
+    inline StatsAutolock(Mutex& lock, LockStats& stats) : mLock(lock), mStats(stats) {
+        if (mLock.tryLock() == 0) {
+            mAcquired = systemTime();
+        } else {
+            nsecs_t start = systemTime();
+            mLock.lock();
+            mAcquired = systemTime();
+
+            uint64_t wait = mAcquired - start;
+            mStats.waitNs += wait;
+            if (wait > mStats.maxWaitNs) {
+                mStats.maxWaitNs = wait;
+            }
+        }
+        mStats.acquisitions++;
+    }
+
+    inline ~StatsAutolock() {
+        uint64_t hold = systemTime() - mAcquired;
+        mStats.holdNs += hold;
+        if (hold > mStats.maxHoldNs) {
+            mStats.maxHoldNs = hold;
+        }
+        mLock.unlock();
+    }
+
+private:
+    Mutex& mLock;
+    LockStats& mStats;
+    nsecs_t mAcquired;
+};
+
+/*
+ * Always-on counters for one session's output path. Fields are grouped by
+ * the lock that guards them.
+ */
+struct TerminalStats {
+    /* Guarded by Terminal::mReaderLock */
+    uint64_t bytesRead;
+    uint64_t readCalls;
+    uint64_t readBatches;
+    uint64_t batchHistogram[STATS_BATCH_BUCKETS];
+    uint64_t readPauses;
+
+    /* Guarded by Terminal::mLock */
+    uint64_t bytesParsed;
+    uint64_t parseNs;
+    uint64_t damageCallbacks;
+    uint64_t moveRectCallbacks;
+    uint64_t cursorCallbacks;
+    uint64_t damageDeliveries;
+    uint64_t jumpScrolls;
+    uint64_t jumpFrames;
+    uint64_t unchangedRows;
+    uint64_t shiftedRows;
+    LockStats lock;
+
+    /* Guarded by Terminal::mReadLock */
+    uint64_t cellRunCalls;
+    uint64_t rowRunsCalls;
+    uint64_t scrollCacheHits;
+    uint64_t scrollCacheMisses;
+
+    /* Guarded by Terminal::mScrollLock */
+    uint64_t budgetTrims;
+
+    /* Guarded by Terminal::mWriteLock */
+    uint64_t bytesWritten;
+    uint64_t maxQueuedInput;
+    uint64_t writesRefused;
+
+    TerminalStats() :
+            bytesRead(0), readCalls(0), readBatches(0), readPauses(0), bytesParsed(0), parseNs(0),
+            damageCallbacks(0), moveRectCallbacks(0), cursorCallbacks(0), damageDeliveries(0),
+            jumpScrolls(0), jumpFrames(0), unchangedRows(0), shiftedRows(0), cellRunCalls(0),
+            rowRunsCalls(0), scrollCacheHits(0), scrollCacheMisses(0), budgetTrims(0),
+            bytesWritten(0), maxQueuedInput(0), writesRefused(0) {
+        for (size_t i = 0; i < STATS_BATCH_BUCKETS; i++) {
+            batchHistogram[i] = 0;
+        }
+    }
+
+    inline void recordBatch(size_t bytes, size_t calls) {
+        bytesRead += bytes;
+        readCalls += calls;
+        readBatches++;
+
+        size_t bucket = 0;
+        for (size_t limit = 64; bytes >= limit && bucket < STATS_BATCH_BUCKETS - 1;
+                limit <<= 2) {
+            bucket++;
+        }
+        batchHistogram[bucket]++;
+    }
+};
+
+} /* namespace android */
+
+#endif /* TERMINAL_STATS_H */
@@ -0,0 +1,29 @@
+LOCAL_PATH:= $(call my-dir)
+
+# Throughput benchmarks for the terminal engine, run on the host:
+#   out/host/<os>-x86/bin/terminal_bench [-m megabytes] [workload...]
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    TerminalBench.cpp \
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/.. \
+    external/libvterm/include
+
+LOCAL_STATIC_LIBRARIES := \
+    libterminal_core \
+    libvterm \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_LDLIBS := -lpthread -lrt -lutil
+
+LOCAL_CFLAGS := \
+    -Wno-unused-parameter \
+
+LOCAL_MODULE := terminal_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
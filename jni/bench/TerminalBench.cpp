@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays canned output through the terminal engine and reports parse
+ * throughput and the cost of extracting cell runs for a frame, the way
+ * the UI does when drawing. Output can be generated synthetically or come
+ * from a session recorded on a device.
+ */
+
+#include <utils/Timers.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SessionRecording.h"
+#include "Terminal.h"
+
+using namespace android;
+
+static const size_t DEFAULT_MEGABYTES = 16;
+/* Matches the largest batch the reactor parses in one go */
+static const size_t CHUNK_SIZE = 256 * 1024;
+static const size_t SCROLLBACK_ROWS = 10000;
+static const int EXTRACT_FRAMES = 200;
+static const size_t MAX_RUN_CHARS = 128;
+/* Damage is flushed this often in recorded time, like the reactor does */
+static const nsecs_t FRAME_INTERVAL = 16000000;
+
+/*
+ * Growable byte buffer that workloads are generated into.
+ */
+struct Buffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+
+    Buffer() : data(NULL), size(0), capacity(0) {
+    }
+
+    ~Buffer() {
+        free(data);
+    }
+
+    void append(const char* bytes, size_t len) {
+        if (size + len > capacity) {
+            capacity = (size + len) * 2;
+            data = (char*) realloc(data, capacity);
+        }
+        memcpy(data + size, bytes, len);
+        size += len;
+    }
+
+    void appendf(const char* fmt, ...) {
+        char tmp[256];
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
+        va_end(args);
+        append(tmp, len < (int) sizeof(tmp) ? len : sizeof(tmp) - 1);
+    }
+
+    void appendUtf8(uint32_t c) {
+        char tmp[4];
+        size_t len;
+        if (c < 0x80) {
+            tmp[0] = c;
+            len = 1;
+        } else if (c < 0x800) {
+            tmp[0] = 0xc0 | (c >> 6);
+            tmp[1] = 0x80 | (c & 0x3f);
+            len = 2;
+        } else if (c < 0x10000) {
+            tmp[0] = 0xe0 | (c >> 12);
+            tmp[1] = 0x80 | ((c >> 6) & 0x3f);
+            tmp[2] = 0x80 | (c & 0x3f);
+            len = 3;
+        } else {
+            tmp[0] = 0xf0 | (c >> 18);
+            tmp[1] = 0x80 | ((c >> 12) & 0x3f);
+            tmp[2] = 0x80 | ((c >> 6) & 0x3f);
+            tmp[3] = 0x80 | (c & 0x3f);
+            len = 4;
+        }
+        append(tmp, len);
+    }
+};
+
+/*
+ * Workload generators fill the buffer with at least target bytes and return
+ * the number of screen lines they produce.
+ */
+typedef size_t (*generate_t)(Buffer* out, size_t target, dimen_t rows, dimen_t cols);
+
+/* Plain printable ASCII, one full line at a time, like cat of a log */
+static size_t generateAscii(Buffer* out, size_t target, dimen_t rows, dimen_t cols) {
+    size_t lines = 0;
+    while (out->size < target) {
+        int prefix = snprintf(NULL, 0, "%zu: ", lines);
+        out->appendf("%zu: ", lines);
+        for (int col = prefix; col < cols - 1; col++) {
+            char c = ' ' + (lines + col) % 95;
+            out->append(&c, 1);
+        }
+        out->append("\r\n", 2);
+        lines++;
+    }
+    return lines;
+}
+
+/* Short SGR-colored lines, the same shape as the USE_TEST_SHELL script */
+static size_t generateSgr(Buffer* out, size_t target, dimen_t rows, dimen_t cols) {
+    size_t lines = 0;
+    int c = 0;
+    while (out->size < target) {
+        out->appendf("stop \033[00;3%dmechoing\033[00m yourself! (%zu)\r\n", c, lines + 1);
+        c = (c + 1) % 7;
+        lines++;
+    }
+    return lines;
+}
+
+/* Double-width CJK mixed with astral plane emoji and some ASCII */
+static size_t generateWide(Buffer* out, size_t target, dimen_t rows, dimen_t cols) {
+    size_t lines = 0;
+    while (out->size < target) {
+        int col = 0;
+        int i = 0;
+        while (col + 2 < cols) {
+            switch (i % 4) {
+            case 0:
+            case 1:
+                out->appendUtf8(0x4e00 + (lines * 7 + i) % 0x5000);
+                col += 2;
+                break;
+            case 2:
+                out->appendUtf8(0x1f300 + (lines + i) % 0x200);
+                col += 2;
+                break;
+            default:
+                out->appendUtf8('a' + (lines + i) % 26);
+                col += 1;
+                break;
+            }
+            i++;
+        }
+        out->append("\r\n", 2);
+        lines++;
+    }
+    return lines;
+}
+
+/*
+ * Full-screen application redrawing every row with cursor addressing and
+ * colors on the alternate screen, like top or a text editor scrolling.
+ */
+static size_t generateTui(Buffer* out, size_t target, dimen_t rows, dimen_t cols) {
+    size_t lines = 0;
+    out->appendf("\033[?1049h");
+    for (size_t frame = 0; out->size < target; frame++) {
+        if (frame % 16 == 0) {
+            out->appendf("\033[2J");
+        }
+        for (int row = 0; row < rows - 1; row++) {
+            out->appendf("\033[%d;1H\033[3%d;4%dm%5zu ", row + 1, (int) (row + frame) % 8,
+                    (int) (frame % 8), frame + row);
+            for (int col = 6; col < cols - 1; col++) {
+                char c = 'A' + (frame + row * 3 + col) % 26;
+                out->append(&c, 1);
+            }
+            out->appendf("\033[0m\033[K");
+            lines++;
+        }
+        out->appendf("\033[%d;1H\033[7m frame %zu \033[0m\033[K", rows, frame);
+        lines++;
+    }
+    out->appendf("\033[?1049l");
+    return lines;
+}
+
+struct Workload {
+    const char* name;
+    const char* description;
+    generate_t generate;
+};
+
+static const Workload WORKLOADS[] = {
+    { "ascii", "plain ASCII flood", generateAscii },
+    { "sgr", "SGR-colored short lines", generateSgr },
+    { "wide", "CJK and astral characters", generateWide },
+    { "tui", "full-screen redraws", generateTui },
+};
+
+static const size_t NUM_WORKLOADS = sizeof(WORKLOADS) / sizeof(WORKLOADS[0]);
+
+/*
+ * Listener that only counts what would have been sent to the UI.
+ */
+class CountingListener : public TerminalListener {
+public:
+    CountingListener() : damageCount(0), bellCount(0) {
+    }
+
+    virtual void onDamage(dimen_t startRow, dimen_t endRow, const uint32_t* dirtyRows,
+            size_t dirtyWords, size_t screenLine, uint64_t scrollOffset,
+            const VTermPos& cursorPos, bool cursorVisible) {
+        damageCount++;
+    }
+
+    virtual int onTermProp(VTermProp prop, const VTermValue& val) {
+        return 1;
+    }
+
+    virtual int onBell() {
+        bellCount++;
+        return 1;
+    }
+
+    size_t damageCount;
+    size_t bellCount;
+};
+
+/*
+ * Extracts every run of rows [startRow, endRow) the way the UI does when
+ * drawing, returning the number of runs so the work can't be optimized out.
+ */
+static size_t extractRows(Terminal* term, int startRow, int endRow) {
+    uint16_t data[MAX_RUN_CHARS];
+    size_t runs = 0;
+
+    Mutex::Autolock lock(term->mReadLock);
+    const ScreenFrame* frame = term->acquireFrameLocked();
+    CellRow cells;
+    for (int row = startRow; row < endRow; row++) {
+        term->getRowLocked(frame, row, &cells);
+        for (dimen_t col = 0; col < cells.cols;) {
+            size_t dataSize;
+            size_t colSize;
+            Terminal::getRun(cells, col, data, MAX_RUN_CHARS, &dataSize, &colSize);
+            if (colSize == 0) {
+                break;
+            }
+            col += colSize;
+            runs++;
+        }
+    }
+    return runs;
+}
+
+static double toMicros(nsecs_t ns) {
+    return ns / 1000.0;
+}
+
+/*
+ * Measures average time to extract a screen frame, and a page of history
+ * as seen while flinging through scrollback. Returns runs extracted.
+ */
+static size_t measureExtraction(Terminal* term, dimen_t rows, nsecs_t* screenTime,
+        nsecs_t* scrollTime) {
+    size_t runs = 0;
+    nsecs_t start = systemTime();
+    for (int i = 0; i < EXTRACT_FRAMES; i++) {
+        runs += extractRows(term, 0, rows);
+    }
+    *screenTime = (systemTime() - start) / EXTRACT_FRAMES;
+
+    start = systemTime();
+    for (int i = 0; i < EXTRACT_FRAMES; i++) {
+        runs += extractRows(term, -rows, 0);
+    }
+    *scrollTime = (systemTime() - start) / EXTRACT_FRAMES;
+    return runs;
+}
+
+static void runWorkload(const Workload& workload, size_t bytes, dimen_t rows, dimen_t cols) {
+    Buffer buffer;
+    size_t lines = workload.generate(&buffer, bytes, rows, cols);
+
+    CountingListener listener;
+    Terminal term(&listener);
+    term.resize(rows, cols, SCROLLBACK_ROWS);
+
+    nsecs_t start = systemTime();
+    for (size_t offset = 0; offset < buffer.size; offset += CHUNK_SIZE) {
+        size_t len = buffer.size - offset < CHUNK_SIZE ? buffer.size - offset : CHUNK_SIZE;
+        term.pushBytes(buffer.data + offset, len);
+        term.flushDamage();
+    }
+    nsecs_t parseTime = systemTime() - start;
+
+    nsecs_t screenTime, scrollTime;
+    size_t runs = measureExtraction(&term, rows, &screenTime, &scrollTime);
+
+    double seconds = parseTime / 1e9;
+    printf("%-6s %9.2f MB/s %12.0f lines/s %9.1f us/frame %9.1f us/page  %s\n",
+            workload.name, buffer.size / seconds / (1024 * 1024), lines / seconds,
+            toMicros(screenTime), toMicros(scrollTime), workload.description);
+    fprintf(stderr, "%-6s %zu bytes, %zu lines, %zu damage callbacks, %zu runs\n",
+            workload.name, buffer.size, lines, listener.damageCount, runs);
+}
+
+/*
+ * Feeds a recorded session through a terminal with no shell behind it.
+ * Damage is flushed whenever the recorded clock crosses a frame boundary,
+ * so delivery follows the original session even at full speed. When paced,
+ * events are also held back until their original time.
+ */
+static int runReplay(const char* path, bool paced) {
+    SessionPlayer player;
+    status_t res = player.open(path);
+    if (res != OK) {
+        fprintf(stderr, "failed to open recording %s: %d\n", path, res);
+        return 1;
+    }
+
+    CountingListener listener;
+    Terminal term(&listener);
+    dimen_t rows = player.getRows();
+    term.resize(rows, player.getCols(), SCROLLBACK_ROWS);
+
+    // Count lines up front, since scrollback only keeps the newest
+    SessionPlayer::Event event;
+    size_t lines = 0;
+    while (player.next(&event)) {
+        for (size_t i = 0; event.kind == RECORD_OUTPUT && i < event.len; i++) {
+            lines += event.bytes[i] == '\n';
+        }
+    }
+    player.rewind();
+
+    nsecs_t nextFlush = FRAME_INTERVAL;
+    nsecs_t recorded = 0;
+    nsecs_t start = systemTime();
+    while (player.next(&event)) {
+        if (paced) {
+            nsecs_t wait = event.when - (systemTime() - start);
+            if (wait > 0) {
+                struct timespec ts = { (time_t) (wait / 1000000000), (long) (wait % 1000000000) };
+                nanosleep(&ts, NULL);
+            }
+        }
+
+        if (event.when >= nextFlush) {
+            term.flushDamage();
+            nextFlush = event.when + FRAME_INTERVAL;
+        }
+
+        if (event.kind == RECORD_OUTPUT) {
+            term.pushBytes(event.bytes, event.len);
+        } else {
+            rows = event.rows;
+            term.resize(event.rows, event.cols, SCROLLBACK_ROWS);
+        }
+        recorded = event.when;
+    }
+    term.flushDamage();
+    nsecs_t parseTime = systemTime() - start;
+
+    nsecs_t screenTime, scrollTime;
+    size_t runs = measureExtraction(&term, rows, &screenTime, &scrollTime);
+
+    double seconds = parseTime / 1e9;
+    printf("%-6s %9.2f MB/s %12.0f lines/s %9.1f us/frame %9.1f us/page  %s\n",
+            "replay", player.getOutputBytes() / seconds / (1024 * 1024),
+            lines / seconds, toMicros(screenTime),
+            toMicros(scrollTime), path);
+    fprintf(stderr, "replay %zu bytes over %.1f s recorded, %zu damage callbacks, %zu runs\n",
+            player.getOutputBytes(), recorded / 1e9, listener.damageCount, runs);
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-m megabytes] [-r rows] [-c cols] [workload...]\n", name);
+    fprintf(stderr, "       %s -p recording [-s]\n", name);
+    fprintf(stderr, "  -p  replay a recorded session as fast as possible\n");
+    fprintf(stderr, "  -s  replay at the original pace instead\n");
+    fprintf(stderr, "workloads:\n");
+    for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+        fprintf(stderr, "  %-6s %s\n", WORKLOADS[i].name, WORKLOADS[i].description);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = DEFAULT_MEGABYTES;
+    int rows = 25;
+    int cols = 80;
+    const char* recording = NULL;
+    bool paced = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:c:p:sh")) != -1) {
+        switch (opt) {
+        case 'p':
+            recording = optarg;
+            break;
+        case 's':
+            paced = true;
+            break;
+        case 'm':
+            megabytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rows = atoi(optarg);
+            break;
+        case 'c':
+            cols = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (recording != NULL) {
+        return runReplay(recording, paced);
+    }
+
+    if (megabytes == 0 || rows < 2 || cols < 10 || rows > 0xffff || cols > 0xffff) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+        bool selected = optind == argc;
+        for (int arg = optind; arg < argc; arg++) {
+            selected |= strcmp(argv[arg], WORKLOADS[i].name) == 0;
+        }
+        if (selected) {
+            runWorkload(WORKLOADS[i], megabytes * 1024 * 1024, rows, cols);
+        }
+    }
+
+    return 0;
+}
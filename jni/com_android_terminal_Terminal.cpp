@@ -25,22 +25,15 @@
 #include "ScopedLocalRef.h"
 #include "ScopedPrimitiveArray.h"
 
-#include <fcntl.h>
-#include <pty.h>
-#include <stdio.h>
-#include <termios.h>
-#include <unistd.h>
-#include <util.h>
-#include <utmp.h>
-
 #include <vterm.h>
 
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define USE_TEST_SHELL 0
-#define DEBUG_CALLBACKS 0
-#define DEBUG_IO 0
-#define DEBUG_SCROLLBACK 0
+#include "ScrollbackBudget.h"
+#include "Terminal.h"
+#include "TerminalSearch.h"
 
 namespace android {
 
@@ -52,9 +45,7 @@ static jclass terminalCallbacksClass;
 /*
  * Callback methods
  */
-static jmethodID damageMethod;
-static jmethodID moveRectMethod;
-static jmethodID moveCursorMethod;
+static jmethodID damageRowsMethod;
 static jmethodID setTermPropBooleanMethod;
 static jmethodID setTermPropIntMethod;
 static jmethodID setTermPropStringMethod;
@@ -71,648 +62,570 @@ static jfieldID cellRunColSizeField;
 static jfieldID cellRunFgField;
 static jfieldID cellRunBgField;
 
-typedef short unsigned int dimen_t;
-
-class ScrollbackLine {
-public:
-    inline ScrollbackLine(dimen_t _cols) : cols(_cols) {
-        mCells = new VTermScreenCell[cols];
-    };
-    inline ~ScrollbackLine() {
-        delete mCells;
-    }
-
-    inline dimen_t copyFrom(dimen_t cols, const VTermScreenCell* cells) {
-        dimen_t n = this->cols > cols ? cols : this->cols;
-        memcpy(mCells, cells, sizeof(VTermScreenCell) * n);
-        return n;
-    }
-
-    inline dimen_t copyTo(dimen_t cols, VTermScreenCell* cells) {
-        dimen_t n = cols > this->cols ? this->cols : cols;
-        memcpy(cells, mCells, sizeof(VTermScreenCell) * n);
-        return n;
-    }
-
-    inline void getCell(dimen_t col, VTermScreenCell* cell) {
-        *cell = mCells[col];
-    }
-
-    const dimen_t cols;
-
-private:
-    VTermScreenCell* mCells;
-};
-
 /*
- * Terminal session
+ * Forwards terminal events to a Java TerminalCallbacks instance.
  */
-class Terminal {
+class JniTerminalListener : public TerminalListener {
 public:
-    Terminal(jobject callbacks);
-    ~Terminal();
-
-    status_t run();
+    JniTerminalListener(JNIEnv* env, jobject callbacks);
+    virtual ~JniTerminalListener();
 
-    size_t write(const char *bytes, size_t len);
-
-    bool dispatchCharacter(int mod, int character);
-    bool dispatchKey(int mod, int key);
-    bool flushInput();
-
-    status_t resize(dimen_t rows, dimen_t cols, dimen_t scrollRows);
-    status_t setColors(int fg, int bg);
-
-    status_t onPushline(dimen_t cols, const VTermScreenCell* cells);
-    status_t onPopline(dimen_t cols, VTermScreenCell* cells);
-    int onCursorChange(const VTermPos& oldPos, const VTermPos& newPos, bool visible);
-
-    bool getCellLocked(VTermPos pos, VTermScreenCell* cell);
-
-    dimen_t getRows() const;
-    dimen_t getCols() const;
-    dimen_t getScrollRows() const;
-
-    jobject getCallbacks() const;
-
-    // Lock protecting mutations of internal libvterm state
-    Mutex mLock;
+    virtual void onDamage(dimen_t startRow, dimen_t endRow, const uint32_t* dirtyRows,
+            size_t dirtyWords, size_t screenLine, uint64_t scrollOffset,
+            const VTermPos& cursorPos, bool cursorVisible);
+    virtual int onTermProp(VTermProp prop, const VTermValue& val);
+    virtual int onBell();
 
 private:
-    int mMasterFd;
-    pid_t mChildPid;
-    VTerm *mVt;
-    VTermScreen *mVts;
-
     jobject mCallbacks;
-
-    dimen_t mRows;
-    dimen_t mCols;
-    bool mKilled;
-    bool mCursorVisible;
-
-    ScrollbackLine **mScroll;
-    dimen_t mScrollCur;
-    dimen_t mScrollSize;
-
+    jintArray mDirtyArray;
+    size_t mDirtyArrayLength;
 };
 
 /*
- * VTerm event handlers
+ * Events arrive on the parse reactor thread, which wasn't started by the VM,
+ * so it's attached on first use and stays attached for the life of the
+ * process.
  */
-
-static int term_damage(VTermRect rect, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_damage");
-#endif
-
+static JNIEnv* getCallbackEnv() {
     JNIEnv* env = AndroidRuntime::getJNIEnv();
-    return env->CallIntMethod(term->getCallbacks(), damageMethod, rect.start_row, rect.end_row,
-            rect.start_col, rect.end_col);
+    if (env == NULL) {
+        JavaVMAttachArgs args = { JNI_VERSION_1_6, "TerminalParser", NULL };
+        if (AndroidRuntime::getJavaVM()->AttachCurrentThread(&env, &args) != JNI_OK) {
+            ALOGE("failed to attach thread to VM");
+            return NULL;
+        }
+    }
+    return env;
 }
 
-static int term_moverect(VTermRect dest, VTermRect src, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_moverect");
-#endif
+JniTerminalListener::JniTerminalListener(JNIEnv* env, jobject callbacks) :
+        mDirtyArray(NULL), mDirtyArrayLength(0) {
+    mCallbacks = env->NewGlobalRef(callbacks);
+}
 
+JniTerminalListener::~JniTerminalListener() {
     JNIEnv* env = AndroidRuntime::getJNIEnv();
-    return env->CallIntMethod(term->getCallbacks(), moveRectMethod,
-            dest.start_row, dest.end_row, dest.start_col, dest.end_col,
-            src.start_row, src.end_row, src.start_col, src.end_col);
+    if (mDirtyArray != NULL) {
+        env->DeleteGlobalRef(mDirtyArray);
+    }
+    env->DeleteGlobalRef(mCallbacks);
 }
 
-static int term_movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_movecursor");
-#endif
+void JniTerminalListener::onDamage(dimen_t startRow, dimen_t endRow, const uint32_t* dirtyRows,
+        size_t dirtyWords, size_t screenLine, uint64_t scrollOffset, const VTermPos& cursorPos,
+        bool cursorVisible) {
+    JNIEnv* env = getCallbackEnv();
+    if (env == NULL) {
+        return;
+    }
+
+    if (mDirtyArrayLength != dirtyWords) {
+        if (mDirtyArray != NULL) {
+            env->DeleteGlobalRef(mDirtyArray);
+        }
+        ScopedLocalRef<jintArray> array(env, env->NewIntArray(dirtyWords));
+        mDirtyArray = reinterpret_cast<jintArray>(env->NewGlobalRef(array.get()));
+        mDirtyArrayLength = dirtyWords;
+    }
 
-    return term->onCursorChange(oldpos, pos, visible != 0);
+    size_t firstWord = startRow >> 5;
+    size_t lastWord = startRow == endRow ? firstWord : ((endRow - 1) >> 5) + 1;
+    env->SetIntArrayRegion(mDirtyArray, firstWord, lastWord - firstWord,
+            reinterpret_cast<const jint*>(dirtyRows + firstWord));
+    env->CallIntMethod(mCallbacks, damageRowsMethod, startRow, endRow, mDirtyArray,
+            (jlong) screenLine, (jlong) scrollOffset, cursorPos.row, cursorPos.col,
+            cursorVisible);
 }
 
-static int term_settermprop(VTermProp prop, VTermValue *val, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_settermprop");
-#endif
+int JniTerminalListener::onTermProp(VTermProp prop, const VTermValue& val) {
+    JNIEnv* env = getCallbackEnv();
+    if (env == NULL) {
+        return 0;
+    }
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
     switch (vterm_get_prop_type(prop)) {
     case VTERM_VALUETYPE_BOOL:
-        return env->CallIntMethod(term->getCallbacks(), setTermPropBooleanMethod, prop,
-                val->boolean ? JNI_TRUE : JNI_FALSE);
+        return env->CallIntMethod(mCallbacks, setTermPropBooleanMethod, prop,
+                val.boolean ? JNI_TRUE : JNI_FALSE);
     case VTERM_VALUETYPE_INT:
-        return env->CallIntMethod(term->getCallbacks(), setTermPropIntMethod, prop, val->number);
-    case VTERM_VALUETYPE_STRING:
-        return env->CallIntMethod(term->getCallbacks(), setTermPropStringMethod, prop,
-                env->NewStringUTF(val->string));
+        return env->CallIntMethod(mCallbacks, setTermPropIntMethod, prop, val.number);
+    case VTERM_VALUETYPE_STRING: {
+        ScopedLocalRef<jstring> string(env, env->NewStringUTF(val.string));
+        return env->CallIntMethod(mCallbacks, setTermPropStringMethod, prop, string.get());
+    }
     case VTERM_VALUETYPE_COLOR:
-        return env->CallIntMethod(term->getCallbacks(), setTermPropIntMethod, prop, val->color.red,
-                val->color.green, val->color.blue);
+        return env->CallIntMethod(mCallbacks, setTermPropColorMethod, prop, val.color.red,
+                val.color.green, val.color.blue);
     default:
         ALOGE("unknown callback type");
         return 0;
     }
 }
 
-static int term_setmousefunc(VTermMouseFunc func, void *data, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_setmousefunc");
-#endif
-    return 1;
+int JniTerminalListener::onBell() {
+    JNIEnv* env = getCallbackEnv();
+    if (env == NULL) {
+        return 0;
+    }
+    return env->CallIntMethod(mCallbacks, bellMethod);
 }
 
-static int term_bell(void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_bell");
-#endif
+/*
+ * JNI glue
+ */
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    return env->CallIntMethod(term->getCallbacks(), bellMethod);
-}
+/*
+ * Modified UTF-8 copy of a Java String[], NULL terminated, for as long as it
+ * stays in scope. A null array gives a NULL copy; a null element or running
+ * out of memory leaves the copy invalid.
+ */
+class ScopedUtfStringArray {
+public:
+    ScopedUtfStringArray(JNIEnv* env, jobjectArray array) :
+            mEnv(env), mCount(0), mStrings(NULL), mChars(NULL), mValid(true) {
+        if (array == NULL) {
+            return;
+        }
 
-static int term_sb_pushline(int cols, const VTermScreenCell *cells, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_sb_pushline");
-#endif
+        mCount = env->GetArrayLength(array);
+        mStrings = (jstring*) calloc(mCount, sizeof(jstring));
+        mChars = (const char**) calloc(mCount + 1, sizeof(const char*));
+        if (mStrings == NULL || mChars == NULL) {
+            mValid = false;
+            return;
+        }
+        for (size_t i = 0; i < mCount; i++) {
+            mStrings[i] = (jstring) env->GetObjectArrayElement(array, i);
+            if (mStrings[i] == NULL
+                    || (mChars[i] = env->GetStringUTFChars(mStrings[i], NULL)) == NULL) {
+                mValid = false;
+                return;
+            }
+        }
+    }
 
-    return term->onPushline(cols, cells);
-}
+    ~ScopedUtfStringArray() {
+        for (size_t i = 0; mStrings != NULL && i < mCount && mStrings[i] != NULL; i++) {
+            if (mChars[i] != NULL) {
+                mEnv->ReleaseStringUTFChars(mStrings[i], mChars[i]);
+            }
+            mEnv->DeleteLocalRef(mStrings[i]);
+        }
+        free(mStrings);
+        free(mChars);
+    }
 
-static int term_sb_popline(int cols, VTermScreenCell *cells, void *user) {
-    Terminal* term = reinterpret_cast<Terminal*>(user);
-#if DEBUG_CALLBACKS
-    ALOGW("term_sb_popline");
-#endif
+    inline bool isValid() const {
+        return mValid;
+    }
 
-    return term->onPopline(cols, cells);
-}
+    inline const char* const* get() const {
+        return mChars;
+    }
 
-static VTermScreenCallbacks cb = {
-    .damage = term_damage,
-    .moverect = term_moverect,
-    .movecursor = term_movecursor,
-    .settermprop = term_settermprop,
-    .setmousefunc = term_setmousefunc,
-    .bell = term_bell,
-    // Resize requests are applied immediately, so callback is ignored
-    .resize = NULL,
-    .sb_pushline = term_sb_pushline,
-    .sb_popline = term_sb_popline,
+private:
+    JNIEnv* mEnv;
+    size_t mCount;
+    jstring* mStrings;
+    const char** mChars;
+    bool mValid;
 };
 
-static inline int toArgb(const VTermColor& color) {
-    return (0xff << 24 | color.red << 16 | color.green << 8 | color.blue);
-}
-
-Terminal::Terminal(jobject callbacks) :
-        mCallbacks(callbacks), mRows(25), mCols(80), mKilled(false),
-        mCursorVisible(true), mScrollCur(0), mScrollSize(100) {
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    mCallbacks = env->NewGlobalRef(callbacks);
-
-    mScroll = new ScrollbackLine*[mScrollSize];
-    memset(mScroll, 0, sizeof(ScrollbackLine*) * mScrollSize);
-
-    /* Create VTerm */
-    mVt = vterm_new(mRows, mCols);
-    vterm_parser_set_utf8(mVt, 1);
-
-    /* Set up screen */
-    mVts = vterm_obtain_screen(mVt);
-    vterm_screen_enable_altscreen(mVts, 1);
-    vterm_screen_set_callbacks(mVts, &cb, this);
-    vterm_screen_set_damage_merge(mVts, VTERM_DAMAGE_SCROLL);
-    vterm_screen_reset(mVts, 1);
+static jlong com_android_terminal_Terminal_nativeInit(JNIEnv* env, jclass clazz, jobject callbacks) {
+    return reinterpret_cast<jlong>(new Terminal(new JniTerminalListener(env, callbacks)));
 }
 
-Terminal::~Terminal() {
-    close(mMasterFd);
-    ::kill(mChildPid, SIGHUP);
-
-    vterm_free(mVt);
-
-    delete mScroll;
-
-    JNIEnv *env = AndroidRuntime::getJNIEnv();
-    env->DeleteGlobalRef(mCallbacks);
+static jint com_android_terminal_Terminal_nativeDestroy(JNIEnv* env, jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    TerminalListener* listener = term->getListener();
+    delete term;
+    delete listener;
+    return 0;
 }
 
-status_t Terminal::run() {
-    struct termios termios;
-    memset(&termios, 0, sizeof(termios));
-    termios.c_iflag = ICRNL|IXON|IUTF8;
-    termios.c_oflag = OPOST|ONLCR|NL0|CR0|TAB0|BS0|VT0|FF0;
-    termios.c_cflag = CS8|CREAD;
-    termios.c_lflag = ISIG|ICANON|IEXTEN|ECHO|ECHOE|ECHOK;
-
-    cfsetispeed(&termios, B38400);
-    cfsetospeed(&termios, B38400);
-
-    termios.c_cc[VINTR]    = 0x1f & 'C';
-    termios.c_cc[VQUIT]    = 0x1f & '\\';
-    termios.c_cc[VERASE]   = 0x7f;
-    termios.c_cc[VKILL]    = 0x1f & 'U';
-    termios.c_cc[VEOF]     = 0x1f & 'D';
-    termios.c_cc[VSTART]   = 0x1f & 'Q';
-    termios.c_cc[VSTOP]    = 0x1f & 'S';
-    termios.c_cc[VSUSP]    = 0x1f & 'Z';
-    termios.c_cc[VREPRINT] = 0x1f & 'R';
-    termios.c_cc[VWERASE]  = 0x1f & 'W';
-    termios.c_cc[VLNEXT]   = 0x1f & 'V';
-    termios.c_cc[VMIN]     = 1;
-    termios.c_cc[VTIME]    = 0;
-
-    struct winsize size = { mRows, mCols, 0, 0 };
-
-    int stderr_save_fd = dup(2);
-    if (stderr_save_fd < 0) {
-        ALOGE("failed to dup stderr - %s", strerror(errno));
-    }
-
-    mChildPid = forkpty(&mMasterFd, NULL, &termios, &size);
-    if (mChildPid == 0) {
-        /* Restore the ISIG signals back to defaults */
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGSTOP, SIG_DFL);
-        signal(SIGCONT, SIG_DFL);
-
-        FILE *stderr_save = fdopen(stderr_save_fd, "a");
-
-        if (!stderr_save) {
-            ALOGE("failed to open stderr - %s", strerror(errno));
+static jint com_android_terminal_Terminal_nativeSetCommand(JNIEnv* env, jclass clazz,
+        jlong ptr, jstring path, jobjectArray argv, jobjectArray envp) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    // A null path falls back to the default shell
+    const char* pathChars = NULL;
+    if (path != NULL) {
+        pathChars = env->GetStringUTFChars(path, NULL);
+        if (pathChars == NULL) {
+            return -1;
         }
-
-        // We know execvp(2) won't actually try to modify this.
-        char *shell = const_cast<char*>("/system/bin/sh");
-#if USE_TEST_SHELL
-        char *args[4] = {shell, "-c", "x=1; c=0; while true; do echo -e \"stop \e[00;3${c}mechoing\e[00m yourself! ($x)\"; x=$(( $x + 1 )); c=$((($c+1)%7)); if [ $x -gt 110 ]; then sleep 0.5; fi; done", NULL};
-#else
-        char *args[2] = {shell, NULL};
-#endif
-
-        execvp(shell, args);
-        fprintf(stderr_save, "Cannot exec(%s) - %s\n", shell, strerror(errno));
-        _exit(1);
     }
 
-    ALOGD("entering read() loop");
-    while (1) {
-        char buffer[4096];
-        ssize_t bytes = ::read(mMasterFd, buffer, sizeof buffer);
-#if DEBUG_IO
-        ALOGD("read() returned %d bytes", bytes);
-#endif
-
-        if (mKilled) {
-            ALOGD("kill() requested");
-            break;
-        }
-        if (bytes == 0) {
-            ALOGD("read() found EOF");
-            break;
-        }
-        if (bytes == -1) {
-            ALOGE("read() failed: %s", strerror(errno));
-            return 1;
-        }
-
-        {
-            Mutex::Autolock lock(mLock);
-            vterm_push_bytes(mVt, buffer, bytes);
-            vterm_screen_flush_damage(mVts);
+    status_t res;
+    {
+        ScopedUtfStringArray args(env, argv);
+        ScopedUtfStringArray vars(env, envp);
+        if (args.isValid() && vars.isValid()) {
+            res = term->setCommand(pathChars, args.get(), vars.get());
+        } else {
+            res = BAD_VALUE;
         }
     }
-
-    return 0;
+    if (pathChars != NULL) {
+        env->ReleaseStringUTFChars(path, pathChars);
+    }
+    return res;
 }
 
-size_t Terminal::write(const char *bytes, size_t len) {
-    return ::write(mMasterFd, bytes, len);
+static jint com_android_terminal_Terminal_nativeStart(JNIEnv* env, jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->start();
 }
 
-bool Terminal::dispatchCharacter(int mod, int character) {
-    Mutex::Autolock lock(mLock);
-    vterm_input_push_char(mVt, static_cast<VTermModifier>(mod), character);
-    return flushInput();
+static jint com_android_terminal_Terminal_nativeResize(JNIEnv* env,
+        jclass clazz, jlong ptr, jint rows, jint cols, jint scrollRows) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->resize(rows, cols, scrollRows);
 }
 
-bool Terminal::dispatchKey(int mod, int key) {
-    Mutex::Autolock lock(mLock);
-    vterm_input_push_key(mVt, static_cast<VTermModifier>(mod), static_cast<VTermKey>(key));
-    return flushInput();
+static jint com_android_terminal_Terminal_nativeSetColors(JNIEnv* env,
+        jclass clazz, jlong ptr, jint fg, jint bg) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->setColors(fg, bg);
 }
 
-bool Terminal::flushInput() {
-    size_t len = vterm_output_get_buffer_current(mVt);
-    if (len) {
-        char buf[len];
-        len = vterm_output_bufferread(mVt, buf, len);
-        return len == write(buf, len);
-    }
-    return true;
+static void com_android_terminal_Terminal_nativeSetFrameInterval(JNIEnv* env,
+        jclass clazz, jlong ptr, jint millis) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    term->setFrameInterval(millis);
 }
 
-status_t Terminal::resize(dimen_t rows, dimen_t cols, dimen_t scrollRows) {
-    Mutex::Autolock lock(mLock);
-
-    ALOGD("resize(%d, %d, %d)", rows, cols, scrollRows);
-
-    mRows = rows;
-    mCols = cols;
-    // TODO: resize scrollback
-
-    struct winsize size = { rows, cols, 0, 0 };
-    ioctl(mMasterFd, TIOCSWINSZ, &size);
-
-    vterm_set_size(mVt, rows, cols);
-    vterm_screen_flush_damage(mVts);
+static void com_android_terminal_Terminal_nativeSetJumpScroll(JNIEnv* env,
+        jclass clazz, jlong ptr, jint bytesPerFrame) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    term->setJumpScroll(bytesPerFrame);
+}
 
-    return 0;
+static void com_android_terminal_Terminal_nativeSetInputQueueLimit(JNIEnv* env,
+        jclass clazz, jlong ptr, jint bytes) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    term->setInputQueueLimit(bytes > 0 ? bytes : 0);
 }
 
-status_t Terminal::setColors(int fg, int bg) {
-    Mutex::Autolock lock(mLock);
+static void com_android_terminal_Terminal_nativeSetVisible(JNIEnv* env,
+        jclass clazz, jlong ptr, jboolean visible) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    term->setVisible(visible);
+}
 
-    ALOGD("setColors(0x%x, 0x%x)", fg, bg);
+static void com_android_terminal_Terminal_nativeSetScrollbackBudget(JNIEnv* env,
+        jclass clazz, jlong bytes) {
+    ScrollbackBudget::getInstance().setLimit(bytes > 0 ? bytes : 0);
+}
 
-    VTermState* state = vterm_obtain_state(mVt);
-    VTermColor oldFgColor, oldBgColor;
-    vterm_state_get_default_colors(state, &oldFgColor, &oldBgColor);
+static jlong com_android_terminal_Terminal_nativeGetScrollbackBudgetUsed(JNIEnv* env,
+        jclass clazz) {
+    return ScrollbackBudget::getInstance().getTotal();
+}
 
-    int changed = fg != toArgb(oldFgColor) || bg != toArgb(oldBgColor);
-    VTermColor fg_color = { (uint8_t)((fg>>16)&0xff),
-                            (uint8_t)((fg>>8)&0xff),
-                            (uint8_t)(fg&0xff) };
-    VTermColor bg_color = { (uint8_t)((bg>>16)&0xff),
-                            (uint8_t)((bg>>8)&0xff),
-                            (uint8_t)(bg&0xff) };
-    vterm_state_set_default_colors(state, &fg_color, &bg_color);
+static void com_android_terminal_Terminal_nativeTrimMemory(JNIEnv* env,
+        jclass clazz, jint level) {
+    ScrollbackBudget::getInstance().onTrimMemory(level);
+}
 
-    VTermPos oldPos, newPos;
-    vterm_state_get_cursorpos(state, &oldPos);
-    vterm_state_reset(state, changed);
-    vterm_state_get_cursorpos(state, &newPos);
+static jint com_android_terminal_Terminal_nativeSetScrollbackSpill(JNIEnv* env,
+        jclass clazz, jlong ptr, jstring dir, jint hotRows) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    if (dir == NULL) {
+        return term->setScrollbackSpill(NULL, hotRows);
+    }
 
-    if (oldPos.row != newPos.row || oldPos.col != newPos.col) {
-        onCursorChange(oldPos, newPos, mCursorVisible);
+    const char* path = env->GetStringUTFChars(dir, NULL);
+    if (path == NULL) {
+        return -1;
     }
+    status_t res = term->setScrollbackSpill(path, hotRows);
+    env->ReleaseStringUTFChars(dir, path);
+    return res;
+}
 
-    return 0;
+static jint com_android_terminal_Terminal_nativeStartRecording(JNIEnv* env,
+        jclass clazz, jlong ptr, jstring path) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    const char* chars = env->GetStringUTFChars(path, NULL);
+    if (chars == NULL) {
+        return -1;
+    }
+    status_t res = term->startRecording(chars);
+    env->ReleaseStringUTFChars(path, chars);
+    return res;
 }
 
-int Terminal::onCursorChange(const VTermPos& oldPos, const VTermPos& newPos, bool visible) {
-    mCursorVisible = visible;
+static void com_android_terminal_Terminal_nativeStopRecording(JNIEnv* env,
+        jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    term->stopRecording();
+}
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    return env->CallIntMethod(getCallbacks(), moveCursorMethod, newPos.row,
-            newPos.col, oldPos.row, oldPos.col, visible);
+static jboolean com_android_terminal_Terminal_nativeIsRecording(JNIEnv* env,
+        jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->isRecording();
 }
 
-status_t Terminal::onPushline(dimen_t cols, const VTermScreenCell* cells) {
-    ScrollbackLine* line = NULL;
-    if (mScrollCur == mScrollSize) {
-        /* Recycle old row if it's the right size */
-        if (mScroll[mScrollCur - 1]->cols == cols) {
-            line = mScroll[mScrollCur - 1];
-        } else {
-            delete mScroll[mScrollCur - 1];
-        }
+static inline int toArgb(uint32_t rgb) {
+    return 0xff << 24 | rgb;
+}
 
-        memmove(mScroll + 1, mScroll, sizeof(ScrollbackLine*) * (mScrollCur - 1));
-    } else if (mScrollCur > 0) {
-        memmove(mScroll + 1, mScroll, sizeof(ScrollbackLine*) * mScrollCur);
-    }
+static jint com_android_terminal_Terminal_nativeGetCellRun(JNIEnv* env,
+        jclass clazz, jlong ptr, jint row, jint col, jobject run) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
 
-    if (line == NULL) {
-        line = new ScrollbackLine(cols);
+    jcharArray dataArray = (jcharArray) env->GetObjectField(run, cellRunDataField);
+    ScopedCharArrayRW data(env, dataArray);
+    if (data.get() == NULL) {
+        return -1;
     }
 
-    mScroll[0] = line;
+    Mutex::Autolock lock(term->mReadLock);
+    term->noteCellRunLocked();
+    const ScreenFrame* frame = term->acquireFrameLocked();
 
-    if (mScrollCur < mScrollSize) {
-        mScrollCur++;
+    size_t dataSize = 0;
+    size_t colSize = 0;
+    CellRow cells;
+    bool valid = term->getRowLocked(frame, row, &cells);
+    if (col >= 0 && col < cells.cols) {
+        Terminal::getRun(cells, col, data.get(), data.size(), &dataSize, &colSize);
+        if (valid) {
+            env->SetIntField(run, cellRunFgField, toArgb(styleFg(cells.styles[col])));
+            env->SetIntField(run, cellRunBgField, toArgb(styleBg(cells.styles[col])));
+        }
     }
 
-    line->copyFrom(cols, cells);
-    return 1;
-}
+    env->SetIntField(run, cellRunDataSizeField, dataSize);
+    env->SetIntField(run, cellRunColSizeField, colSize);
 
-status_t Terminal::onPopline(dimen_t cols, VTermScreenCell* cells) {
-    if (mScrollCur == 0) {
-        return 0;
-    }
+    return 0;
+}
 
-    ScrollbackLine* line = mScroll[0];
-    mScrollCur--;
-    memmove(mScroll, mScroll + 1, sizeof(ScrollbackLine*) * mScrollCur);
+/*
+ * Fills a direct ByteBuffer with every run of rows [startRow, endRow) in a
+ * single pass over the latest published frame. Layout, all native-endian
+ * 32-bit ints:
+ *
+ *   per row:  row, runCount, then runCount runs
+ *   per run:  col, colSize, fg, bg, attrs, dataSize, then dataSize UTF-16
+ *             chars padded to a multiple of 4 bytes
+ *
+ * attrs uses the STYLE_ATTR_* bits from CellStyle.h. Cells outside the
+ * valid region are reported with default colors. Returns bytes written, or
+ * -1 if the buffer is too small to hold the requested rows.
+ */
+static jint com_android_terminal_Terminal_nativeGetLineRuns(JNIEnv* env,
+        jclass clazz, jlong ptr, jlong startLine, jlong endLine, jint maxRunChars,
+        jobject buffer) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
 
-    dimen_t n = line->copyTo(cols, cells);
-    for (dimen_t col = n; col < cols; col++) {
-        cells[col].chars[0] = 0;
-        cells[col].width = 1;
+    uint8_t* base = reinterpret_cast<uint8_t*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (base == NULL || capacity < 0 || maxRunChars <= 0) {
+        return -1;
     }
 
-    delete line;
-    return 1;
-}
-
-bool Terminal::getCellLocked(VTermPos pos, VTermScreenCell* cell) {
-    // The UI may be asking for cell data while the model is changing
-    // underneath it, so we always fill with meaningful data.
-
-    if (pos.row < 0) {
-        size_t scrollRow = -pos.row;
-        if (scrollRow > mScrollCur) {
-            // Invalid region above current scrollback
-            cell->width = 1;
-#if DEBUG_SCROLLBACK
-            cell->bg.red = 255;
-#endif
-            return false;
+    const size_t runHeader = 6 * sizeof(jint);
+    const size_t maxRunBytes = runHeader + ((maxRunChars * sizeof(jchar) + 3) & ~3);
+    uint8_t* out = base;
+    uint8_t* end = base + capacity;
+
+    Mutex::Autolock lock(term->mReadLock);
+    term->noteRowRunsLocked();
+    const ScreenFrame* frame = term->acquireFrameLocked();
+
+    // Lines map to rows through the same frame the rows are read from, so
+    // output published meanwhile can't shift them
+    CellRow cells;
+    for (jlong line = startLine; line < endLine; line++) {
+        if ((size_t) (end - out) < 2 * sizeof(jint)) {
+            return -1;
         }
-
-        ScrollbackLine* line = mScroll[scrollRow - 1];
-        if ((size_t) pos.col < line->cols) {
-            // Valid scrollback cell
-            line->getCell(pos.col, cell);
-            cell->width = 1;
-#if DEBUG_SCROLLBACK
-            cell->bg.blue = 255;
-#endif
-            return true;
-        } else {
-            // Extend last scrollback cell into invalid region
-            line->getCell(line->cols - 1, cell);
-            cell->width = 1;
-            cell->chars[0] = ' ';
-#if DEBUG_SCROLLBACK
-            cell->bg.green = 255;
-#endif
-            return true;
+        jlong row = line - (jlong) frame->scrollSeq;
+        if (row < -INT_MAX) {
+            row = -INT_MAX;
+        } else if (row > INT_MAX) {
+            row = INT_MAX;
         }
-    }
+        jint* rowHeader = reinterpret_cast<jint*>(out);
+        rowHeader[0] = row;
+        rowHeader[1] = 0;
+        out += 2 * sizeof(jint);
+
+        bool valid = term->getRowLocked(frame, row, &cells);
+        for (dimen_t col = 0; col < cells.cols;) {
+            if ((size_t) (end - out) < maxRunBytes) {
+                return -1;
+            }
 
-    if ((size_t) pos.row >= mRows) {
-        // Invalid region below screen
-        cell->width = 1;
-#if DEBUG_SCROLLBACK
-        cell->bg.red = 128;
-#endif
-        return false;
+            jint* header = reinterpret_cast<jint*>(out);
+            jchar* data = reinterpret_cast<jchar*>(out + runHeader);
+            size_t dataSize;
+            size_t colSize;
+            Terminal::getRun(cells, col, data, maxRunChars, &dataSize, &colSize);
+            if (colSize == 0) {
+                break;
+            }
+
+            style_key_t style = cells.styles[col];
+            header[0] = col;
+            header[1] = colSize;
+            header[2] = toArgb(valid ? styleFg(style) : frame->defaultFg);
+            header[3] = toArgb(valid ? styleBg(style) : frame->defaultBg);
+            header[4] = valid ? styleAttrs(style) : 0;
+            header[5] = dataSize;
+            out += runHeader + ((dataSize * sizeof(jchar) + 3) & ~3);
+
+            rowHeader[1]++;
+            col += colSize;
+        }
     }
 
-    // Valid screen cell
-    vterm_screen_get_cell(mVts, pos, cell);
-    return true;
+    return out - base;
 }
 
-dimen_t Terminal::getRows() const {
-    return mRows;
+static jint com_android_terminal_Terminal_nativeGetRows(JNIEnv* env, jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->getRows();
 }
 
-dimen_t Terminal::getCols() const {
-    return mCols;
+static jint com_android_terminal_Terminal_nativeGetCols(JNIEnv* env, jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->getCols();
 }
 
-dimen_t Terminal::getScrollRows() const {
-    return mScrollSize;
+static jint com_android_terminal_Terminal_nativeGetScrollRows(JNIEnv* env, jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->getScrollRows();
 }
 
-jobject Terminal::getCallbacks() const {
-    return mCallbacks;
+static jint com_android_terminal_Terminal_nativeGetScrollbackLines(JNIEnv* env, jclass clazz,
+        jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->getScrollbackLines();
 }
 
-/*
- * JNI glue
- */
-
-static jlong com_android_terminal_Terminal_nativeInit(JNIEnv* env, jclass clazz, jobject callbacks) {
-    return reinterpret_cast<jlong>(new Terminal(callbacks));
+static jlong com_android_terminal_Terminal_nativeGetScrollbackBytesHeld(JNIEnv* env,
+        jclass clazz, jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    return term->getScrollbackBytesHeld();
 }
 
-static jint com_android_terminal_Terminal_nativeDestroy(JNIEnv* env, jclass clazz, jlong ptr) {
+static jlong com_android_terminal_Terminal_nativeGetScrollbackBytesUsed(JNIEnv* env,
+        jclass clazz, jlong ptr) {
     Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    delete term;
-    return 0;
+    return term->getScrollbackBytesUsed();
 }
 
-static jint com_android_terminal_Terminal_nativeRun(JNIEnv* env, jclass clazz, jlong ptr) {
+static jlong com_android_terminal_Terminal_nativeGetQueuedInput(JNIEnv* env,
+        jclass clazz, jlong ptr) {
     Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->run();
+    return term->getQueuedInput();
 }
 
-static jint com_android_terminal_Terminal_nativeResize(JNIEnv* env,
-        jclass clazz, jlong ptr, jint rows, jint cols, jint scrollRows) {
+static jint com_android_terminal_Terminal_nativeGetStats(JNIEnv* env, jclass clazz, jlong ptr,
+        jlongArray stats) {
     Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->resize(rows, cols, scrollRows);
+
+    ScopedLongArrayRW values(env, stats);
+    if (values.get() == NULL) {
+        return -1;
+    }
+
+    uint64_t buf[STAT_COUNT];
+    size_t count = term->getStats(buf, values.size());
+    for (size_t i = 0; i < count; i++) {
+        values[i] = buf[i];
+    }
+    return count;
 }
 
-static jint com_android_terminal_Terminal_nativeSetColors(JNIEnv* env,
-        jclass clazz, jlong ptr, jint fg, jint bg) {
+static jlong com_android_terminal_Terminal_nativeGetScreenLine(JNIEnv* env, jclass clazz,
+        jlong ptr) {
     Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->setColors(fg, bg);
+    Mutex::Autolock lock(term->mReadLock);
+    return term->acquireFrameLocked()->scrollSeq;
 }
 
-static inline bool isCellStyleEqual(const VTermScreenCell& a, const VTermScreenCell& b) {
-    if (toArgb(a.fg) != toArgb(b.fg)) return false;
-    if (toArgb(a.bg) != toArgb(b.bg)) return false;
+static jlong com_android_terminal_Terminal_nativeGetFirstLine(JNIEnv* env, jclass clazz,
+        jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    Mutex::Autolock lock(term->mReadLock);
+    size_t first, end;
+    term->getLineRangeLocked(term->acquireFrameLocked(), &first, &end);
+    return first;
+}
 
-    if (a.attrs.bold != b.attrs.bold) return false;
-    if (a.attrs.underline != b.attrs.underline) return false;
-    if (a.attrs.italic != b.attrs.italic) return false;
-    if (a.attrs.blink != b.attrs.blink) return false;
-    if (a.attrs.reverse != b.attrs.reverse) return false;
-    if (a.attrs.strike != b.attrs.strike) return false;
-    if (a.attrs.font != b.attrs.font) return false;
+static jlong com_android_terminal_Terminal_nativeGetScrollOffset(JNIEnv* env, jclass clazz,
+        jlong ptr) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    Mutex::Autolock lock(term->mReadLock);
+    return term->acquireFrameLocked()->scrollOffset;
+}
+
+static jlong com_android_terminal_Terminal_nativeSearchStart(JNIEnv* env, jclass clazz,
+        jstring pattern, jint flags) {
+    const jsize len = env->GetStringLength(pattern);
+    jchar* utf16 = new jchar[len];
+    uint32_t* codepoints = new uint32_t[len];
+    env->GetStringRegion(pattern, 0, len, utf16);
+
+    size_t count = 0;
+    for (jsize i = 0; i < len; i++) {
+        uint32_t c = utf16[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < len
+                && utf16[i + 1] >= 0xdc00 && utf16[i + 1] < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (utf16[i + 1] - 0xdc00);
+            i++;
+        }
+        codepoints[count++] = c;
+    }
 
-    return true;
+    TerminalSearch* search = new TerminalSearch(codepoints, count, flags);
+    delete[] utf16;
+    delete[] codepoints;
+    return reinterpret_cast<jlong>(search);
 }
 
-static jint com_android_terminal_Terminal_nativeGetCellRun(JNIEnv* env,
-        jclass clazz, jlong ptr, jint row, jint col, jobject run) {
+/*
+ * Fills matches with the next chunk of results, two longs per match: the
+ * absolute line, then the start column in the high half and the number of
+ * columns in the low half. Returns the number of matches, or -1 once the
+ * search has covered all of history.
+ */
+static jint com_android_terminal_Terminal_nativeSearchNext(JNIEnv* env, jclass clazz,
+        jlong ptr, jlong searchPtr, jlongArray matches) {
     Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    Mutex::Autolock lock(term->mLock);
+    TerminalSearch* search = reinterpret_cast<TerminalSearch*>(searchPtr);
 
-    jcharArray dataArray = (jcharArray) env->GetObjectField(run, cellRunDataField);
-    ScopedCharArrayRW data(env, dataArray);
-    if (data.get() == NULL) {
+    ScopedLongArrayRW values(env, matches);
+    if (values.get() == NULL) {
         return -1;
     }
 
-    VTermScreenCell firstCell, cell;
-
-    VTermPos pos = {
-        .row = row,
-        .col = col,
-    };
-
-    size_t dataSize = 0;
-    size_t colSize = 0;
-    while ((size_t) pos.col < term->getCols()) {
-        memset(&cell, 0, sizeof(VTermScreenCell));
-        bool valid = term->getCellLocked(pos, &cell);
-
-        if (colSize == 0) {
-            if (valid) {
-                env->SetIntField(run, cellRunFgField, toArgb(cell.fg));
-                env->SetIntField(run, cellRunBgField, toArgb(cell.bg));
-            }
-            memcpy(&firstCell, &cell, sizeof(VTermScreenCell));
-        } else {
-            if (!isCellStyleEqual(cell, firstCell)) {
-                break;
-            }
-        }
-
-        // Only include cell chars if they fit into run
-        uint32_t rawCell = cell.chars[0];
-        size_t size = (rawCell < 0x10000) ? 1 : 2;
-        if (dataSize + size <= data.size()) {
-            if (rawCell < 0x10000) {
-                data[dataSize++] = rawCell;
-            } else {
-                data[dataSize++] = (((rawCell - 0x10000) >> 10) & 0x3ff) + 0xd800;
-                data[dataSize++] = ((rawCell - 0x10000) & 0x3ff) + 0xdc00;
-            }
-
-            for (int i = 1; i < cell.width; i++) {
-                data[dataSize++] = ' ';
-            }
-
-            colSize += cell.width;
-            pos.col += cell.width;
-        } else {
-            break;
-        }
+    const size_t capacity = values.size() / 2;
+    SearchMatch* found = new SearchMatch[capacity];
+    size_t count;
+    {
+        Mutex::Autolock lock(term->mReadLock);
+        count = search->nextLocked(term, found, capacity);
     }
 
-    env->SetIntField(run, cellRunDataSizeField, dataSize);
-    env->SetIntField(run, cellRunColSizeField, colSize);
-
-    return 0;
-}
-
-static jint com_android_terminal_Terminal_nativeGetRows(JNIEnv* env, jclass clazz, jlong ptr) {
-    Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->getRows();
-}
+    for (size_t i = 0; i < count; i++) {
+        values[i * 2] = found[i].line;
+        values[i * 2 + 1] = (jlong) found[i].col << 32 | found[i].cols;
+    }
+    delete[] found;
 
-static jint com_android_terminal_Terminal_nativeGetCols(JNIEnv* env, jclass clazz, jlong ptr) {
-    Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->getCols();
+    return (count == 0 && search->isDone()) ? -1 : count;
 }
 
-static jint com_android_terminal_Terminal_nativeGetScrollRows(JNIEnv* env, jclass clazz, jlong ptr) {
-    Terminal* term = reinterpret_cast<Terminal*>(ptr);
-    return term->getScrollRows();
+static void com_android_terminal_Terminal_nativeSearchDestroy(JNIEnv* env, jclass clazz,
+        jlong searchPtr) {
+    delete reinterpret_cast<TerminalSearch*>(searchPtr);
 }
 
 static jboolean com_android_terminal_Terminal_nativeDispatchCharacter(JNIEnv *env, jclass clazz,
@@ -727,18 +640,56 @@ static jboolean com_android_terminal_Terminal_nativeDispatchKey(JNIEnv *env, jcl
     return term->dispatchKey(mod, c);
 }
 
+static jboolean com_android_terminal_Terminal_nativeDispatchText(JNIEnv *env, jclass clazz,
+        jlong ptr, jstring text, jboolean paste) {
+    Terminal* term = reinterpret_cast<Terminal*>(ptr);
+    const jsize len = env->GetStringLength(text);
+    const jchar* chars = env->GetStringChars(text, NULL);
+    if (chars == NULL) {
+        return false;
+    }
+    bool res = term->dispatchText(chars, len, paste);
+    env->ReleaseStringChars(text, chars);
+    return res;
+}
+
 static JNINativeMethod gMethods[] = {
     { "nativeInit", "(Lcom/android/terminal/TerminalCallbacks;)J", (void*)com_android_terminal_Terminal_nativeInit },
     { "nativeDestroy", "(J)I", (void*)com_android_terminal_Terminal_nativeDestroy },
-    { "nativeRun", "(J)I", (void*)com_android_terminal_Terminal_nativeRun },
+    { "nativeSetCommand", "(JLjava/lang/String;[Ljava/lang/String;[Ljava/lang/String;)I", (void*)com_android_terminal_Terminal_nativeSetCommand },
+    { "nativeStart", "(J)I", (void*)com_android_terminal_Terminal_nativeStart },
     { "nativeResize", "(JIII)I", (void*)com_android_terminal_Terminal_nativeResize },
     { "nativeSetColors", "(JII)I", (void*)com_android_terminal_Terminal_nativeSetColors },
+    { "nativeSetFrameInterval", "(JI)V", (void*)com_android_terminal_Terminal_nativeSetFrameInterval },
+    { "nativeSetJumpScroll", "(JI)V", (void*)com_android_terminal_Terminal_nativeSetJumpScroll },
+    { "nativeSetInputQueueLimit", "(JI)V", (void*)com_android_terminal_Terminal_nativeSetInputQueueLimit },
+    { "nativeStartRecording", "(JLjava/lang/String;)I", (void*)com_android_terminal_Terminal_nativeStartRecording },
+    { "nativeStopRecording", "(J)V", (void*)com_android_terminal_Terminal_nativeStopRecording },
+    { "nativeIsRecording", "(J)Z", (void*)com_android_terminal_Terminal_nativeIsRecording },
+    { "nativeSetScrollbackSpill", "(JLjava/lang/String;I)I", (void*)com_android_terminal_Terminal_nativeSetScrollbackSpill },
+    { "nativeSetVisible", "(JZ)V", (void*)com_android_terminal_Terminal_nativeSetVisible },
+    { "nativeSetScrollbackBudget", "(J)V", (void*)com_android_terminal_Terminal_nativeSetScrollbackBudget },
+    { "nativeGetScrollbackBudgetUsed", "()J", (void*)com_android_terminal_Terminal_nativeGetScrollbackBudgetUsed },
+    { "nativeTrimMemory", "(I)V", (void*)com_android_terminal_Terminal_nativeTrimMemory },
     { "nativeGetCellRun", "(JIILcom/android/terminal/Terminal$CellRun;)I", (void*)com_android_terminal_Terminal_nativeGetCellRun },
+    { "nativeGetLineRuns", "(JJJILjava/nio/ByteBuffer;)I", (void*)com_android_terminal_Terminal_nativeGetLineRuns },
     { "nativeGetRows", "(J)I", (void*)com_android_terminal_Terminal_nativeGetRows },
     { "nativeGetCols", "(J)I", (void*)com_android_terminal_Terminal_nativeGetCols },
     { "nativeGetScrollRows", "(J)I", (void*)com_android_terminal_Terminal_nativeGetScrollRows },
+    { "nativeGetScrollbackLines", "(J)I", (void*)com_android_terminal_Terminal_nativeGetScrollbackLines },
+    { "nativeGetScrollbackBytesHeld", "(J)J", (void*)com_android_terminal_Terminal_nativeGetScrollbackBytesHeld },
+    { "nativeGetScrollbackBytesUsed", "(J)J", (void*)com_android_terminal_Terminal_nativeGetScrollbackBytesUsed },
+    { "nativeGetQueuedInput", "(J)J", (void*)com_android_terminal_Terminal_nativeGetQueuedInput },
+    { "nativeGetStats", "(J[J)I", (void*)com_android_terminal_Terminal_nativeGetStats },
+    { "nativeGetScreenLine", "(J)J", (void*)com_android_terminal_Terminal_nativeGetScreenLine },
+    { "nativeGetFirstLine", "(J)J", (void*)com_android_terminal_Terminal_nativeGetFirstLine },
+    { "nativeGetScrollOffset", "(J)J", (void*)com_android_terminal_Terminal_nativeGetScrollOffset },
+    { "nativeSearchStart", "(Ljava/lang/String;I)J", (void*)com_android_terminal_Terminal_nativeSearchStart },
+    { "nativeSearchNext", "(JJ[J)I", (void*)com_android_terminal_Terminal_nativeSearchNext },
+    { "nativeSearchDestroy", "(J)V", (void*)com_android_terminal_Terminal_nativeSearchDestroy },
     { "nativeDispatchCharacter", "(JII)Z", (void*)com_android_terminal_Terminal_nativeDispatchCharacter},
     { "nativeDispatchKey", "(JII)Z", (void*)com_android_terminal_Terminal_nativeDispatchKey },
+    { "nativeDispatchText", "(JLjava/lang/String;Z)Z", (void*)com_android_terminal_Terminal_nativeDispatchText },
 };
 
 int register_com_android_terminal_Terminal(JNIEnv* env) {
@@ -747,10 +698,8 @@ int register_com_android_terminal_Terminal(JNIEnv* env) {
 
     android::terminalCallbacksClass = reinterpret_cast<jclass>(env->NewGlobalRef(localClass.get()));
 
-    android::damageMethod = env->GetMethodID(terminalCallbacksClass, "damage", "(IIII)I");
-    android::moveRectMethod = env->GetMethodID(terminalCallbacksClass, "moveRect", "(IIIIIIII)I");
-    android::moveCursorMethod = env->GetMethodID(terminalCallbacksClass, "moveCursor",
-            "(IIIII)I");
+    android::damageRowsMethod = env->GetMethodID(terminalCallbacksClass, "damageRows",
+            "(II[IJJIII)I");
     android::setTermPropBooleanMethod = env->GetMethodID(terminalCallbacksClass,
             "setTermPropBoolean", "(IZ)I");
     android::setTermPropIntMethod = env->GetMethodID(terminalCallbacksClass, "setTermPropInt",
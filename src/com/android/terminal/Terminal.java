@@ -18,6 +18,10 @@ package com.android.terminal;
 
 import android.graphics.Color;
 
+import java.io.File;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
 /**
  * Single terminal session backed by a pseudo terminal on the local device.
  */
@@ -43,6 +47,7 @@ public class Terminal {
 
         boolean bold;
         int underline;
+        boolean italic;
         boolean blink;
         boolean reverse;
         boolean strike;
@@ -50,20 +55,354 @@ public class Terminal {
 
         int fg = Color.CYAN;
         int bg = Color.DKGRAY;
+
+        void clearAttrs() {
+            bold = false;
+            underline = 0;
+            italic = false;
+            blink = false;
+            reverse = false;
+            strike = false;
+            font = 0;
+        }
+    }
+
+    // Matches TerminalSearch::FLAG_IGNORE_CASE
+    private static final int SEARCH_IGNORE_CASE = 1 << 0;
+
+    /** Attribute bits reported by {@link #getLineRuns}, matching CellStyle.h */
+    private static final int ATTR_BOLD = 1 << 0;
+    private static final int ATTR_UNDERLINE_SHIFT = 1;
+    private static final int ATTR_UNDERLINE_MASK = 3 << ATTR_UNDERLINE_SHIFT;
+    private static final int ATTR_ITALIC = 1 << 3;
+    private static final int ATTR_BLINK = 1 << 4;
+    private static final int ATTR_REVERSE = 1 << 5;
+    private static final int ATTR_STRIKE = 1 << 6;
+    private static final int ATTR_FONT_SHIFT = 7;
+    private static final int ATTR_FONT_MASK = 0xf << ATTR_FONT_SHIFT;
+
+    /**
+     * Counters for the native output path of a session, filled by
+     * {@link Terminal#getStats}. Times are in nanoseconds.
+     */
+    public static class Stats {
+        /** Read batches by size: <64, <256, <1K, <4K, <16K, <64K, <256K, larger */
+        public static final int BATCH_BUCKETS = 8;
+
+        // Indices of values reported by nativeGetStats, matching TerminalStats.h
+        private static final int STAT_UPTIME_NS = 0;
+        private static final int STAT_BYTES_READ = 1;
+        private static final int STAT_READ_CALLS = 2;
+        private static final int STAT_READ_BATCHES = 3;
+        private static final int STAT_BATCH_HISTOGRAM = 4;
+        private static final int STAT_BYTES_PARSED = 12;
+        private static final int STAT_PARSE_NS = 13;
+        private static final int STAT_DAMAGE_CALLBACKS = 14;
+        private static final int STAT_MOVERECT_CALLBACKS = 15;
+        private static final int STAT_CURSOR_CALLBACKS = 16;
+        private static final int STAT_DAMAGE_DELIVERIES = 17;
+        private static final int STAT_CELL_RUN_CALLS = 18;
+        private static final int STAT_ROW_RUNS_CALLS = 19;
+        private static final int STAT_LOCK_ACQUISITIONS = 20;
+        private static final int STAT_LOCK_WAIT_NS = 21;
+        private static final int STAT_LOCK_MAX_WAIT_NS = 22;
+        private static final int STAT_LOCK_HOLD_NS = 23;
+        private static final int STAT_LOCK_MAX_HOLD_NS = 24;
+        private static final int STAT_SCROLLBACK_LINES = 25;
+        private static final int STAT_SCROLLBACK_BYTES_USED = 26;
+        private static final int STAT_SCROLLBACK_BYTES_HELD = 27;
+        private static final int STAT_SCROLL_CACHE_HITS = 28;
+        private static final int STAT_SCROLL_CACHE_MISSES = 29;
+        private static final int STAT_SPILL_LINES = 30;
+        private static final int STAT_SPILL_FILE_BYTES = 31;
+        private static final int STAT_JUMP_SCROLLS = 32;
+        private static final int STAT_JUMP_FRAMES = 33;
+        private static final int STAT_BYTES_WRITTEN = 34;
+        private static final int STAT_QUEUED_INPUT = 35;
+        private static final int STAT_MAX_QUEUED_INPUT = 36;
+        private static final int STAT_WRITES_REFUSED = 37;
+        private static final int STAT_REFLOW_ROWS = 38;
+        private static final int STAT_READ_PAUSES = 39;
+        private static final int STAT_BUDGET_TRIMS = 40;
+        private static final int STAT_UNCHANGED_ROWS = 41;
+        private static final int STAT_SHIFTED_ROWS = 42;
+        private static final int STAT_COUNT = 43;
+
+        final long[] values = new long[STAT_COUNT];
+
+        public long getUptimeNanos() { return values[STAT_UPTIME_NS]; }
+        public long getBytesRead() { return values[STAT_BYTES_READ]; }
+        public long getReadCalls() { return values[STAT_READ_CALLS]; }
+        public long getReadBatches() { return values[STAT_READ_BATCHES]; }
+        public long getBatchCount(int bucket) { return values[STAT_BATCH_HISTOGRAM + bucket]; }
+        public long getBytesParsed() { return values[STAT_BYTES_PARSED]; }
+        public long getParseNanos() { return values[STAT_PARSE_NS]; }
+        public long getDamageCallbacks() { return values[STAT_DAMAGE_CALLBACKS]; }
+        public long getMoveRectCallbacks() { return values[STAT_MOVERECT_CALLBACKS]; }
+        public long getCursorCallbacks() { return values[STAT_CURSOR_CALLBACKS]; }
+        public long getDamageDeliveries() { return values[STAT_DAMAGE_DELIVERIES]; }
+        public long getCellRunCalls() { return values[STAT_CELL_RUN_CALLS]; }
+        public long getRowRunsCalls() { return values[STAT_ROW_RUNS_CALLS]; }
+        public long getLockAcquisitions() { return values[STAT_LOCK_ACQUISITIONS]; }
+        public long getLockWaitNanos() { return values[STAT_LOCK_WAIT_NS]; }
+        public long getLockMaxWaitNanos() { return values[STAT_LOCK_MAX_WAIT_NS]; }
+        public long getLockHoldNanos() { return values[STAT_LOCK_HOLD_NS]; }
+        public long getLockMaxHoldNanos() { return values[STAT_LOCK_MAX_HOLD_NS]; }
+        public long getScrollbackLines() { return values[STAT_SCROLLBACK_LINES]; }
+        public long getScrollbackBytesUsed() { return values[STAT_SCROLLBACK_BYTES_USED]; }
+        public long getScrollbackBytesHeld() { return values[STAT_SCROLLBACK_BYTES_HELD]; }
+        public long getScrollCacheHits() { return values[STAT_SCROLL_CACHE_HITS]; }
+        public long getScrollCacheMisses() { return values[STAT_SCROLL_CACHE_MISSES]; }
+        public long getSpillLines() { return values[STAT_SPILL_LINES]; }
+        public long getSpillFileBytes() { return values[STAT_SPILL_FILE_BYTES]; }
+        public long getJumpScrolls() { return values[STAT_JUMP_SCROLLS]; }
+        public long getJumpFrames() { return values[STAT_JUMP_FRAMES]; }
+        public long getBytesWritten() { return values[STAT_BYTES_WRITTEN]; }
+        public long getQueuedInput() { return values[STAT_QUEUED_INPUT]; }
+        public long getMaxQueuedInput() { return values[STAT_MAX_QUEUED_INPUT]; }
+        public long getWritesRefused() { return values[STAT_WRITES_REFUSED]; }
+        public long getReflowRows() { return values[STAT_REFLOW_ROWS]; }
+        public long getReadPauses() { return values[STAT_READ_PAUSES]; }
+        public long getBudgetTrims() { return values[STAT_BUDGET_TRIMS]; }
+        public long getUnchangedRows() { return values[STAT_UNCHANGED_ROWS]; }
+        public long getShiftedRows() { return values[STAT_SHIFTED_ROWS]; }
+
+        /**
+         * Bytes parsed per second of time spent inside the parser.
+         */
+        public long getParseBytesPerSecond() {
+            final long nanos = getParseNanos();
+            return nanos > 0 ? getBytesParsed() * 1000000000L / nanos : 0;
+        }
+
+        @Override
+        public String toString() {
+            final StringBuilder builder = new StringBuilder("Stats{");
+            builder.append("read=").append(getBytesRead()).append("B/")
+                    .append(getReadCalls()).append(" calls/")
+                    .append(getReadBatches()).append(" batches [");
+            for (int i = 0; i < BATCH_BUCKETS; i++) {
+                builder.append(i == 0 ? "" : " ").append(getBatchCount(i));
+            }
+            builder.append("], readPauses=").append(getReadPauses())
+                    .append(", parse=").append(getParseBytesPerSecond()).append("B/s")
+                    .append(", damage=").append(getDamageCallbacks())
+                    .append(", moverect=").append(getMoveRectCallbacks())
+                    .append(", cursor=").append(getCursorCallbacks())
+                    .append(", delivered=").append(getDamageDeliveries())
+                    .append(", cellRuns=").append(getCellRunCalls())
+                    .append(", rowRuns=").append(getRowRunsCalls())
+                    .append(", lock=").append(getLockAcquisitions())
+                    .append(" wait=").append(getLockWaitNanos() / 1000).append("us")
+                    .append(" (max ").append(getLockMaxWaitNanos() / 1000).append("us)")
+                    .append(" hold=").append(getLockHoldNanos() / 1000).append("us")
+                    .append(" (max ").append(getLockMaxHoldNanos() / 1000).append("us)")
+                    .append(", scrollback=").append(getScrollbackLines()).append(" lines/")
+                    .append(getScrollbackBytesUsed()).append("B")
+                    .append(", scrollCache=").append(getScrollCacheHits()).append("/")
+                    .append(getScrollCacheHits() + getScrollCacheMisses())
+                    .append(", spilled=").append(getSpillLines()).append(" lines/")
+                    .append(getSpillFileBytes()).append("B")
+                    .append(", jumpScrolls=").append(getJumpScrolls())
+                    .append(" (").append(getJumpFrames()).append(" frames)")
+                    .append(", written=").append(getBytesWritten()).append("B")
+                    .append(", queued=").append(getQueuedInput()).append("B")
+                    .append(" (max ").append(getMaxQueuedInput()).append("B)")
+                    .append(", refused=").append(getWritesRefused())
+                    .append(", reflowed=").append(getReflowRows()).append(" rows")
+                    .append(", budgetTrims=").append(getBudgetTrims())
+                    .append(", unchangedRows=").append(getUnchangedRows())
+                    .append(", shiftedRows=").append(getShiftedRows()).append("}");
+            return builder.toString();
+        }
+    }
+
+    /**
+     * Every {@link CellRun} of a range of lines, captured from one frame with
+     * a single native call and unpacked on demand.
+     */
+    public static class RowRuns {
+        private static final int RUN_HEADER_INTS = 6;
+
+        final int maxRunChars;
+
+        ByteBuffer buffer = ByteBuffer.allocateDirect(16 * 1024).order(ByteOrder.nativeOrder());
+        long startLine;
+        long endLine;
+        int[] rowOffsets = new int[0];
+
+        /** Row of the captured frame the line found by {@link #seekLine} was on */
+        int row;
+
+        private int mOffset;
+        private int mRemaining;
+
+        public RowRuns(int maxRunChars) {
+            this.maxRunChars = maxRunChars;
+        }
+
+        void index(long startLine, long endLine) {
+            this.startLine = startLine;
+            this.endLine = endLine;
+            final int count = (int) (endLine - startLine);
+            if (rowOffsets.length < count) {
+                rowOffsets = new int[count];
+            }
+
+            int offset = 0;
+            for (int i = 0; i < count; i++) {
+                rowOffsets[i] = offset;
+                int runCount = buffer.getInt(offset + 4);
+                offset += 8;
+                for (int j = 0; j < runCount; j++) {
+                    final int dataSize = buffer.getInt(offset + 20);
+                    offset += RUN_HEADER_INTS * 4 + ((dataSize * 2 + 3) & ~3);
+                }
+            }
+        }
+
+        /**
+         * Forget captured rows, so later lookups fall back to the terminal.
+         */
+        public void clear() {
+            startLine = 0;
+            endLine = 0;
+            mRemaining = 0;
+        }
+
+        /**
+         * Position at the first run of the given line, returning false if the
+         * line isn't part of this snapshot.
+         */
+        public boolean seekLine(long line) {
+            if (line < startLine || line >= endLine) {
+                mRemaining = 0;
+                return false;
+            }
+            final int offset = rowOffsets[(int) (line - startLine)];
+            row = buffer.getInt(offset);
+            mRemaining = buffer.getInt(offset + 4);
+            mOffset = offset + 8;
+            return true;
+        }
+
+        /**
+         * Unpack the next run of the current row into {@code run}, returning
+         * false once the row is exhausted.
+         */
+        public boolean nextRun(CellRun run) {
+            if (mRemaining == 0) {
+                return false;
+            }
+            mRemaining--;
+
+            final ByteBuffer b = buffer;
+            int offset = mOffset;
+            run.colSize = b.getInt(offset + 4);
+            run.fg = b.getInt(offset + 8);
+            run.bg = b.getInt(offset + 12);
+            final int attrs = b.getInt(offset + 16);
+            run.dataSize = b.getInt(offset + 20);
+            offset += RUN_HEADER_INTS * 4;
+
+            run.bold = (attrs & ATTR_BOLD) != 0;
+            run.underline = (attrs & ATTR_UNDERLINE_MASK) >> ATTR_UNDERLINE_SHIFT;
+            run.italic = (attrs & ATTR_ITALIC) != 0;
+            run.blink = (attrs & ATTR_BLINK) != 0;
+            run.reverse = (attrs & ATTR_REVERSE) != 0;
+            run.strike = (attrs & ATTR_STRIKE) != 0;
+            run.font = (attrs & ATTR_FONT_MASK) >> ATTR_FONT_SHIFT;
+
+            if (run.data == null || run.data.length < run.dataSize) {
+                run.data = new char[run.dataSize];
+            }
+            for (int i = 0; i < run.dataSize; i++) {
+                run.data[i] = b.getChar(offset + i * 2);
+            }
+
+            mOffset = offset + ((run.dataSize * 2 + 3) & ~3);
+            return true;
+        }
+    }
+
+    /**
+     * Incremental search over scrollback and the screen, from the newest line
+     * towards the oldest. Matches are reported in chunks by {@link #next()},
+     * identified by absolute line numbers; see {@link Terminal#getScreenLine()}
+     * for turning them into rows. Must be closed when no longer needed.
+     */
+    public class Search {
+        private static final int MAX_MATCHES = 64;
+
+        private final long[] mMatches = new long[MAX_MATCHES * 2];
+        private long mSearchPtr;
+        private int mCount;
+
+        private Search(long searchPtr) {
+            mSearchPtr = searchPtr;
+        }
+
+        /**
+         * Scan the next stretch of history, returning false once all of it
+         * has been covered. Any matches found are available through
+         * {@link #getMatchCount()}, and there may be none even when this
+         * returns true.
+         */
+        public boolean next() {
+            if (mSearchPtr == 0) {
+                throw new IllegalStateException("search closed");
+            }
+            final int count = nativeSearchNext(mNativePtr, mSearchPtr, mMatches);
+            mCount = Math.max(count, 0);
+            return count >= 0;
+        }
+
+        public int getMatchCount() {
+            return mCount;
+        }
+
+        public long getMatchLine(int index) {
+            return mMatches[index * 2];
+        }
+
+        public int getMatchCol(int index) {
+            return (int) (mMatches[index * 2 + 1] >>> 32);
+        }
+
+        public int getMatchColSize(int index) {
+            return (int) mMatches[index * 2 + 1];
+        }
+
+        public void close() {
+            if (mSearchPtr != 0) {
+                nativeSearchDestroy(mSearchPtr);
+                mSearchPtr = 0;
+            }
+        }
     }
 
     // NOTE: clients must not call back into terminal while handling a callback,
     // since native mutex isn't reentrant.
     public interface TerminalClient {
-        public void onDamage(int startRow, int endRow, int startCol, int endCol);
-        public void onMoveRect(int destStartRow, int destEndRow, int destStartCol, int destEndCol,
-                int srcStartRow, int srcEndRow, int srcStartCol, int srcEndCol);
+        /**
+         * A frame is being delivered whose screen row 0 is line
+         * {@code screenLine}, and which had scrolled {@code scrollOffset}
+         * rows in total. Rows passed to the {@link #onDamage} and
+         * {@link #onMoveCursor} calls that follow are rows of this frame.
+         * Rows that only moved with a scroll since the previous frame aren't
+         * reported as damage.
+         */
+        public void onFrame(long screenLine, long scrollOffset);
+        /**
+         * Rows changed since the last call, in the bitmap form described by
+         * {@link TerminalCallbacks#damageRows}.
+         */
+        public void onDamage(int startRow, int endRow, int[] dirtyRows);
         public void onMoveCursor(int posRow, int posCol, int oldPosRow, int oldPosCol, int visible);
         public void onBell();
     }
 
     private final long mNativePtr;
-    private final Thread mThread;
 
     private String mTitle;
 
@@ -75,30 +414,26 @@ public class Terminal {
 
     private final TerminalCallbacks mCallbacks = new TerminalCallbacks() {
         @Override
-        public int damage(int startRow, int endRow, int startCol, int endCol) {
-            if (mClient != null) {
-                mClient.onDamage(startRow, endRow, startCol, endCol);
-            }
-            return 1;
-        }
-
-        @Override
-        public int moveRect(int destStartRow, int destEndRow, int destStartCol, int destEndCol,
-                int srcStartRow, int srcEndRow, int srcStartCol, int srcEndCol) {
-            if (mClient != null) {
-                mClient.onMoveRect(destStartRow, destEndRow, destStartCol, destEndCol, srcStartRow,
-                        srcEndRow, srcStartCol, srcEndCol);
-            }
-            return 1;
-        }
+        public int damageRows(int startRow, int endRow, int[] dirtyRows, long screenLine,
+                long scrollOffset, int cursorRow, int cursorCol, int cursorVisible) {
+            final boolean visible = (cursorVisible != 0);
+            final boolean cursorChanged = (visible != mCursorVisible || cursorRow != mCursorRow
+                    || cursorCol != mCursorCol);
+            final int oldCursorRow = mCursorRow;
+            final int oldCursorCol = mCursorCol;
+            mCursorVisible = visible;
+            mCursorRow = cursorRow;
+            mCursorCol = cursorCol;
 
-        @Override
-        public int moveCursor(int posRow, int posCol, int oldPosRow, int oldPosCol, int visible) {
-            mCursorVisible = (visible != 0);
-            mCursorRow = posRow;
-            mCursorCol = posCol;
             if (mClient != null) {
-                mClient.onMoveCursor(posRow, posCol, oldPosRow, oldPosCol, visible);
+                mClient.onFrame(screenLine, scrollOffset);
+                if (startRow < endRow) {
+                    mClient.onDamage(startRow, endRow, dirtyRows);
+                }
+                if (cursorChanged) {
+                    mClient.onMoveCursor(cursorRow, cursorCol, oldCursorRow, oldCursorCol,
+                            cursorVisible);
+                }
             }
             return 1;
         }
@@ -116,19 +451,30 @@ public class Terminal {
         mNativePtr = nativeInit(mCallbacks);
         key = sNumber++;
         mTitle = TAG + " " + key;
-        mThread = new Thread(mTitle) {
-            @Override
-            public void run() {
-                nativeRun(mNativePtr);
-            }
-        };
     }
 
     /**
-     * Start thread which internally forks and manages the pseudo terminal.
+     * Run {@code path} instead of the default shell once started, with the
+     * given arguments and {@code NAME=value} environment. A null
+     * {@code path} goes back to the default shell, a null {@code argv}
+     * passes just {@code path}, and a null {@code env} keeps the app's
+     * environment. Must be called before {@link #start}.
+     */
+    public void setCommand(String path, String[] argv, String[] env) {
+        if (nativeSetCommand(mNativePtr, path, argv, env) != 0) {
+            throw new IllegalStateException("setCommand failed");
+        }
+    }
+
+    /**
+     * Spawn the shell and start servicing its pseudo terminal. Output from
+     * every session is read by one shared native thread and parsed by
+     * another.
      */
     public void start() {
-        mThread.start();
+        if (nativeStart(mNativePtr) != 0) {
+            throw new IllegalStateException("start failed");
+        }
     }
 
     public void destroy() {
@@ -137,8 +483,13 @@ public class Terminal {
         }
     }
 
+    /**
+     * Attach the client showing this session, or detach it with null. Only
+     * sessions without a client give up scrollback to the shared budget.
+     */
     public void setClient(TerminalClient client) {
         mClient = client;
+        nativeSetVisible(mNativePtr, client != null);
     }
 
     public void resize(int rows, int cols, int scrollRows) {
@@ -153,6 +504,97 @@ public class Terminal {
         }
     }
 
+    /**
+     * Set the minimum time between damage notifications while output is
+     * streaming. Output arriving after an idle period is always reported
+     * immediately. Zero reports damage after every read.
+     */
+    public void setFrameInterval(int millis) {
+        nativeSetFrameInterval(mNativePtr, millis);
+    }
+
+    /**
+     * Switch to jump scrolling whenever output arrives faster than
+     * {@code bytesPerFrame} per frame interval. Intermediate screen states
+     * are skipped, and each frame repaints the whole screen once. Zero
+     * disables it.
+     */
+    public void setJumpScroll(int bytesPerFrame) {
+        nativeSetJumpScroll(mNativePtr, bytesPerFrame);
+    }
+
+    /**
+     * Limit how much input may wait for the child to read it. Input that
+     * would go past the limit is refused, and the dispatch methods return
+     * false for it.
+     */
+    public void setInputQueueLimit(int bytes) {
+        nativeSetInputQueueLimit(mNativePtr, bytes);
+    }
+
+    /**
+     * Bytes of input written by us but not yet read by the child.
+     */
+    public long getQueuedInput() {
+        return nativeGetQueuedInput(mNativePtr);
+    }
+
+    /**
+     * Keep only the newest {@code hotRows} lines of scrollback in memory,
+     * spilling older history to a file under {@code dir}. Pass a null
+     * {@code dir} to keep everything in memory again.
+     */
+    public void setScrollbackSpill(File dir, int hotRows) {
+        final String path = (dir != null) ? dir.getAbsolutePath() : null;
+        if (nativeSetScrollbackSpill(mNativePtr, path, hotRows) != 0) {
+            throw new IllegalStateException("setScrollbackSpill failed");
+        }
+    }
+
+    /**
+     * Limit the native memory held by scrollback across all sessions. When
+     * it runs over, sessions that aren't shown lose in-memory history, least
+     * recently shown first; spilled sessions keep it on disk instead. A
+     * lower limit is applied on the native parse thread, not by this call.
+     */
+    public static void setScrollbackBudget(long bytes) {
+        nativeSetScrollbackBudget(bytes);
+    }
+
+    /**
+     * Bytes of scrollback currently counted against the shared budget.
+     */
+    public static long getScrollbackBudgetUsed() {
+        return nativeGetScrollbackBudgetUsed();
+    }
+
+    /**
+     * Release scrollback memory in response to
+     * {@link android.content.ComponentCallbacks2#onTrimMemory}. Returns
+     * right away; sessions are trimmed on the native parse thread.
+     */
+    public static void trimMemory(int level) {
+        nativeTrimMemory(level);
+    }
+
+    /**
+     * Record raw output of this session to {@code file}, which can be
+     * replayed with the native terminal_bench tool.
+     */
+    public void startRecording(File file) {
+        if (nativeStartRecording(mNativePtr, file.getAbsolutePath()) != 0) {
+            throw new IllegalStateException("startRecording failed");
+        }
+    }
+
+    public void stopRecording() {
+        nativeStopRecording(mNativePtr);
+    }
+
+    public boolean isRecording() {
+        return nativeIsRecording(mNativePtr);
+    }
+
     public int getRows() {
         return nativeGetRows(mNativePtr);
     }
@@ -165,12 +607,98 @@ public class Terminal {
         return nativeGetScrollRows(mNativePtr);
     }
 
+    /**
+     * Scrollback rows the session actually holds right now, at most
+     * {@link #getScrollRows()}. Grows as output scrolls off the screen and
+     * shrinks when history is trimmed.
+     */
+    public int getScrollbackLines() {
+        return nativeGetScrollbackLines(mNativePtr);
+    }
+
+    /**
+     * Bytes of native memory held for scrollback, including free space kept
+     * around for recycling lines.
+     */
+    public long getScrollbackBytesHeld() {
+        return nativeGetScrollbackBytesHeld(mNativePtr);
+    }
+
+    /**
+     * Bytes of native memory occupied by live scrollback lines.
+     */
+    public long getScrollbackBytesUsed() {
+        return nativeGetScrollbackBytesUsed(mNativePtr);
+    }
+
+    /**
+     * Fill {@code stats} with the current counters of this session.
+     */
+    public void getStats(Stats stats) {
+        if (nativeGetStats(mNativePtr, stats.values) < 0) {
+            throw new IllegalStateException("getStats failed");
+        }
+    }
+
+    /**
+     * Absolute line number of screen row 0 in the latest published frame.
+     * Row {@code r} holds line {@code getScreenLine() + r}, and scrollback
+     * rows are negative offsets from it.
+     */
+    public long getScreenLine() {
+        return nativeGetScreenLine(mNativePtr);
+    }
+
+    /**
+     * Absolute line number of the oldest scrollback line still held. Lines
+     * from here up to {@link #getScreenLine()} are scrollback.
+     */
+    public long getFirstLine() {
+        return nativeGetFirstLine(mNativePtr);
+    }
+
+    /**
+     * Rows the whole screen had scrolled up in total as of the latest
+     * published frame. Only ever grows, unlike {@link #getScreenLine()},
+     * and counts scrolling with no scrollback such as on the alternate
+     * screen.
+     */
+    public long getScrollOffset() {
+        return nativeGetScrollOffset(mNativePtr);
+    }
+
+    /**
+     * Start searching history for {@code pattern} as a literal string.
+     */
+    public Search search(String pattern, boolean ignoreCase) {
+        return new Search(nativeSearchStart(pattern, ignoreCase ? SEARCH_IGNORE_CASE : 0));
+    }
+
     public void getCellRun(int row, int col, CellRun run) {
         if (nativeGetCellRun(mNativePtr, row, col, run) != 0) {
             throw new IllegalStateException("getCell failed");
         }
     }
 
+    /**
+     * Capture every run of absolute lines {@code [startLine, endLine)} into
+     * {@code runs} using one native call, growing its buffer as needed.
+     * Lines are looked up in a single frame, and ones no longer held come
+     * back blank.
+     */
+    public void getLineRuns(long startLine, long endLine, RowRuns runs) {
+        while (true) {
+            final int size = nativeGetLineRuns(mNativePtr, startLine, endLine, runs.maxRunChars,
+                    runs.buffer);
+            if (size >= 0) {
+                break;
+            }
+            runs.buffer = ByteBuffer.allocateDirect(runs.buffer.capacity() * 2)
+                    .order(ByteOrder.nativeOrder());
+        }
+        runs.index(startLine, endLine);
+    }
+
     public boolean getCursorVisible() {
         return mCursorVisible;
     }
@@ -196,17 +724,59 @@ public class Terminal {
         return nativeDispatchCharacter(mNativePtr, modifiers, character);
     }
 
+    /**
+     * Send a run of typed text in one go, instead of a character at a time.
+     */
+    public boolean dispatchText(String text) {
+        return nativeDispatchText(mNativePtr, text, false);
+    }
+
+    /**
+     * Send pasted text, bracketed if the application asked for it so it can
+     * tell a paste apart from typing.
+     */
+    public boolean paste(String text) {
+        return nativeDispatchText(mNativePtr, text, true);
+    }
+
     private static native long nativeInit(TerminalCallbacks callbacks);
     private static native int nativeDestroy(long ptr);
 
-    private static native int nativeRun(long ptr);
+    private static native int nativeSetCommand(long ptr, String path, String[] argv,
+            String[] env);
+    private static native int nativeStart(long ptr);
     private static native int nativeResize(long ptr, int rows, int cols, int scrollRows);
     private static native int nativeSetColors(long ptr, int fg, int bg);
+    private static native void nativeSetFrameInterval(long ptr, int millis);
+    private static native void nativeSetJumpScroll(long ptr, int bytesPerFrame);
+    private static native void nativeSetInputQueueLimit(long ptr, int bytes);
+    private static native int nativeSetScrollbackSpill(long ptr, String dir, int hotRows);
+    private static native void nativeSetVisible(long ptr, boolean visible);
+    private static native void nativeSetScrollbackBudget(long bytes);
+    private static native long nativeGetScrollbackBudgetUsed();
+    private static native void nativeTrimMemory(int level);
+    private static native int nativeStartRecording(long ptr, String path);
+    private static native void nativeStopRecording(long ptr);
+    private static native boolean nativeIsRecording(long ptr);
     private static native int nativeGetCellRun(long ptr, int row, int col, CellRun run);
+    private static native int nativeGetLineRuns(long ptr, long startLine, long endLine,
+            int maxRunChars, ByteBuffer buffer);
     private static native int nativeGetRows(long ptr);
     private static native int nativeGetCols(long ptr);
     private static native int nativeGetScrollRows(long ptr);
+    private static native int nativeGetScrollbackLines(long ptr);
+    private static native long nativeGetScrollbackBytesHeld(long ptr);
+    private static native long nativeGetScrollbackBytesUsed(long ptr);
+    private static native long nativeGetQueuedInput(long ptr);
+    private static native int nativeGetStats(long ptr, long[] stats);
+    private static native long nativeGetScreenLine(long ptr);
+    private static native long nativeGetFirstLine(long ptr);
+    private static native long nativeGetScrollOffset(long ptr);
+    private static native long nativeSearchStart(String pattern, int flags);
+    private static native int nativeSearchNext(long ptr, long searchPtr, long[] matches);
+    private static native void nativeSearchDestroy(long searchPtr);
 
     private static native boolean nativeDispatchKey(long ptr, int modifiers, int key);
     private static native boolean nativeDispatchCharacter(long ptr, int modifiers, int character);
+    private static native boolean nativeDispatchText(long ptr, String text, boolean paste);
 }
@@ -21,6 +21,8 @@ import static com.android.terminal.Terminal.TAG;
 import android.Manifest;
 import android.animation.LayoutTransition;
 import android.app.Activity;
+import android.content.ClipData;
+import android.content.ClipboardManager;
 import android.content.ComponentName;
 import android.content.Context;
 import android.content.Intent;
@@ -43,8 +45,11 @@ import android.view.Menu;
 import android.view.MenuItem;
 import android.view.View;
 import android.view.ViewGroup;
+import android.widget.Toast;
 import android.widget.Toolbar;
 
+import java.io.File;
+
 /**
  * Activity that displays all {@link Terminal} instances running in a bound
  * {@link TerminalService}.
@@ -54,6 +59,7 @@ public class TerminalActivity extends Activity {
     private TerminalService mService;
 
     private ViewPager mPager;
+    private File mRecordingFile;
     private PagerTitleStrip mTitles;
 
     private final ServiceConnection mServiceConn = new ServiceConnection() {
@@ -240,6 +246,13 @@ public class TerminalActivity extends Activity {
         unbindService(mServiceConn);
     }
 
+    private Terminal getCurrentTerminal() {
+        if (mService == null || mTermAdapter.getCount() == 0) {
+            return null;
+        }
+        return mService.getTerminals().valueAt(mPager.getCurrentItem());
+    }
+
     @Override
     public boolean onCreateOptionsMenu(Menu menu) {
         getMenuInflater().inflate(R.menu.activity, menu);
@@ -250,6 +263,15 @@ public class TerminalActivity extends Activity {
     public boolean onPrepareOptionsMenu(Menu menu) {
         super.onPrepareOptionsMenu(menu);
         menu.findItem(R.id.menu_close_tab).setEnabled(mTermAdapter.getCount() > 0);
+
+        final Terminal term = getCurrentTerminal();
+        final MenuItem record = menu.findItem(R.id.menu_record_session);
+        record.setEnabled(term != null);
+        record.setChecked(term != null && term.isRecording());
+
+        final ClipboardManager clipboard =
+                (ClipboardManager) getSystemService(Context.CLIPBOARD_SERVICE);
+        menu.findItem(R.id.menu_paste).setEnabled(term != null && clipboard.hasPrimaryClip());
         return true;
     }
 
@@ -272,6 +294,38 @@ public class TerminalActivity extends Activity {
                 invalidateOptionsMenu();
                 return true;
             }
+            case R.id.menu_paste: {
+                final Terminal term = getCurrentTerminal();
+                final ClipboardManager clipboard =
+                        (ClipboardManager) getSystemService(Context.CLIPBOARD_SERVICE);
+                final ClipData clip = clipboard.getPrimaryClip();
+                if (term != null && clip != null && clip.getItemCount() > 0) {
+                    final CharSequence text = clip.getItemAt(0).coerceToText(this);
+                    term.paste(text.toString());
+                }
+                return true;
+            }
+            case R.id.menu_record_session: {
+                final Terminal term = getCurrentTerminal();
+                if (term == null) {
+                    return true;
+                }
+                if (term.isRecording()) {
+                    term.stopRecording();
+                    Toast.makeText(this, getString(R.string.recording_saved, mRecordingFile),
+                            Toast.LENGTH_LONG).show();
+                } else {
+                    mRecordingFile = new File(getExternalFilesDir(null),
+                            "session-" + System.currentTimeMillis() + ".vtrec");
+                    try {
+                        term.startRecording(mRecordingFile);
+                    } catch (IllegalStateException e) {
+                        Log.w(TAG, "Failed to start recording", e);
+                    }
+                }
+                invalidateOptionsMenu();
+                return true;
+            }
             case R.id.menu_item_settings: {
                 startActivity(new Intent(TerminalActivity.this, TerminalSettingsActivity.class));
                 return true;
@@ -17,16 +17,17 @@
 package com.android.terminal;
 
 public abstract class TerminalCallbacks {
-    public int damage(int startRow, int endRow, int startCol, int endCol) {
-        return 1;
-    }
-
-    public int moveRect(int destStartRow, int destEndRow, int destStartCol, int destEndCol,
-            int srcStartRow, int srcEndRow, int srcStartCol, int srcEndCol) {
-        return 1;
-    }
-
-    public int moveCursor(int posRow, int posCol, int oldPosRow, int oldPosCol, int visible) {
+    /**
+     * All damage collected while processing one batch of output, for the
+     * frame whose row 0 is line {@code screenLine} and which had scrolled
+     * {@code scrollOffset} rows in total. Rows that only moved with the
+     * scroll since the previous call aren't reported. On top of that, row
+     * {@code r} changed when bit {@code r % 32} of {@code dirtyRows[r / 32]}
+     * is set; only rows in {@code [startRow, endRow)} can be set. The array
+     * is reused by native code, so copy anything needed after returning.
+     */
+    public int damageRows(int startRow, int endRow, int[] dirtyRows, long screenLine,
+            long scrollOffset, int cursorRow, int cursorCol, int cursorVisible) {
         return 1;
     }
 
@@ -24,14 +24,15 @@ import android.graphics.Color;
 import android.util.Log;
 import android.view.View;
 
+import com.android.terminal.Terminal.CellRun;
 import com.android.terminal.TerminalView.TerminalMetrics;
 
 /**
  * Rendered contents of a single line of a {@link Terminal} session.
  */
 public class TerminalLineView extends View {
-    public int pos;
-    public int row;
+    /** Absolute line shown, as numbered by {@link Terminal#getScreenLine()} */
+    public long line;
     public int cols;
 
     private final Terminal mTerm;
@@ -61,27 +62,23 @@ public class TerminalLineView extends View {
 
         final TerminalMetrics m = mMetrics;
 
-        int col;
-        for (col = 0; col < cols;) {
-            mTerm.getCellRun(row, col, m.run);
-
-            m.bgPaint.setColor(m.run.bg);
-            m.textPaint.setColor(m.run.fg);
-
-            final int x = col * m.charWidth;
-            final int xEnd = x + (m.run.colSize * m.charWidth);
-
-            canvas.save();
-            canvas.translate(x, 0);
-            canvas.clipRect(0, 0, m.run.colSize * m.charWidth, m.charHeight);
-
-            canvas.drawPaint(m.bgPaint);
-            canvas.drawPosText(m.run.data, 0, m.run.dataSize, m.pos, m.textPaint);
-
-            canvas.restore();
+        // Runs are usually captured for every visible line at once; one
+        // redrawn on its own captures just itself
+        final boolean alone = !m.rowRuns.seekLine(line);
+        if (alone) {
+            mTerm.getLineRuns(line, line + 1, m.rowRuns);
+            m.rowRuns.seekLine(line);
+        }
+        final int row = m.rowRuns.row;
 
+        int col;
+        for (col = 0; col < cols && m.rowRuns.nextRun(m.run);) {
+            drawRun(canvas, col);
             col += m.run.colSize;
         }
+        if (alone) {
+            m.rowRuns.clear();
+        }
 
         if (mTerm.getCursorVisible() && mTerm.getCursorRow() == row) {
             col = mTerm.getCursorCol();
@@ -92,4 +89,27 @@ public class TerminalLineView extends View {
         }
 
     }
+
+    private void drawRun(Canvas canvas, int col) {
+        final TerminalMetrics m = mMetrics;
+        final CellRun run = m.run;
+
+        m.bgPaint.setColor(run.reverse ? run.fg : run.bg);
+        m.textPaint.setColor(run.reverse ? run.bg : run.fg);
+        m.textPaint.setFakeBoldText(run.bold);
+        m.textPaint.setUnderlineText(run.underline != 0);
+        m.textPaint.setStrikeThruText(run.strike);
+        m.textPaint.setTextSkewX(run.italic ? -0.25f : 0);
+
+        final int x = col * m.charWidth;
+
+        canvas.save();
+        canvas.translate(x, 0);
+        canvas.clipRect(0, 0, run.colSize * m.charWidth, m.charHeight);
+
+        canvas.drawPaint(m.bgPaint);
+        canvas.drawPosText(run.data, 0, run.dataSize, m.pos, m.textPaint);
+
+        canvas.restore();
+    }
 }
@@ -16,10 +16,15 @@
 
 package com.android.terminal;
 
+import static com.android.terminal.Terminal.TAG;
+
+import android.app.ActivityManager;
 import android.app.Service;
+import android.content.Context;
 import android.content.Intent;
 import android.os.Binder;
 import android.os.IBinder;
+import android.util.Log;
 import android.util.SparseArray;
 
 /**
@@ -27,8 +32,29 @@ import android.util.SparseArray;
  * when UI isn't present.
  */
 public class TerminalService extends Service {
+    /** Scrollback lines kept in memory; anything older goes to the cache dir */
+    private static final int HOT_SCROLLBACK_ROWS = 10000;
+
+    /** Share of the app's heap class that all scrollback together may take */
+    private static final int SCROLLBACK_BUDGET_DIVISOR = 8;
+
     private final SparseArray<Terminal> mTerminals = new SparseArray<Terminal>();
 
+    @Override
+    public void onCreate() {
+        super.onCreate();
+
+        final ActivityManager am = (ActivityManager) getSystemService(Context.ACTIVITY_SERVICE);
+        final long budget = (long) am.getMemoryClass() * 1024 * 1024 / SCROLLBACK_BUDGET_DIVISOR;
+        Terminal.setScrollbackBudget(budget);
+    }
+
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        Terminal.trimMemory(level);
+    }
+
     public class ServiceBinder extends Binder {
         public TerminalService getService() {
             return TerminalService.this;
@@ -51,6 +77,11 @@ public class TerminalService extends Service {
         }
 
         final Terminal term = new Terminal();
+        try {
+            term.setScrollbackSpill(getCacheDir(), HOT_SCROLLBACK_ROWS);
+        } catch (IllegalStateException e) {
+            Log.w(TAG, "Keeping all scrollback in memory", e);
+        }
         term.start();
         mTerminals.put(term.key, term);
         return term.key;
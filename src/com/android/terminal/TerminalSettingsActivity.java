@@ -36,11 +36,13 @@ public class TerminalSettingsActivity extends PreferenceActivity {
     public static final String KEY_SCREEN_ORIENTATION = "screen_orientation";
     public static final String KEY_FONT_SIZE = "font_size";
     public static final String KEY_TEXT_COLORS = "text_colors";
+    public static final String KEY_SCROLLBACK_ROWS = "scrollback_rows";
 
     private SwitchPreference mFullscreenModePref;
     private ListPreference mScreenOrientationPref;
     private ListPreference mFontSizePref;
     private ListPreference mTextColorsPref;
+    private ListPreference mScrollbackRowsPref;
 
     @Override
     protected void onCreate(Bundle savedInstanceState) {
@@ -51,6 +53,7 @@ public class TerminalSettingsActivity extends PreferenceActivity {
         mScreenOrientationPref = (ListPreference) findPreference(KEY_SCREEN_ORIENTATION);
         mFontSizePref = (ListPreference) findPreference(KEY_FONT_SIZE);
         mTextColorsPref = (ListPreference) findPreference(KEY_TEXT_COLORS);
+        mScrollbackRowsPref = (ListPreference) findPreference(KEY_SCROLLBACK_ROWS);
 
         getActionBar().setDisplayHomeAsUpEnabled(true);
     }
@@ -20,6 +20,7 @@ import static com.android.terminal.Terminal.TAG;
 
 import android.content.Context;
 import android.content.SharedPreferences;
+import android.graphics.Canvas;
 import android.graphics.Color;
 import android.graphics.Paint;
 import android.graphics.Paint.FontMetrics;
@@ -40,7 +41,10 @@ import android.widget.AdapterView;
 import android.widget.BaseAdapter;
 import android.widget.ListView;
 
+import java.util.Arrays;
+
 import com.android.terminal.Terminal.CellRun;
+import com.android.terminal.Terminal.RowRuns;
 import com.android.terminal.Terminal.TerminalClient;
 
 /**
@@ -60,9 +64,40 @@ public class TerminalView extends ListView {
     private int mCols;
     private int mScrollRows;
 
+    /**
+     * Position p of the list shows absolute line mBaseLine + p, so a line
+     * keeps its position and what was drawn for it as output scrolls it off
+     * the screen into scrollback. Lines trimmed from the top of history stay
+     * behind as blank positions until a screenful has piled up, and then
+     * positions are renumbered from the oldest line still held.
+     */
+    private long mBaseLine;
+    /** Line of screen row 0 in the frame the list was last updated for */
+    private long mScreenLine;
+
     private final TerminalMetrics mMetrics = new TerminalMetrics();
     private final TerminalKeys mTermKeys = new TerminalKeys();
 
+    /**
+     * Damage collected from the parser thread for the next damage pass.
+     * mPendingRows has one bit per screen row of the latest frame, whose
+     * row 0 is line mPendingLine. Guarded by mDamageLock.
+     */
+    private final Object mDamageLock = new Object();
+    private int[] mPendingRows = new int[0];
+    private long mPendingLine;
+    private long mPendingOffset;
+    /** Whether a frame has set mPendingLine since the terminal was attached */
+    private boolean mPendingKnown;
+    /** Dirty rows were scrolled into history before being redrawn */
+    private boolean mPendingHistory;
+    /** Screen contents moved without their lines, like on the alternate screen */
+    private boolean mPendingScreen;
+    private boolean mPendingAll;
+    /** Line the cursor was last reported on, or -1 */
+    private long mCursorLine = -1;
+    private boolean mDamagePosted;
+
     /**
      * Metrics shared between all {@link TerminalLineView} children. Locking
      * provided by main thread.
@@ -76,6 +111,8 @@ public class TerminalView extends ListView {
 
         /** Run of cells used when drawing */
         final CellRun run;
+        /** Runs of all visible rows, captured once per frame */
+        final RowRuns rowRuns;
         /** Screen coordinates to draw chars into */
         final float[] pos;
 
@@ -86,6 +123,7 @@ public class TerminalView extends ListView {
         public TerminalMetrics() {
             run = new Terminal.CellRun();
             run.data = new char[MAX_RUN_LENGTH];
+            rowRuns = new Terminal.RowRuns(MAX_RUN_LENGTH);
 
             // Positions of each possible cell
             // TODO: make sure this works with surrogate pairs
@@ -129,7 +167,7 @@ public class TerminalView extends ListView {
         @Override
         public void onItemClick(AdapterView<?> parent, View v, int pos, long id) {
             // Clicking on top half of view toggles fullscreen mode
-            if (pos - mScrollRows < mRows / 2) {
+            if (posToRow(pos) < mRows / 2) {
                 toggleFullscreenMode();
                 return;
             }
@@ -145,13 +183,148 @@ public class TerminalView extends ListView {
     private final Runnable mDamageRunnable = new Runnable() {
         @Override
         public void run() {
-            invalidateViews();
+            final int[] rows;
+            final long screenLine;
+            final boolean known;
+            final boolean history;
+            final boolean screen;
+            final boolean all;
+            synchronized (mDamageLock) {
+                rows = mPendingRows;
+                screenLine = mPendingLine;
+                known = mPendingKnown;
+                history = mPendingHistory;
+                screen = mPendingScreen;
+                all = mPendingAll;
+                mPendingRows = new int[rows.length];
+                mPendingHistory = false;
+                mPendingScreen = false;
+                mPendingAll = false;
+                mDamagePosted = false;
+            }
+
+            if (mTerm != null && known) {
+                updateLines(screenLine);
+            }
+
+            // Children keep the line they're bound to, so only those whose
+            // line changed need redrawing; rebinding takes care of the rest
+            final int childCount = getChildCount();
+            for (int i = 0; i < childCount; i++) {
+                final TerminalLineView child = (TerminalLineView) getChildAt(i);
+                final long row = child.line - screenLine;
+                final boolean dirty;
+                if (all || !known) {
+                    dirty = true;
+                } else if (row < 0) {
+                    dirty = history;
+                } else {
+                    dirty = screen || ((row >> 5) < rows.length
+                            && (rows[(int) (row >> 5)] & (1 << (row & 31))) != 0);
+                }
+                if (dirty) {
+                    child.invalidate();
+                }
+            }
             if (SCROLL_ON_DAMAGE) {
                 scrollToBottom(true);
             }
         }
     };
 
+    /**
+     * Catches the list up with a newer frame. Positions keep their lines, so
+     * usually only the length changes, as lines pushed into history add
+     * positions at the bottom.
+     */
+    private void updateLines(long screenLine) {
+        final long firstLine = mTerm.getFirstLine();
+        final long trimmed = firstLine - mBaseLine;
+        final int first = getFirstVisiblePosition();
+        final boolean rebase = trimmed < 0 || trimmed >= mRows
+                || (getChildCount() > 0 && first < trimmed);
+        if (!rebase && screenLine == mScreenLine) {
+            return;
+        }
+
+        final boolean atBottom = getLastVisiblePosition() >= mAdapter.getCount() - 1;
+        final View top = getChildAt(0);
+        mScreenLine = screenLine;
+        if (rebase) {
+            mBaseLine = firstLine;
+        }
+        mAdapter.notifyDataSetChanged();
+
+        if (rebase && top != null && !atBottom) {
+            // Stay on the lines being looked at
+            setSelectionFromTop((int) Math.max(0, first - trimmed), top.getTop());
+        }
+    }
+
+    /**
+     * Binds positions afresh, for when lines were renumbered or the list
+     * was attached to a terminal.
+     */
+    private void resetLines() {
+        mScreenLine = mTerm.getScreenLine();
+        mBaseLine = mTerm.getFirstLine();
+        mAdapter.notifyDataSetChanged();
+        synchronized (mDamageLock) {
+            mPendingAll = true;
+            postDamageLocked();
+        }
+    }
+
+    private void addPendingRowLocked(int row) {
+        if (row < 0) {
+            return;
+        }
+        if ((row >> 5) >= mPendingRows.length) {
+            mPendingRows = Arrays.copyOf(mPendingRows, (row >> 5) + 1);
+        }
+        mPendingRows[row >> 5] |= 1 << (row & 31);
+    }
+
+    private void addPendingLineLocked(long line) {
+        if (line < 0) {
+            return;
+        }
+        if (line < mPendingLine) {
+            mPendingHistory = true;
+        } else {
+            addPendingRowLocked((int) (line - mPendingLine));
+        }
+    }
+
+    /**
+     * Renumbers pending rows for a frame whose row 0 is {@code lines} further
+     * down, as rows keep their lines when the screen scrolls.
+     */
+    private void shiftPendingRowsLocked(long lines) {
+        final int[] rows = mPendingRows;
+        final int count = rows.length * 32;
+        for (int row = 0; row < count; row++) {
+            final int bit = 1 << (row & 31);
+            if ((rows[row >> 5] & bit) == 0) {
+                continue;
+            }
+            rows[row >> 5] &= ~bit;
+            final long moved = row - lines;
+            if (moved < 0) {
+                mPendingHistory = true;
+            } else {
+                rows[(int) (moved >> 5)] |= 1 << (moved & 31);
+            }
+        }
+    }
+
+    private void postDamageLocked() {
+        if (!mDamagePosted) {
+            mDamagePosted = true;
+            post(mDamageRunnable);
+        }
+    }
+
     private final float PT_PER_INCH = 72.0f;
     private float ptToDp(float pt) {
         return (pt / PT_PER_INCH) * (float)DisplayMetrics.DENSITY_DEFAULT;
@@ -174,6 +347,9 @@ public class TerminalView extends ListView {
         setFocusable(true);
         setFocusableInTouchMode(true);
 
+        // The list grows as history does, and should follow it when at the end
+        setTranscriptMode(TRANSCRIPT_MODE_NORMAL);
+
         setAdapter(mAdapter);
         setOnKeyListener(mKeyListener);
 
@@ -190,8 +366,12 @@ public class TerminalView extends ListView {
                 view = new TerminalLineView(parent.getContext(), mTerm, mMetrics);
             }
 
-            view.pos = position;
-            view.row = posToRow(position);
+            final long line = mBaseLine + position;
+            if (view.line != line || view.cols != mCols) {
+                // Recycled from another line, so what it drew is stale
+                view.invalidate();
+            }
+            view.line = line;
             view.cols = mCols;
             return view;
         }
@@ -209,7 +389,7 @@ public class TerminalView extends ListView {
         @Override
         public int getCount() {
             if (mTerm != null) {
-                return mRows + mScrollRows;
+                return (int) (mScreenLine + mRows - mBaseLine);
             } else {
                 return 0;
             }
@@ -218,20 +398,51 @@ public class TerminalView extends ListView {
 
     private TerminalClient mClient = new TerminalClient() {
         @Override
-        public void onDamage(final int startRow, final int endRow, int startCol, int endCol) {
-            post(mDamageRunnable);
+        public void onFrame(long screenLine, long scrollOffset) {
+            synchronized (mDamageLock) {
+                final long lines = screenLine - mPendingLine;
+                final long scrolled = scrollOffset - mPendingOffset;
+                if (!mPendingKnown || lines < 0) {
+                    // Lines came back out of history, like on resize
+                    mPendingAll = true;
+                    postDamageLocked();
+                } else if (lines > 0 || scrolled > 0) {
+                    // Rows pushed into history kept their lines; anything
+                    // else that scrolled is now showing a different line
+                    shiftPendingRowsLocked(lines);
+                    if (scrolled != lines) {
+                        mPendingScreen = true;
+                    }
+                    postDamageLocked();
+                }
+                mPendingKnown = true;
+                mPendingLine = screenLine;
+                mPendingOffset = scrollOffset;
+            }
         }
 
         @Override
-        public void onMoveRect(int destStartRow, int destEndRow, int destStartCol, int destEndCol,
-                int srcStartRow, int srcEndRow, int srcStartCol, int srcEndCol) {
-            post(mDamageRunnable);
+        public void onDamage(int startRow, int endRow, int[] dirtyRows) {
+            synchronized (mDamageLock) {
+                for (int row = startRow; row < endRow; row++) {
+                    if ((dirtyRows[row >> 5] & (1 << (row & 31))) != 0) {
+                        addPendingRowLocked(row);
+                    }
+                }
+                postDamageLocked();
+            }
         }
 
         @Override
         public void onMoveCursor(int posRow, int posCol, int oldPosRow,
                 int oldPosCol, int visible) {
-            post(mDamageRunnable);
+            synchronized (mDamageLock) {
+                // The old row was on an earlier frame, so go by its line
+                addPendingLineLocked(mCursorLine);
+                addPendingRowLocked(posRow);
+                mCursorLine = mPendingLine + posRow;
+                postDamageLocked();
+            }
         }
 
         @Override
@@ -240,12 +451,8 @@ public class TerminalView extends ListView {
         }
     };
 
-    private int rowToPos(int row) {
-        return row + mScrollRows;
-    }
-
     private int posToRow(int pos) {
-        return pos - mScrollRows;
+        return (int) (mBaseLine + pos - mScreenLine);
     }
 
     private View.OnKeyListener mKeyListener = new OnKeyListener() {
@@ -289,10 +496,25 @@ public class TerminalView extends ListView {
             mCols = cols;
             mScrollRows = scrollRows;
 
-            mAdapter.notifyDataSetChanged();
+            // Rewrapping history renumbers its lines
+            resetLines();
         }
     }
 
+    @Override
+    protected void dispatchDraw(Canvas canvas) {
+        // Capture every visible row in one pass before children draw
+        final int childCount = getChildCount();
+        if (mTerm != null && childCount > 0) {
+            final long first = mBaseLine + getFirstVisiblePosition();
+            mTerm.getLineRuns(first, first + childCount, mMetrics.rowRuns);
+        }
+        super.dispatchDraw(canvas);
+
+        // Children redrawn on their own later must not see a stale frame
+        mMetrics.rowRuns.clear();
+    }
+
     public void scrollToBottom(boolean animate) {
         final int dur = animate ? 250 : 0;
         smoothScrollToPositionFromTop(getCount(), 0, dur);
@@ -306,6 +528,10 @@ public class TerminalView extends ListView {
         }
         mTerm = term;
         mScrolled = false;
+        synchronized (mDamageLock) {
+            mPendingKnown = false;
+            mCursorLine = -1;
+        }
         if (term != null) {
             term.setClient(mClient);
             mTermKeys.setTerminal(term);
@@ -316,7 +542,7 @@ public class TerminalView extends ListView {
             mRows = mTerm.getRows();
             mCols = mTerm.getCols();
             mScrollRows = mTerm.getScrollRows();
-            mAdapter.notifyDataSetChanged();
+            resetLines();
         }
     }
 
@@ -344,6 +570,16 @@ public class TerminalView extends ListView {
             EditorInfo.IME_ACTION_NONE;
         outAttrs.inputType = EditorInfo.TYPE_NULL;
         return new BaseInputConnection(this, false) {
+            @Override
+            public boolean commitText(CharSequence text, int newCursorPosition) {
+                // Single characters still go through key handling for modifiers
+                if (mTerm != null && text.length() > 1) {
+                    mTerm.dispatchText(text.toString());
+                    return true;
+                }
+                return super.commitText(text, newCursorPosition);
+            }
+
             @Override
             public boolean deleteSurroundingText (int leftLength, int rightLength) {
                 KeyEvent k;
@@ -388,5 +624,19 @@ public class TerminalView extends ListView {
         mMetrics.run.fg = fg;
         mMetrics.run.bg = bg;
         mMetrics.cursorPaint.setColor(fg);
+
+        val = sp.getString(TerminalSettingsActivity.KEY_SCROLLBACK_ROWS, "1000");
+        int scrollRows = mTerm.getScrollRows();
+        try {
+            scrollRows = Integer.parseInt(val);
+        } catch (NumberFormatException e) {
+            // Ignore
+        }
+        if (scrollRows != mTerm.getScrollRows()) {
+            // Existing history is kept across capacity changes
+            mTerm.resize(mTerm.getRows(), mTerm.getCols(), scrollRows);
+            mScrollRows = scrollRows;
+            resetLines();
+        }
     }
 }